@@ -0,0 +1,153 @@
+//Node allocation with and without a NodeArena: the same expression is
+//differentiated, simplified and destroyed over and over (allocation is a
+//small part of that), then only copied and destroyed (little else but
+//allocation). Each is run with every node calloc()'d (no arena bound) and
+//from the context's arena, taking turns, best of BENCH_REPEATS each way.
+//calloc() and free() are counted here (glibc only, free(NULL) left out),
+//the counts are those of the first, cold run each way. While differentiating,
+//the parsed tree stays alive, so recycled nodes come back scattered over the
+//slabs and the time is about even. Copies handed out after a reset are
+//contiguous
+#include "diff/derivative.h"
+#include "diff/io/parse.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const size_t BENCH_TERMS   = 2000;
+static const size_t BENCH_ROUNDS  = 50;
+static const size_t BENCH_REPEATS = 5;
+
+struct AllocCalls {
+  size_t callocs = 0;
+  size_t frees   = 0;
+};
+
+typedef void (*workload_f)(Context* ctx, TreeNode* tree);
+
+struct Workload {
+  const char* name = NULL;
+  workload_f  run  = NULL;
+};
+
+static AllocCalls ALLOC_CALLS = {};
+
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void  __libc_free(void* ptr);
+
+extern "C" void* calloc(size_t count, size_t size) {
+  ALLOC_CALLS.callocs++;
+  return __libc_calloc(count, size);
+}
+
+extern "C" void free(void* ptr) {
+  if (ptr)
+    ALLOC_CALLS.frees++;
+  __libc_free(ptr);
+}
+
+static double now();
+static void compare(Context* ctx, const char* formula, Workload workload);
+static double run(Context* ctx, const char* formula, Workload workload,
+                  AllocCalls* calls);
+static void differentiateRounds(Context* ctx, TreeNode* tree);
+static void copyRounds(Context* ctx, TreeNode* tree);
+
+int main() {
+  Context ctx = {};
+  if (contextInit(&ctx, 8))
+    return EXIT_FAILURE;
+
+  const char term[] = "x*sin(x)/(x+1)";
+  size_t length = BENCH_TERMS * sizeof(term);
+  char* formula = (char*)calloc(length, sizeof(char));
+  if (!formula)
+    return EXIT_FAILURE;
+  for (size_t i = 0; i < BENCH_TERMS; i++) {
+    if (i)
+      strcat(formula, "+");
+    strcat(formula, term);
+  }
+
+  printf("%zu terms x %zu rounds\n", BENCH_TERMS, BENCH_ROUNDS);
+  compare(&ctx, formula, {"differentiate", differentiateRounds});
+  compare(&ctx, formula, {"copy",          copyRounds});
+
+  free(formula);
+  contextDestroy(&ctx);
+  return EXIT_SUCCESS;
+}
+
+static double now() {
+  timespec time = {};
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+//Leaves the context's arena bound, like it was
+static void compare(Context* ctx, const char* formula, Workload workload) {
+  NodeArena* arena = nodeArenaBind(NULL);
+  double heapTime  = INFINITY;
+  double arenaTime = INFINITY;
+  AllocCalls heapCalls  = {};
+  AllocCalls arenaCalls = {};
+  NodeArenaStats stats = {};
+  for (size_t i = 0; i < BENCH_REPEATS; i++) {
+    AllocCalls calls = {};
+    nodeArenaBind(NULL);
+    double time = run(ctx, formula, workload, &calls);
+    if (time < heapTime)
+      heapTime = time;
+    if (!i)
+      heapCalls = calls;
+
+    nodeArenaBind(arena);
+    NodeArenaStats before = arena->stats;
+    time = run(ctx, formula, workload, &calls);
+    if (time < arenaTime)
+      arenaTime = time;
+    if (!i) {
+      arenaCalls = calls;
+      stats = arena->stats;
+      stats.slabAllocs -= before.slabAllocs;
+      stats.nodeAllocs -= before.nodeAllocs;
+    }
+  }
+
+  printf("%-14s calloc %.3f s, arena %.3f s (x%.2f)\n",
+         workload.name, heapTime, arenaTime, heapTime / arenaTime);
+  printf("  without arena: %zu calloc(), %zu free()\n",
+         heapCalls.callocs, heapCalls.frees);
+  printf("  with arena:    %zu calloc() (%zu of them slabs), %zu free(), "
+         "%zu nodes handed out\n",
+         arenaCalls.callocs, stats.slabAllocs, arenaCalls.frees, stats.nodeAllocs);
+}
+
+//Parses, then times the workload, calls are those of the whole run
+static double run(Context* ctx, const char* formula, Workload workload,
+                  AllocCalls* calls) {
+  AllocCalls before = ALLOC_CALLS;
+  TreeNode* tree = parseFormula(formula, strlen(formula), ctx->vars);
+
+  double start = now();
+  workload.run(ctx, tree);
+  double time = now() - start;
+
+  nodeDestroy(tree, true);
+  calls->callocs = ALLOC_CALLS.callocs - before.callocs;
+  calls->frees   = ALLOC_CALLS.frees   - before.frees;
+  return time;
+}
+
+static void differentiateRounds(Context* ctx, TreeNode* tree) {
+  for (size_t i = 0; i < BENCH_ROUNDS; i++) {
+    TreeNode* diff = differentiate(ctx, tree, "x");
+    nodeOptimize(&diff);
+    nodeDestroy(diff, true);
+  }
+}
+
+static void copyRounds(Context*, TreeNode* tree) {
+  for (size_t i = 0; i < BENCH_ROUNDS; i++)
+    nodeDestroy(nodeCopy(tree, NULL), true);
+}
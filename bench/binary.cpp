@@ -0,0 +1,137 @@
+//A balanced random tree of a million nodes written in the text format of
+//nodeRead() and in the binary one, then read back by treeRead() and
+//treeReadBinary(), best of BENCH_RUNS each. Both must give the same tree
+#include "diff/io/binary.h"
+#include "diff/io/io.h"
+#include "misc/util.h"
+#include <stdlib.h>
+#include <time.h>
+
+static const size_t BENCH_NODES = 1000000;
+static const int    BENCH_RUNS  = 3;
+
+static uint64_t BENCH_SEED = 88172645463325252ull;
+
+typedef TreeRoot* (*reader_f)(FILE* file, Variables* vars, Error* status);
+
+static double now();
+static uint benchRandom();
+static TreeNode* benchTree(size_t nodes);
+static void textWrite(FILE* file, Variables* vars, TreeNode* node);
+static long fileSize(FILE* file);
+static double readBest(FILE* file, reader_f reader, Variables* vars, TreeRoot** root);
+
+int main() {
+  Context ctx = {};
+  if (contextInit(&ctx, 8))
+    return EXIT_FAILURE;
+  regVar(ctx.vars, "x");
+  regVar(ctx.vars, "yy");
+  regVar(ctx.vars, "zed");
+
+  TreeNode* tree = benchTree(BENCH_NODES);
+  FILE* text   = tmpfile();
+  FILE* binary = tmpfile();
+  if (!tree || !text || !binary)
+    return EXIT_FAILURE;
+  nodeFixParents(tree);
+
+  textWrite(text, ctx.vars, tree);
+  double start = now();
+  Error err = nodeWriteBinary(binary, ctx.vars, tree);
+  double writeTime = now() - start;
+  if (err ||
+      fflush(text) || fflush(binary))
+    return EXIT_FAILURE;
+
+  TreeRoot* textRoot   = NULL;
+  TreeRoot* binaryRoot = NULL;
+  double textTime   = readBest(text,   treeRead,       ctx.vars, &textRoot);
+  double binaryTime = readBest(binary, treeReadBinary, ctx.vars, &binaryRoot);
+  bool isOk = textRoot && binaryRoot &&
+              textRoot->nodeCount == BENCH_NODES &&
+              nodeEqual(textRoot->rootNode, tree) &&
+              nodeEqual(binaryRoot->rootNode, tree);
+
+  printf("%zu nodes, binary written in %.3f s\n", BENCH_NODES, writeTime);
+  printf("treeRead       %.3f s, %8.2f MB\n", textTime,   (double)fileSize(text)   / 1e6);
+  printf("treeReadBinary %.3f s, %8.2f MB (x%.2f) %s\n", binaryTime,
+         (double)fileSize(binary) / 1e6, textTime / binaryTime, isOk ? "ok" : "FAILED");
+
+  if (textRoot)
+    treeDestroy(textRoot, true);
+  if (binaryRoot)
+    treeDestroy(binaryRoot, true);
+  fclose(text);
+  fclose(binary);
+  nodeDestroy(tree, true);
+  contextDestroy(&ctx);
+  return isOk ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static double now() {
+  timespec time = {};
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+//xorshift, the same tree every run
+static uint benchRandom() {
+  BENCH_SEED ^= BENCH_SEED << 13;
+  BENCH_SEED ^= BENCH_SEED >> 7;
+  BENCH_SEED ^= BENCH_SEED << 17;
+  return (uint)BENCH_SEED;
+}
+
+//Balanced, so recursing here is only ~20 deep
+static TreeNode* benchTree(size_t nodes) {
+  if (nodes <= 1)
+    return (benchRandom() & 1)
+           ? VAR_(benchRandom() % 3)
+           : NUM_((double)(benchRandom() % 1000) / 8 - 50);
+  if (nodes == 2)
+    return SIN_(benchTree(1));
+
+  static const OpType ops[] = {OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW, OP_LOG};
+  size_t left = (nodes - 1) / 2;
+  return nodeAlloc({OP_TYPE, ops[benchRandom() % sizer(ops)]}, NULL,
+                   benchTree(left), benchTree(nodes - 1 - left));
+}
+
+//(token left right), a missing child is nil
+static void textWrite(FILE* file, Variables* vars, TreeNode* node) {
+  if (!node) {
+    fputs("nil ", file);
+    return;
+  }
+  fputc('(', file);
+  nodePrint(file, vars, node);
+  fputc(' ', file);
+  textWrite(file, vars, node->left);
+  textWrite(file, vars, node->right);
+  fputs(") ", file);
+}
+
+static long fileSize(FILE* file) {
+  fseek(file, 0, SEEK_END);
+  return ftell(file);
+}
+
+//Keeps the tree of the last run
+static double readBest(FILE* file, reader_f reader, Variables* vars, TreeRoot** root) {
+  double best = INFINITY;
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    if (*root)
+      treeDestroy(*root, true);
+    rewind(file);
+    Error err = OK;
+    double start = now();
+    *root = reader(file, vars, &err);
+    double time = now() - start;
+    if (err)
+      return INFINITY;
+    if (time < best)
+      best = time;
+  }
+  return best;
+}
@@ -0,0 +1,109 @@
+//Every tree walk on an expression a million nodes deep: none of them may
+//use the call stack per node. The chain alternates sides, (... + x*1) on the
+//left and x - (...) on the right, so the derivative stays linear in size
+#include "diff/derivative.h"
+#include "diff/eval/tape.h"
+#include "diff/io/io.h"
+#include "ds/tree/rewrite.h"
+#include "misc/util.h"
+#include <stdlib.h>
+#include <time.h>
+
+static const size_t DEEP_TERMS = 1000000;
+
+static double now();
+static void report(const char* what, double start, bool isOk);
+
+int main() {
+  Context ctx = {};
+  if (contextInit(&ctx, 8))
+    return EXIT_FAILURE;
+  size_t x = regVar(ctx.vars, "x");
+
+  TreeNode* tree = VAR_(x);
+  for (size_t i = 0; i < DEEP_TERMS && tree; i++)
+    tree = (i % 2)
+           ? ADD_(tree, MUL_(VAR_(x), NUM_(1)))
+           : SUB_(VAR_(x), tree);
+  if (!tree)
+    return EXIT_FAILURE;
+  nodeFixParents(tree);
+
+  double start = now();
+  TreeNode* copy = nodeCopy(tree, NULL);
+  report("nodeCopy, nodeEqual", start, nodeEqual(tree, copy));
+  nodeDestroy(copy, true);
+
+  start = now();
+  TreeNode* diff = differentiate(&ctx, tree, "x");
+  report("differentiate", start, diff);
+
+  start = now();
+  report("nodeOptimize", start, !nodeOptimize(&diff) && OF_NUM(diff, 1));
+
+  nodeDestroy(diff, true);
+
+  //x - (x*1 + (x - ...)) is x or 0 every other term
+  start = now();
+  Error err = OK;
+  Tape* tape = tapeCompile(tree, &err);
+  setVarValue(ctx.vars, "x", 2);
+  report("tapeCompile, tapeEval", start,
+         !err && doubleEqual(tapeEvalVars(tape, ctx.vars), 2));
+  tapeDestroy(tape, true);
+
+  //x*1 goes, the rest stays as it is: same value as before
+  start = now();
+  copy = nodeCopy(tree, NULL);
+  err = copy ? nodeRewrite(&copy) : FailMemoryAllocation;
+  tape = err ? NULL : tapeCompile(copy, &err);
+  report("nodeRewrite", start,
+         !err && doubleEqual(tapeEvalVars(tape, ctx.vars), 2));
+  tapeDestroy(tape, true);
+  nodeDestroy(copy, true);
+
+  ctx.sink = fopen("/dev/null", "w");
+  start = now();
+  report("nodeToTex", start, ctx.sink && !nodeToTex(&ctx, tree));
+
+  start = now();
+  contextSetReport(&ctx, {.detail = TEX_REPORT_TOP});
+  diff = differentiate(&ctx, tree, "x");
+  report("differentiate, top step", start, diff);
+  nodeDestroy(diff, true);
+
+  start = now();
+  report("contextCse", start, !contextCse(&ctx, &tree));
+
+  start = now();
+  report("nodeToTexNamed", start, ctx.sink && !nodeToTexNamed(&ctx, tree));
+  fclose(ctx.sink);
+  ctx.sink = NULL;
+
+  start = now();
+  report("nodeCountExpanded", start,
+         nodeCountExpanded(tree) == 1 + DEEP_TERMS / 2 * 6);
+
+  start = now();
+  report("nodeStoreOptimize", start, !nodeStoreOptimize(ctx.store, &tree));
+
+  start = now();
+  contextEnableDiffCache(&ctx);
+  diff = differentiate(&ctx, tree, "x");
+  report("differentiate, cached", start, diff);
+  nodeDestroy(diff, true);
+
+  nodeDestroy(tree, true);
+  contextDestroy(&ctx);
+  return EXIT_SUCCESS;
+}
+
+static double now() {
+  timespec time = {};
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+static void report(const char* what, double start, bool isOk) {
+  printf("%-24s %.3f s %s\n", what, now() - start, isOk ? "ok" : "FAILED");
+}
@@ -0,0 +1,99 @@
+//nodeOptimize() on expressions of doubling size, best of BENCH_RUNS on a
+//fresh copy each: time per node has to stay flat for the pass to be linear.
+//  product  derivative of sin(x) * prod (sin(k x) + 1)
+//  chain    sin(...sin(sin(0 * x) * x)...) * x, folding and neutral rules
+//           alternate up the whole chain, the fixed point loop's worst case
+#include "diff/derivative.h"
+#include <stdlib.h>
+#include <time.h>
+
+static const int BENCH_RUNS = 3;
+
+static double now();
+static TreeNode* productDerivative(Context* ctx, size_t factors);
+static TreeNode* foldChain(size_t levels);
+static bool optimizeBest(TreeNode* tree, double* best, size_t* before, size_t* after);
+static void report(const char* name, size_t size, TreeNode* tree, bool* isOk);
+
+int main() {
+  Context ctx = {};
+  if (contextInit(&ctx, 8))
+    return EXIT_FAILURE;
+  regVar(ctx.vars, "x");
+
+  bool isOk = true;
+  printf("%-8s %6s %10s %10s %10s %8s\n",
+         "", "size", "nodes", "result", "ms", "ns/node");
+  for (size_t factors = 25; factors <= 800; factors *= 2)
+    report("product", factors, productDerivative(&ctx, factors), &isOk);
+  for (size_t levels = 1000; levels <= 64000; levels *= 2)
+    report("chain", levels, foldChain(levels), &isOk);
+
+  contextDestroy(&ctx);
+  return isOk ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static double now() {
+  timespec time = {};
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+static TreeNode* productDerivative(Context* ctx, size_t factors) {
+  TreeNode* tree = SIN_(VAR_(0));
+  for (size_t k = 0; k < factors && tree; k++)
+    tree = MUL_(tree, ADD_(SIN_(MUL_(NUM_((double)(k % 3)), VAR_(0))), NUM_(1)));
+  if (!tree)
+    return NULL;
+  nodeFixParents(tree);
+  TreeNode* diff = differentiate(ctx, tree, "x");
+  nodeDestroy(tree, true);
+  return diff;
+}
+
+static TreeNode* foldChain(size_t levels) {
+  TreeNode* tree = MUL_(NUM_(0), VAR_(0));
+  for (size_t k = 0; k < levels && tree; k++)
+    tree = MUL_(SIN_(tree), VAR_(0));
+  if (tree)
+    nodeFixParents(tree);
+  return tree;
+}
+
+//Every run gets a copy of tree, the copying isn't timed
+static bool optimizeBest(TreeNode* tree, double* best, size_t* before, size_t* after) {
+  *best = INFINITY;
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    TreeNode* copy = nodeCopy(tree, NULL);
+    if (!copy)
+      return false;
+    *before = 0;
+    nodeTraverse(copy, .prefix = countNodesCallback, .prefixData = before);
+    *after = *before;
+
+    double start = now();
+    Error err = nodeOptimize(&copy, after);
+    double time = now() - start;
+    nodeDestroy(copy, true);
+    if (err)
+      return false;
+    if (time < *best)
+      *best = time;
+  }
+  return true;
+}
+
+static void report(const char* name, size_t size, TreeNode* tree, bool* isOk) {
+  double best   = 0;
+  size_t before = 0;
+  size_t after  = 0;
+  if (!tree ||
+      !optimizeBest(tree, &best, &before, &after)) {
+    printf("%-8s %6zu FAILED\n", name, size);
+    *isOk = false;
+  } else {
+    printf("%-8s %6zu %10zu %10zu %10.3f %8.1f\n", name, size, before, after,
+           best * 1e3, best * 1e9 / (double)before);
+  }
+  nodeDestroy(tree, true);
+}
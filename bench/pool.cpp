@@ -0,0 +1,101 @@
+//One derivative evaluated at a few million points by an EvalPool of 1 to as
+//many threads as there are online cpus: best of BENCH_RUNS after a warm up run,
+//with the speedup over one thread. Every run must give the same doubles as
+//tapeEvalBatch on the calling thread
+#include "diff/derivative.h"
+#include "diff/eval/pool.h"
+#include "diff/io/parse.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const size_t BENCH_POINTS = 1 << 22;
+static const int    BENCH_RUNS   = 3;
+
+static double now();
+
+int main() {
+  Context ctx = {};
+  if (contextInit(&ctx, 8))
+    return EXIT_FAILURE;
+  size_t x = regVar(ctx.vars, "x");
+  size_t y = regVar(ctx.vars, "y");
+
+  const char formula[] = "sin(x*y)/(x^2+1)+cosh(x/(y+3))*ln(y^2+x^2+1)-x^3*cos(y)";
+  TreeNode* tree = parseFormula(formula, strlen(formula), ctx.vars);
+  TreeNode* diff = tree ? differentiate(&ctx, tree, "x") : NULL;
+  if (!diff ||
+      nodeOptimize(&diff))
+    return EXIT_FAILURE;
+
+  Error err = OK;
+  Tape* tape = tapeCompile(diff, &err);
+  if (err)
+    return EXIT_FAILURE;
+  double** columns = (double**)calloc(tape->varCount, sizeof(double*));
+  double* expected = (double*)calloc(BENCH_POINTS, sizeof(double));
+  double* out      = (double*)calloc(BENCH_POINTS, sizeof(double));
+  if (!columns || !expected || !out)
+    return EXIT_FAILURE;
+  for (size_t v = 0; v < tape->varCount; v++) {
+    columns[v] = (double*)calloc(BENCH_POINTS, sizeof(double));
+    if (!columns[v])
+      return EXIT_FAILURE;
+  }
+  for (size_t i = 0; i < BENCH_POINTS; i++) {
+    columns[x][i] = -2 + 4 * (double)i / BENCH_POINTS;
+    columns[y][i] =  1 + (double)(i % 1000) / 1000;
+  }
+  if (tapeEvalBatch(tape, columns, BENCH_POINTS, expected))
+    return EXIT_FAILURE;
+
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t maxThreads = online > 0 ? (size_t)online : 1;
+  printf("%zu points, %zu instructions, %s path, %zu cpus\n",
+         BENCH_POINTS, tape->count, batchPathName(batchDetectPath()), maxThreads);
+
+  double single = 0;
+  for (size_t threads = 1; threads <= maxThreads && !err; threads++) {
+    EvalPool* pool = evalPoolAlloc(threads, EVAL_POOL_DEFAULT_CHUNK_BYTES, &err);
+    if (err)
+      break;
+
+    //first run only warms up caches and worker scratch
+    err = evalPoolRun(pool, tape, columns, BENCH_POINTS, out);
+    double best = INFINITY;
+    for (int run = 0; run < BENCH_RUNS && !err; run++) {
+      memset(out, 0, BENCH_POINTS * sizeof(double));
+      double start = now();
+      err = evalPoolRun(pool, tape, columns, BENCH_POINTS, out);
+      double time = now() - start;
+      if (time < best)
+        best = time;
+    }
+    evalPoolDestroy(pool, true);
+
+    if (threads == 1)
+      single = best;
+    bool isOk = !err && !memcmp(out, expected, BENCH_POINTS * sizeof(double));
+    printf("%3zu threads: %10.3f ms %8.2f ns/point %6.2fx %s\n",
+           threads, best * 1e3, best * 1e9 / BENCH_POINTS, single / best,
+           isOk ? "ok" : "FAILED");
+  }
+
+  for (size_t v = 0; v < tape->varCount; v++)
+    free(columns[v]);
+  free(columns);
+  free(expected);
+  free(out);
+  tapeDestroy(tape, true);
+  nodeDestroy(diff, true);
+  nodeDestroy(tree, true);
+  contextDestroy(&ctx);
+  return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static double now() {
+  timespec time = {};
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
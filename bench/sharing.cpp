@@ -0,0 +1,95 @@
+//Derivatives of deeply nested expressions as plain trees and as DAGs
+//(contextEnableSharing()), each in a context of its own so its arena counts
+//only those nodes. Peak is the most nodes alive at once while differentiating,
+//the expression itself included, and both must write out to the same tree.
+//  sin      sin(sin(...sin(x)...))
+//  product  (...((x * (x + 1)) * (x + 2))...) * (x + depth)
+#include "diff/derivative.h"
+#include <stdlib.h>
+#include <time.h>
+
+enum Nesting {
+  NESTING_SIN,
+  NESTING_PRODUCT,
+};
+
+struct SharingRun {
+  double time  = 0;
+  size_t nodes = 0; //of the derivative written out as a tree
+  size_t peak  = 0;
+};
+
+static double now();
+static TreeNode* nested(Nesting nesting, size_t depth);
+static bool differentiateNested(Nesting nesting, size_t depth, bool isShared, SharingRun* run);
+static void report(const char* name, Nesting nesting, size_t depth, bool* isOk);
+
+int main() {
+  bool isOk = true;
+  printf("%-8s %5s %10s %10s %10s %9s %9s\n", "", "depth", "nodes",
+         "tree peak", "dag peak", "tree ms", "dag ms");
+  for (size_t depth = 16; depth <= 1024; depth *= 2)
+    report("sin", NESTING_SIN, depth, &isOk);
+  for (size_t depth = 16; depth <= 1024; depth *= 2)
+    report("product", NESTING_PRODUCT, depth, &isOk);
+  printf("a node is %zu bytes\n", sizeof(TreeNode));
+  return isOk ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static double now() {
+  timespec time = {};
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+//Var 0 is x, built bottom up so a bound store interns it as it goes
+static TreeNode* nested(Nesting nesting, size_t depth) {
+  TreeNode* tree = VAR_(0);
+  for (size_t k = 1; k <= depth && tree; k++)
+    tree = (nesting == NESTING_SIN)
+           ? SIN_(tree)
+           : MUL_(tree, ADD_(VAR_(0), NUM_((double)k)));
+  if (tree)
+    nodeFixParents(tree);
+  return tree;
+}
+
+static bool differentiateNested(Nesting nesting, size_t depth, bool isShared, SharingRun* run) {
+  Context ctx = {};
+  if (contextInit(&ctx, 8))
+    return false;
+  regVar(ctx.vars, "x");
+  if (isShared &&
+      contextEnableSharing(&ctx)) {
+    contextDestroy(&ctx);
+    return false;
+  }
+
+  TreeNode* tree = nested(nesting, depth);
+  ctx.arena->stats.peakNodes = ctx.arena->stats.liveNodes;
+  double start = now();
+  TreeNode* diff = tree ? differentiate(&ctx, tree, "x") : NULL;
+  run->time  = now() - start;
+  run->peak  = ctx.arena->stats.peakNodes;
+  run->nodes = nodeCountExpanded(diff);
+  bool isOk  = diff;
+
+  nodeDestroy(diff, true);
+  nodeDestroy(tree, true);
+  contextDestroy(&ctx);
+  return isOk;
+}
+
+static void report(const char* name, Nesting nesting, size_t depth, bool* isOk) {
+  SharingRun tree = {};
+  SharingRun dag  = {};
+  if (!differentiateNested(nesting, depth, false, &tree) ||
+      !differentiateNested(nesting, depth, true,  &dag)  ||
+      tree.nodes != dag.nodes) {
+    printf("%-8s %5zu FAILED\n", name, depth);
+    *isOk = false;
+    return;
+  }
+  printf("%-8s %5zu %10zu %10zu %10zu %9.3f %9.3f\n", name, depth,
+         tree.nodes, tree.peak, dag.peak, tree.time * 1e3, dag.time * 1e3);
+}
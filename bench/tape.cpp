@@ -0,0 +1,76 @@
+//One derivative evaluated at a million points: tapeEvalMany() against
+//nodeEval() called on the tree once per point. Both must give the same doubles
+#include "diff/derivative.h"
+#include "diff/eval/tape.h"
+#include "diff/io/parse.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const size_t BENCH_POINTS = 1000000;
+
+static double now();
+
+int main() {
+  Context ctx = {};
+  if (contextInit(&ctx, 8))
+    return EXIT_FAILURE;
+  size_t x = regVar(ctx.vars, "x");
+  size_t y = regVar(ctx.vars, "y");
+  size_t stride = (x > y ? x : y) + 1;
+
+  const char formula[] = "sin(x*y)/(x^2+1)+cosh(x/(y+3))*ln(y^2+x^2+1)-x^3*cos(y)";
+  TreeNode* tree = parseFormula(formula, strlen(formula), ctx.vars);
+  TreeNode* diff = tree ? differentiate(&ctx, tree, "x") : NULL;
+  if (!diff ||
+      nodeOptimize(&diff))
+    return EXIT_FAILURE;
+
+  Error err = OK;
+  Tape* tape = tapeCompile(diff, &err);
+  double* points = (double*)calloc(BENCH_POINTS * stride, sizeof(double));
+  double* tapeOut = (double*)calloc(BENCH_POINTS, sizeof(double));
+  double* treeOut = (double*)calloc(BENCH_POINTS, sizeof(double));
+  if (err ||
+      !points || !tapeOut || !treeOut)
+    return EXIT_FAILURE;
+  for (size_t i = 0; i < BENCH_POINTS; i++) {
+    points[i * stride + x] = -2 + 4 * (double)i / BENCH_POINTS;
+    points[i * stride + y] =  1 + (double)(i % 1000) / 1000;
+  }
+
+  double start = now();
+  err = tapeEvalMany(tape, points, stride, BENCH_POINTS, tapeOut);
+  double tapeTime = now() - start;
+
+  start = now();
+  for (size_t i = 0; i < BENCH_POINTS; i++)
+    treeOut[i] = nodeEval(diff, points + i * stride);
+  double treeTime = now() - start;
+
+  size_t mismatches = 0;
+  for (size_t i = 0; i < BENCH_POINTS; i++)
+    if (memcmp(tapeOut + i, treeOut + i, sizeof(double)))
+      mismatches++;
+
+  printf("%zu instructions x %zu points\n", tape->count, BENCH_POINTS);
+  printf("nodeEval     %.3f s\n", treeTime);
+  printf("tapeEvalMany %.3f s (x%.2f), %zu mismatches %s\n",
+         tapeTime, treeTime / tapeTime, mismatches,
+         !err && !mismatches ? "ok" : "FAILED");
+
+  free(points);
+  free(tapeOut);
+  free(treeOut);
+  tapeDestroy(tape, true);
+  nodeDestroy(diff, true);
+  nodeDestroy(tree, true);
+  contextDestroy(&ctx);
+  return EXIT_SUCCESS;
+}
+
+static double now() {
+  timespec time = {};
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
@@ -0,0 +1,131 @@
+//An expression over 100 variables differentiated by each of them, best of
+//BENCH_RUNS: by name through differentiate() (one lookup per call) and by
+//index through differentiateByIndex(). The last two lines isolate what
+//matching a variable costs on every node of the expression: ofVar() (lookup,
+//varsVerify() and strcmp(), what each VAR_TYPE node went through before)
+//against comparing indices
+#include "diff/derivative.h"
+#include "diff/io/parse.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const size_t BENCH_VARS    = 100;
+static const size_t BENCH_REPEATS = 10; //every variable shows up in this many terms
+static const int    BENCH_RUNS    = 5;
+
+struct MatchData {
+  Variables*  vars  = NULL;
+  const char* name  = NULL;
+  size_t      index = 0;
+  size_t      found = 0;
+};
+
+static double now();
+static double differentiateAll(Context* ctx, TreeNode* tree, bool byIndex, size_t* nodes);
+static double matchAll(Context* ctx, TreeNode* tree, callback_f match, size_t* found);
+static Error matchNameCallback(TreeNode* node, void* data, uint level);
+static Error matchIndexCallback(TreeNode* node, void* data, uint level);
+
+int main() {
+  Context ctx = {};
+  if (contextInit(&ctx, 8))
+    return EXIT_FAILURE;
+
+  size_t length = BENCH_VARS * BENCH_REPEATS * 64;
+  char* formula = (char*)calloc(length, sizeof(char));
+  if (!formula)
+    return EXIT_FAILURE;
+  size_t written = 0;
+  for (size_t r = 0; r < BENCH_REPEATS; r++)
+    for (size_t i = 0; i < BENCH_VARS; i++)
+      written += (size_t)snprintf(formula + written, length - written,
+                                  "%ssin(v%zu*v%zu)*v%zu^2/(v%zu+%zu)",
+                                  written ? "+" : "", i, (i + 1) % BENCH_VARS,
+                                  (i + 7) % BENCH_VARS, (i + 3) % BENCH_VARS, r + 1);
+  TreeNode* tree = parseFormula(formula, written, ctx.vars);
+  free(formula);
+  if (!tree)
+    return EXIT_FAILURE;
+  size_t treeNodes = 0;
+  nodeTraverse(tree, .prefix = countNodesCallback, .prefixData = &treeNodes);
+
+  size_t byName  = 0;
+  size_t byIndex = 0;
+  double nameTime  = differentiateAll(&ctx, tree, false, &byName);
+  double indexTime = differentiateAll(&ctx, tree, true,  &byIndex);
+
+  size_t nameFound  = 0;
+  size_t indexFound = 0;
+  double ofVarTime = matchAll(&ctx, tree, matchNameCallback,  &nameFound);
+  double equalTime = matchAll(&ctx, tree, matchIndexCallback, &indexFound);
+
+  bool isOk = byName && byName == byIndex && nameFound == indexFound;
+  printf("%zu variables, %zu nodes, %zu derivative nodes\n",
+         ctx.vars->count, treeNodes, byName);
+  printf("differentiate        %8.2f ms\n", nameTime  * 1e3);
+  printf("differentiateByIndex %8.2f ms\n", indexTime * 1e3);
+  printf("ofVar on every node  %8.2f ms\n", ofVarTime * 1e3);
+  printf("index on every node  %8.2f ms %s\n", equalTime * 1e3, isOk ? "ok" : "FAILED");
+
+  nodeDestroy(tree, true);
+  contextDestroy(&ctx);
+  return isOk ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static double now() {
+  timespec time = {};
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+//One derivative by each variable, nodes are those of all of them together
+static double differentiateAll(Context* ctx, TreeNode* tree, bool byIndex, size_t* nodes) {
+  double best = INFINITY;
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    *nodes = 0;
+    double start = now();
+    for (size_t i = 0; i < ctx->vars->count; i++) {
+      TreeNode* diff = byIndex
+                       ? differentiateByIndex(ctx, tree, i)
+                       : differentiate(ctx, tree, ctx->vars->items[i].str);
+      nodeTraverse(diff, .prefix = countNodesCallback, .prefixData = nodes);
+      nodeDestroy(diff, true);
+    }
+    double time = now() - start;
+    if (time < best)
+      best = time;
+  }
+  return best;
+}
+
+static double matchAll(Context* ctx, TreeNode* tree, callback_f match, size_t* found) {
+  double best = INFINITY;
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    *found = 0;
+    double start = now();
+    for (size_t i = 0; i < ctx->vars->count; i++) {
+      MatchData data = {ctx->vars, ctx->vars->items[i].str, i, 0};
+      nodeTraverse(tree, .prefix = match, .prefixData = &data);
+      *found += data.found;
+    }
+    double time = now() - start;
+    if (time < best)
+      best = time;
+  }
+  return best;
+}
+
+static Error matchNameCallback(TreeNode* node, void* data, uint) {
+  MatchData* match = (MatchData*)data;
+  if (ofVar(match->vars, node, match->name))
+    match->found++;
+  return OK;
+}
+
+static Error matchIndexCallback(TreeNode* node, void* data, uint) {
+  MatchData* match = (MatchData*)data;
+  if (IS_VAR(node) && node->data.value.var == match->index)
+    match->found++;
+  return OK;
+}
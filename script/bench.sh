@@ -0,0 +1,49 @@
+#!/bin/bash
+
+VERBOSE=false
+
+while getopts "v" flag; 
+do
+  case "$flag" in
+    v) VERBOSE=true ;;
+  esac
+done
+
+if $VERBOSE; 
+then
+  set -xe
+else
+  set -e  
+fi
+
+#every bench/*.cpp is a program of its own on top of everything in src/ but main.cpp
+bench() {
+  local CFLAGS="-std=c++17 -O2 -DNDEBUG -D DISABLE_NEWLINES"
+  local SRC_FILES=$(find src/ -type f -name '*.cpp' ! -path 'src/main.cpp')
+  local LIBS="-pthread"
+
+  mkdir -p bin/bench
+  for BENCH in bench/*.cpp
+  do
+    local OUTPUT_PATH="bin/bench/$(basename $BENCH .cpp)"
+    g++ $CFLAGS -I src/ $SRC_FILES $BENCH $LIBS -o $OUTPUT_PATH
+    echo "•$OUTPUT_PATH"
+    $OUTPUT_PATH
+  done
+}
+
+#walks up from script dir until is in the same directory as the first arg is
+walkUp() {
+  local SCRIPT_DIR=$(cd -- "$(dirname -- "$0")" && pwd)
+  cd $SCRIPT_DIR
+  until test -e "$1"
+  do
+    cd ..
+  done
+}
+
+#actual script
+SAVED_DIR=$(pwd)
+walkUp "src"
+bench
+cd $SAVED_DIR
@@ -19,8 +19,8 @@ fi
 build() {
   local DEFINES="-D _DEBUG -D DISABLE_NEWLINES"
   local CFLAGS="-ggdb3 -std=c++17 -O0 -Wall -Wextra -Weffc++ -Waggressive-loop-optimizations -Wc++14-compat -Wmissing-declarations -Wcast-align -Wcast-qual -Wchar-subscripts -Wconditionally-supported -Wconversion -Wctor-dtor-privacy -Wempty-body -Wfloat-equal -Wformat-nonliteral -Wformat-security -Wformat-signedness -Wformat=2 -Winline -Wlogical-op -Wnon-virtual-dtor -Wopenmp-simd -Woverloaded-virtual -Wpacked -Wpointer-arith -Winit-self -Wredundant-decls -Wshadow -Wsign-conversion -Wsign-promo -Wstrict-null-sentinel -Wstrict-overflow=2 -Wsuggest-attribute=noreturn -Wsuggest-final-methods -Wsuggest-final-types -Wsuggest-override -Wswitch-default -Wsync-nand -Wundef -Wunreachable-code -Wunused -Wuseless-cast -Wvariadic-macros -Wno-literal-suffix -Wno-missing-field-initializers -Wno-narrowing -Wno-old-style-cast -Wno-varargs -Wstack-protector -fcheck-new -fsized-deallocation -fstack-protector -fstrict-overflow -flto-odr-type-merging -fno-omit-frame-pointer -Wlarger-than=65536 -Wstack-usage=8192 -pie -fPIE -Werror=vla -fsanitize=address,alignment,bool,bounds,enum,float-cast-overflow,float-divide-by-zero,integer-divide-by-zero,leak,nonnull-attribute,null,object-size,return,returns-nonnull-attribute,shift,signed-integer-overflow,undefined,unreachable,vla-bound,vptr"
-  local SRC_FILES="-I src/ src/ds/queue/queue.cpp src/ds/tree/nodetype.cpp src/diff/io/io.cpp src/diff/io/parse.cpp src/misc/util.cpp src/diff/derivative.cpp src/ds/tree/tree.cpp src/ds/tree/dump/dump.cpp src/main.cpp src/ds/tree/node.cpp src/error/error.cpp src/diff/context.cpp"
-  local LIBS="" #empty for now
+  local SRC_FILES="-I src/ src/ds/queue/queue.cpp src/ds/tree/nodetype.cpp src/diff/io/io.cpp src/diff/io/parse.cpp src/misc/util.cpp src/diff/derivative.cpp src/ds/tree/tree.cpp src/ds/tree/dump/dump.cpp src/main.cpp src/ds/tree/node.cpp src/error/error.cpp src/diff/context.cpp src/ds/tree/arena.cpp src/ds/tree/store.cpp src/ds/map/ptrmap.cpp src/diff/cache.cpp src/diff/eval/tape.cpp src/diff/eval/batch.cpp src/diff/eval/pool.cpp src/diff/eval/grad.cpp src/diff/eval/jet.cpp src/ds/tree/rewrite.cpp src/diff/eval/series.cpp src/diff/eval/taylor.cpp src/diff/partial.cpp src/ds/stack/stack.cpp src/diff/io/formulas.cpp src/misc/input.cpp src/diff/io/binary.cpp src/ds/tree/deps.cpp src/misc/output.cpp src/diff/io/report.cpp"
+  local LIBS="-pthread"
   local OUTPUT_PATH="bin/diff" 
   
   rm -f $OUTPUT_PATH
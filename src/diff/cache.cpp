@@ -0,0 +1,265 @@
+#include "diff/cache.h"
+#include "ds/stack/stack.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+static const ulong DIFF_CACHE_NULL_HASH = 0x2545F4914F6CDD1Dul;
+
+static ulong nodeStructHash(DiffCache* cache, const TreeNode* node);
+static ulong nodeStructHashMemo(DiffCache* cache, const TreeNode* node);
+static size_t diffCacheSeen(DiffCache* cache, ulong hash, bool isMiss);
+static DiffCacheEntry* diffCacheFind(DiffCache* cache, ulong hash,
+                                     TreeNode* node, size_t var);
+
+#define RETURN_WITH_STATUS(value, returnValue) \
+  {                                            \
+  if (status)                                  \
+    *status = value;                           \
+  return returnValue;                          \
+  }
+
+DiffCache* diffCacheAlloc(size_t maxEntries, Error* status) {
+  if (!maxEntries)
+    RETURN_WITH_STATUS(InvalidParameters, NULL);
+
+  DiffCache* cache = (DiffCache*)calloc(1, sizeof(DiffCache));
+  if (!cache)
+    RETURN_WITH_STATUS(FailMemoryAllocation, NULL);
+
+  //at most half full, so probes stay short
+  size_t capacity = 1;
+  while (capacity < maxEntries * 2)
+    capacity <<= 1;
+
+  DiffCacheEntry* items = (DiffCacheEntry*)calloc(capacity, sizeof(DiffCacheEntry));
+  Error err = items
+              ? ptrMapInit(&cache->hashes)
+              : FailMemoryAllocation;
+  if (!err &&
+      (err = ptrMapInit(&cache->seen)))
+    ptrMapDestroy(&cache->hashes);
+  if (!err &&
+      (err = nodeStoreInit(&cache->keys))) {
+    ptrMapDestroy(&cache->hashes);
+    ptrMapDestroy(&cache->seen);
+  }
+  if (err) {
+    free(items);
+    free(cache);
+    RETURN_WITH_STATUS(err, NULL);
+  }
+
+  cache->items = items;
+  cache->capacity = capacity;
+  cache->maxEntries = maxEntries;
+  cache->epoch = 1;
+  return cache;
+}
+
+Error diffCacheDestroy(DiffCache* cache, bool isAlloced) {
+  if (!cache)
+    return InvalidParameters;
+
+  diffCacheFlush(cache);
+  free(cache->items);
+  ptrMapDestroy(&cache->hashes);
+  ptrMapDestroy(&cache->seen);
+  nodeStoreDestroy(&cache->keys);
+  *cache = {};
+
+  if (isAlloced)
+    free(cache);
+  return OK;
+}
+
+Error diffCacheFlush(DiffCache* cache) {
+  if (!cache ||
+      !cache->items)
+    return InvalidParameters;
+
+  for (size_t i = 0; i < cache->capacity; i++) {
+    DiffCacheEntry* e = cache->items + i;
+    if (!e->key)
+      continue;
+    nodeRelease(e->keyStore, e->key);
+    nodeDestroy(e->value, true);
+    *e = {};
+  }
+  cache->count = 0;
+  return OK;
+}
+
+Error diffCacheNextEpoch(DiffCache* cache) {
+  if (!cache)
+    return InvalidParameters;
+
+  cache->epoch++;
+  return ptrMapClear(&cache->hashes);
+}
+
+TreeNode* diffCacheGet(DiffCache* cache, TreeNode* node, size_t var, uint* step) {
+  if (!cache ||
+      !node)
+    return NULL;
+
+  ulong hash = nodeStructHash(cache, node);
+  DiffCacheEntry* e = diffCacheFind(cache, hash, node, var);
+  if (!e || !e->key) {
+    cache->stats.misses++;
+    diffCacheSeen(cache, hash, true);
+    return NULL;
+  }
+
+  cache->stats.hits++;
+  if (step)
+    *step = (e->epoch == cache->epoch)
+            ? e->step
+            : 0;
+  return nodeCopy(e->value, NULL);
+}
+
+Error diffCachePut(DiffCache* cache, TreeNode* node, size_t var,
+                   TreeNode* derivative, uint step) {
+  if (!cache ||
+      !node  ||
+      !derivative)
+    return InvalidParameters;
+
+  ulong hash = nodeStructHash(cache, node);
+  DiffCacheEntry* e = diffCacheFind(cache, hash, node, var);
+  if (e && e->key) {
+    e->step  = step;
+    e->epoch = cache->epoch;
+    return OK;
+  }
+  //the first time is likely the only one, not worth the copies
+  if (diffCacheSeen(cache, hash, false) < 2)
+    return OK;
+  //nor is a plain subtree whose parent repeats too: the parent gets an entry,
+  //copies of every repeated subtree nested in it would add up to n^2
+  size_t parentHash = 0;
+  if (!IS_INTERNED(node) &&
+      node->parent &&
+      ptrMapGet(&cache->hashes, node->parent, &parentHash) &&
+      diffCacheSeen(cache, parentHash, false) >= 2)
+    return OK;
+
+  if (cache->count == cache->maxEntries) {
+    diffCacheFlush(cache);
+    cache->stats.flushes++;
+    e = diffCacheFind(cache, hash, node, var);
+  }
+
+  //a shared subtree only takes a reference, a plain one is interned
+  //with the other keys, so keys nested in each other share their nodes
+  Error err = OK;
+  NodeStore* keyStore = IS_INTERNED(node)
+                        ? nodeStoreBound()
+                        : &cache->keys;
+  TreeNode* key = nodeStoreImport(keyStore, node, &err);
+  if (err)
+    return err;
+  TreeNode* value = nodeCopy(derivative, NULL, &err);
+  if (err) {
+    nodeRelease(keyStore, key);
+    return err;
+  }
+
+  *e = {
+    .hash  = hash,
+    .var   = var,
+    .key   = key,
+    .keyStore = keyStore,
+    .value = value,
+    .step  = step,
+    .epoch = cache->epoch
+  };
+  cache->count++;
+  return OK;
+}
+
+//Returns the matching entry or the empty slot where it would go
+static DiffCacheEntry* diffCacheFind(DiffCache* cache, ulong hash,
+                                     TreeNode* node, size_t var) {
+  size_t mask = cache->capacity - 1;
+  for (size_t i = (hash ^ var * 0x9E3779B97F4A7C15ull) & mask; ; i = (i + 1) & mask) {
+    DiffCacheEntry* e = cache->items + i;
+    if (!e->key ||
+        (e->hash == hash &&
+         e->var  == var  &&
+         nodeEqual(e->key, node)))
+      return e;
+  }
+}
+
+//Postorder with an explicit stack, every node's hash is memoized for the epoch
+static ulong nodeStructHash(DiffCache* cache, const TreeNode* node) {
+  if (!node ||
+      ptrMapGet(&cache->hashes, node))
+    return nodeStructHashMemo(cache, node);
+
+  NodeStack stack = {};
+  Error err = nodeStackPush(&stack, {.node = const_cast<TreeNode*>(node)});
+  while (!err &&
+         stack.count) {
+    NodeFrame* frame = nodeStackTop(&stack);
+    TreeNode* current = frame->node;
+    if (!frame->stage++) {
+      if (current->right &&
+          !ptrMapGet(&cache->hashes, current->right))
+        err = nodeStackPush(&stack, {.node = current->right});
+      if (!err &&
+          current->left &&
+          !ptrMapGet(&cache->hashes, current->left))
+        err = nodeStackPush(&stack, {.node = current->left});
+      continue;
+    }
+    nodeStackPop(&stack);
+
+    uint64_t value = 0;
+    switch (current->data.type) {
+      case NUM_TYPE: memcpy(&value, &current->data.value.num, sizeof(value)); break;
+      case VAR_TYPE: value = current->data.value.var;                          break;
+      case OP_TYPE:  value = (uint64_t)current->data.value.op;                 break;
+      default:       break;
+    }
+
+    uint64_t h = (uint64_t)current->data.type;
+    h = (h ^ value)                                     * 0x9E3779B97F4A7C15ull;
+    h = (h ^ nodeStructHashMemo(cache, current->left))  * 0xC2B2AE3D27D4EB4Full;
+    h = (h ^ nodeStructHashMemo(cache, current->right)) * 0x165667B19E3779F9ull;
+    h ^= h >> 29;
+    err = ptrMapSet(&cache->hashes, current, h);
+  }
+  nodeStackDestroy(&stack);
+
+  return nodeStructHashMemo(cache, node);
+}
+
+//Hash of a node nodeStructHash() has been through, 0 if it ran out of memory
+//(a poor hash, not a wrong one)
+static ulong nodeStructHashMemo(DiffCache* cache, const TreeNode* node) {
+  if (!node)
+    return DIFF_CACHE_NULL_HASH;
+
+  size_t hash = 0;
+  ptrMapGet(&cache->hashes, node, &hash);
+  return hash;
+}
+
+//Times hash has missed, counting this one if isMiss
+static size_t diffCacheSeen(DiffCache* cache, ulong hash, bool isMiss) {
+  const void* key = (const void*)(hash | 1);
+  size_t times = 0;
+  ptrMapGet(&cache->seen, key, &times);
+  if (!isMiss)
+    return times;
+
+  if (cache->seen.count >= cache->maxEntries * DIFF_CACHE_SEEN_PER_ENTRY)
+    ptrMapClear(&cache->seen);
+  ptrMapSet(&cache->seen, key, times + 1);
+  return times + 1;
+}
+
+#undef RETURN_WITH_STATUS
@@ -0,0 +1,63 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "ds/tree/node.h"
+#include "ds/tree/store.h"
+#include "ds/map/ptrmap.h"
+
+const size_t DIFF_CACHE_DEFAULT_MAX_ENTRIES = 4096;
+//hashes remembered per entry before the oldest are forgotten (all at once)
+const size_t DIFF_CACHE_SEEN_PER_ENTRY = 8;
+
+struct DiffCacheEntry {
+  ulong hash = 0;
+  size_t var = 0;
+  TreeNode* key   = NULL; //the differentiated subtree, interned, NULL if slot is empty
+  NodeStore* keyStore = NULL; //the store key is interned in
+  TreeNode* value = NULL; //own copy of its derivative
+  uint step  = 0;         //TeX step that printed it, 0 if it wasn't printed
+  uint epoch = 0;         //step numbers are only valid within one differentiate()
+};
+
+struct DiffCacheStats {
+  size_t hits    = 0;
+  size_t misses  = 0;
+  size_t flushes = 0; //times the cache got full and was emptied
+};
+
+///Derivatives of subtrees seen more than once, keyed by their structural hash
+///and the var index. A subtree only gets an entry once its hash has been seen
+///before and, for plain trees, only if its parent's hasn't, so an expression
+///without repeats costs no copies at all and nested repeats cost one
+struct DiffCache {
+  DiffCacheEntry* items = NULL;
+  size_t capacity   = 0; //table slots, a power of two
+  size_t count      = 0;
+  size_t maxEntries = 0;
+  uint epoch = 0;
+  PtrMap hashes = {}; //node -> structural hash, only valid within one epoch
+  PtrMap seen   = {}; //structural hash -> times it missed
+  NodeStore keys = {}; //keys of plain subtrees, shared ones stay in their store
+  DiffCacheStats stats = {};
+};
+
+DiffCache* diffCacheAlloc(size_t maxEntries = DIFF_CACHE_DEFAULT_MAX_ENTRIES,
+                          Error* status = NULL);
+Error diffCacheDestroy(DiffCache* cache, bool isAlloced = false);
+///Drops every entry
+Error diffCacheFlush(DiffCache* cache);
+///Forgets memoized node hashes and printed step numbers,
+///should be called whenever the nodes or the TeX step counter may have changed
+Error diffCacheNextEpoch(DiffCache* cache);
+
+///Returns a copy of the cached derivative of node by var, or NULL on a miss.
+///step is set to the TeX step it was printed at during this epoch, 0 otherwise
+TreeNode* diffCacheGet(DiffCache* cache, TreeNode* node, size_t var, uint* step = NULL);
+///Stores node (interned) and a copy of derivative if node's hash has missed before.
+///If the key is already present only its step is updated
+Error diffCachePut(DiffCache* cache, TreeNode* node, size_t var,
+                   TreeNode* derivative, uint step = 0);
+
+#endif
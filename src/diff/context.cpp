@@ -1,11 +1,20 @@
 #include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
 #include "diff/context.h"
 #include "diff/io/io.h"
 
-static Variable* findVarHashed(Variables* vars, const char* varStr, 
-                               ulong hash, Error* status = NULL, 
-                               size_t* indexPtr = NULL);
-static ulong hash(const char* str);
+static const size_t MAX_LOAD_NUMERATOR   = 3;
+static const size_t MAX_LOAD_DENOMINATOR = 4;
+
+static Variable* findVarHashed(Variables* vars, const char* varStr, size_t length,
+                               ulong hash, size_t* indexPtr = NULL);
+static Error varsGrowSlots(Variables* vars);
+static void varsPlace(Variables* vars, size_t index);
+static char* varsIntern(Variables* vars, const char* str, size_t length);
+static size_t varSlot(ulong hash, size_t slotCapacity);
+static ulong hash(const char* str, size_t length);
 
 Error contextInit(Context* ctx, size_t initialCapacity) {
   if (!ctx ||
@@ -18,8 +27,24 @@ Error contextInit(Context* ctx, size_t initialCapacity) {
   if (err)
     return err;
 
+  //contexts of one thread share its arena, so destroying one of them
+  //never takes the nodes of another with it
+  NodeArena* arena = nodeArenaBound();
+  if (arena && arena->users) {
+    arena->users++;
+  } else {
+    arena = nodeArenaAlloc(NODE_ARENA_DEFAULT_CAPACITY, &err);
+    if (err) {
+      varsDestroy(vars);
+      return err;
+    }
+    arena->users = 1;
+    arena->outer = nodeArenaBind(arena);
+  }
+
   ctx->vars = vars;
   ctx->sink = NULL;
+  ctx->arena = arena;
   ctx->stepCount = 0;
 
   return OK;
@@ -33,10 +58,102 @@ Error contextDestroy(Context* ctx) {
     varsDestroy(ctx->vars);
   if (ctx->sink)
     closeTexFile(ctx);
+  outputDestroy(&ctx->tex);
+  //cached trees may be shared or live in the arena, so they go first
+  if (ctx->cache)
+    diffCacheDestroy(ctx->cache, true);
+  ctx->cache = NULL;
+  free(ctx->rewrite);
+  ctx->rewrite = NULL;
+  ctx->rewriteSets = 0;
+  ctx->report = {};
+  if (ctx->store)
+    nodeStoreDestroy(ctx->store, true);
+  ctx->store = NULL;
+  //the last context of the arena releases every node that is still alive
+  //in one go and gives the thread back whatever was bound before
+  if (ctx->arena &&
+      !--ctx->arena->users) {
+    if (nodeArenaBound() == ctx->arena)
+      nodeArenaBind(ctx->arena->outer);
+    nodeArenaDestroy(ctx->arena, true);
+  }
+  ctx->arena = NULL;
   ctx->stepCount = 0;
   return OK;
 }
 
+Error contextEnableSharing(Context* ctx) {
+  if (!ctx)
+    return InvalidParameters;
+  if (ctx->store)
+    return OK;
+
+  Error err = OK;
+  NodeStore* store = nodeStoreAlloc(NODE_STORE_DEFAULT_CAPACITY, &err);
+  if (err)
+    return err;
+
+  nodeStoreBind(store);
+  ctx->store = store;
+  return OK;
+}
+
+Error contextCse(Context* ctx, TreeNode** node, NodeCseStats* stats) {
+  if (!ctx  ||
+      !node ||
+      !*node)
+    return InvalidParameters;
+
+  Error err = contextEnableSharing(ctx);
+  if (err)
+    return err;
+  return nodeCse(ctx->store, node, stats);
+}
+
+Error contextEnableDiffCache(Context* ctx, size_t maxEntries) {
+  if (!ctx ||
+      !maxEntries)
+    return InvalidParameters;
+  if (ctx->cache)
+    return OK;
+
+  Error err = OK;
+  DiffCache* cache = diffCacheAlloc(maxEntries, &err);
+  if (err)
+    return err;
+
+  ctx->cache = cache;
+  return OK;
+}
+
+Error contextEnableRewrite(Context* ctx, uint sets) {
+  if (!ctx ||
+      !(sets & REWRITE_ALL))
+    return InvalidParameters;
+  if (!ctx->rewrite) {
+    ctx->rewrite = (RewriteStats*)calloc(1, sizeof(RewriteStats));
+    if (!ctx->rewrite)
+      return FailMemoryAllocation;
+    *ctx->rewrite = {};
+  }
+  ctx->rewriteSets = sets;
+  return OK;
+}
+
+Error contextSetReport(Context* ctx, TexReport report) {
+  if (!ctx ||
+      report.detail > TEX_REPORT_FIRST ||
+      report.exprBytes > TEX_REPORT_MAX_EXPR_BYTES)
+    return InvalidParameters;
+
+  if (!report.exprBytes &&
+      (report.detail != TEX_REPORT_ALL || report.isDeduped))
+    report.exprBytes = TEX_REPORT_DEFAULT_EXPR_BYTES;
+  ctx->report = report;
+  return OK;
+}
+
 Error contextVerify(Context* ctx) {
   if (!ctx)
     return InvalidParameters;
@@ -60,8 +177,16 @@ Variables* varsAlloc(size_t initialCapacity, Error* status) {
   if (!vars)
     RETURN_WITH_STATUS(FailMemoryAllocation, NULL);
 
+  size_t slotCapacity = 1;
+  while (slotCapacity * MAX_LOAD_NUMERATOR < initialCapacity * MAX_LOAD_DENOMINATOR)
+    slotCapacity <<= 1;
+
   Variable* items = (Variable*)calloc(initialCapacity, sizeof(Variable));
-  if (!items) {
+  size_t*   slots = (size_t*)  calloc(slotCapacity,    sizeof(size_t));
+  if (!items ||
+      !slots) {
+    free(items);
+    free(slots);
     free(vars);
     RETURN_WITH_STATUS(FailMemoryAllocation, NULL);
   }
@@ -69,6 +194,8 @@ Variables* varsAlloc(size_t initialCapacity, Error* status) {
   vars->items = items;
   vars->count = 0;
   vars->capacity = initialCapacity;
+  vars->slots = slots;
+  vars->slotCapacity = slotCapacity;
 
   return vars;
 }
@@ -77,27 +204,64 @@ Error varsDestroy(Variables* vars) {
   if (!vars)
     return InvalidParameters;
 
-  if (vars->items) {
-    for (size_t i = 0; i < vars->capacity; i++)
-      free(vars->items[i].str);
+  for (VarNameBlock* block = vars->names; block; ) {
+    VarNameBlock* next = block->next;
+    free(block);
+    block = next;
   }
   free(vars->items);
+  free(vars->slots);
   free(vars);
 
   return OK;
 }
 
+Error varsClear(Variables* vars) {
+  if (!vars)
+    return InvalidParameters;
+
+  //the newest block is kept for the names to come
+  VarNameBlock* block = vars->names
+                        ? vars->names->next
+                        : NULL;
+  while (block) {
+    VarNameBlock* next = block->next;
+    free(block);
+    block = next;
+  }
+  if (vars->names) {
+    vars->names->next = NULL;
+    vars->names->size = 0;
+  }
+  for (size_t i = 0; i < vars->count; i++)
+    vars->items[i] = {};
+  memset(vars->slots, 0, vars->slotCapacity * sizeof(size_t));
+  vars->count = 0;
+
+  return OK;
+}
+
 size_t regVar(Variables* vars, const char* varStr, Error* status) {
-  if (!vars || !varStr)
+  if (!varStr)
+    RETURN_WITH_STATUS(InvalidParameters, 0);
+
+  return regVarN(vars, varStr, strlen(varStr), status);
+}
+
+size_t regVarN(Variables* vars, const char* varStr, size_t length, Error* status) {
+  if (!vars   ||
+      !varStr ||
+      !length)
     RETURN_WITH_STATUS(InvalidParameters, 0);
   Error err = varsVerify(vars);
   if (err)
     RETURN_WITH_STATUS(err, 0);
 
-  ulong strhash = hash(varStr);
+  ulong strhash = hash(varStr, length);
+  size_t index = 0;
   //does a variable with that str exist already
-  if (findVarHashed(vars, varStr, strhash))
-    RETURN_WITH_STATUS(AttemptedReregistration, 0);
+  if (findVarHashed(vars, varStr, length, strhash, &index))
+    RETURN_WITH_STATUS(AttemptedReregistration, index);
  
   if (vars->count == vars->capacity) {
     size_t newCapacity = vars->capacity * 2;
@@ -107,18 +271,23 @@ size_t regVar(Variables* vars, const char* varStr, Error* status) {
     vars->capacity = newCapacity;
     vars->items = temp;
   }
+  if ((vars->count + 1) * MAX_LOAD_DENOMINATOR > vars->slotCapacity * MAX_LOAD_NUMERATOR &&
+      (err = varsGrowSlots(vars)))
+    RETURN_WITH_STATUS(err, 0);
 
-  char* str = strdup(varStr);
+  char* str = varsIntern(vars, varStr, length);
   if (!str)
     RETURN_WITH_STATUS(FailMemoryAllocation, 0);
 
-  size_t retVal = vars->count;
+  index = vars->count;
   vars->items[vars->count++] = {
     .hash = strhash,
     .str = str, 
+    .length = length,
     .value = NAN
   };
-  return retVal;
+  varsPlace(vars, index);
+  return index;
 }
 
 Variable* getVar(Variables* vars, size_t index, Error* status) {
@@ -150,13 +319,24 @@ Error setVarValue(Variables* vars, const char* varStr, double value) {
 
 Variable* findVar(Variables* vars, const char* varStr, 
                   Error* status, size_t* indexPtr) {
+  if (!varStr)
+    RETURN_WITH_STATUS(InvalidParameters, NULL);
+
+  return findVarN(vars, varStr, strlen(varStr), status, indexPtr);
+}
+
+Variable* findVarN(Variables* vars, const char* varStr, size_t length,
+                   Error* status, size_t* indexPtr) {
   if (!vars || !varStr)
     RETURN_WITH_STATUS(InvalidParameters, NULL);
   Error err = varsVerify(vars);
   if (err)
     RETURN_WITH_STATUS(err, NULL);
 
-  return findVarHashed(vars, varStr, hash(varStr), status, indexPtr);
+  Variable* v = findVarHashed(vars, varStr, length, hash(varStr, length), indexPtr);
+  if (!v)
+    RETURN_WITH_STATUS(UnknownVariable, NULL);
+  return v;
 }
 
 bool ofVar(Variables* vars, TreeNode* node, const char* varStr) {
@@ -176,45 +356,100 @@ bool ofVar(Variables* vars, TreeNode* node, const char* varStr) {
 Error varsVerify(Variables* vars) {
   if (!vars)
     return InvalidParameters;
-  if (!vars->items)
+  if (!vars->items ||
+      !vars->slots)
     return NullPointerField;
   if (vars->count > vars->capacity)
     return BadCount;
   return OK;
 }
 
-static Variable* findVarHashed(Variables* vars, const char* varStr, 
-                               ulong hash, Error* status, size_t* indexPtr) {
-  if (!vars || !varStr)
-    RETURN_WITH_STATUS(InvalidParameters, NULL);
-  Error err = varsVerify(vars);
-  if (err)
-    RETURN_WITH_STATUS(err, NULL);
-
-  for (size_t i = 0; i < vars->count; i++) {
-    Variable* vi = vars->items + i;
-    if (!vi->str) continue;
-    if (hash == vi->hash && 
-        strcmp(varStr, vi->str) == 0) {
+static Variable* findVarHashed(Variables* vars, const char* varStr, size_t length,
+                               ulong hash, size_t* indexPtr) {
+  assert(vars && varStr);
+
+  size_t mask = vars->slotCapacity - 1;
+  for (size_t i = varSlot(hash, vars->slotCapacity); ; i = (i + 1) & mask) {
+    size_t slot = vars->slots[i];
+    if (!slot)
+      return NULL;
+    Variable* vi = vars->items + slot - 1;
+    if (hash == vi->hash &&
+        length == vi->length &&
+        memcmp(varStr, vi->str, length) == 0) {
       if (indexPtr) 
-        *indexPtr = i;
+        *indexPtr = slot - 1;
       return vi;
     }
   }
+}
+
+static Error varsGrowSlots(Variables* vars) {
+  assert(vars);
+
+  size_t* slots = (size_t*)calloc(vars->slotCapacity * 2, sizeof(size_t));
+  if (!slots)
+    return FailMemoryAllocation;
+  free(vars->slots);
+  vars->slots = slots;
+  vars->slotCapacity *= 2;
+  for (size_t i = 0; i < vars->count; i++)
+    varsPlace(vars, i);
+  return OK;
+}
+
+//Puts item index into the first free slot of its probe sequence
+static void varsPlace(Variables* vars, size_t index) {
+  assert(vars && index < vars->count);
+
+  size_t mask = vars->slotCapacity - 1;
+  size_t i = varSlot(vars->items[index].hash, vars->slotCapacity);
+  while (vars->slots[i])
+    i = (i + 1) & mask;
+  vars->slots[i] = index + 1;
+}
+
+//Terminated copy of str in the name blocks, which are never moved
+static char* varsIntern(Variables* vars, const char* str, size_t length) {
+  assert(vars && str);
+
+  VarNameBlock* block = vars->names;
+  if (!block ||
+      block->capacity - block->size < length + 1) {
+    size_t capacity = length + 1 > VAR_NAMES_BLOCK_SIZE
+                      ? length + 1
+                      : VAR_NAMES_BLOCK_SIZE;
+    block = (VarNameBlock*)calloc(1, sizeof(VarNameBlock) + capacity);
+    if (!block)
+      return NULL;
+    *block = {
+      .next     = vars->names,
+      .capacity = capacity,
+      .data     = (char*)(block + 1)
+    };
+    vars->names = block;
+  }
+
+  char* copy = block->data + block->size;
+  memcpy(copy, str, length);
+  copy[length] = '\0';
+  block->size += length + 1;
+  return copy;
+}
 
-  RETURN_WITH_STATUS(UnknownVariable, NULL);
+static size_t varSlot(ulong hash, size_t slotCapacity) {
+  //Fibonacci hashing spreads names that differ only at the end
+  uint64_t h = hash * 0x9E3779B97F4A7C15ull;
+  return (h >> 32) & (slotCapacity - 1);
 }
 
 //NOTE: Source: http://www.cse.yorku.ca/~oz/hash.html
-static ulong hash(const char* str) {
-  // const char* strSaved = str;
+static ulong hash(const char* str, size_t length) {
   ulong hash = 5381;
-  uint c = 0;
 
-  while ((c = (uint)*str++))
-    hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+  for (size_t i = 0; i < length; i++)
+    hash = ((hash << 5) + hash) + (unsigned char)str[i]; /* hash * 33 + c */
 
-  // fprintf(stderr, "%s is %lu\n", strSaved, hash);
   return hash;
 }
 
@@ -4,29 +4,59 @@
 #include <stdio.h>
 #include <math.h>
 #include <sys/types.h>
+#include "misc/output.h"
+#include "diff/io/report.h"
 
-const size_t MAX_VALUE_STRING_LENGTH = 16;
+const size_t VAR_NAMES_BLOCK_SIZE = 4096;
 
 struct Variable {
   ulong hash = 0;
-  char* str = NULL;
+  char* str = NULL; //interned, owned by Variables
+  size_t length = 0;
   double value = NAN;
 };
 
+//Interned variable names are packed into a chain of these
+struct VarNameBlock {
+  VarNameBlock* next = NULL;
+  size_t size = 0;
+  size_t capacity = 0;
+  char* data = NULL; //right after the block itself
+};
+
+///items keep their indices for good (VAR_TYPE nodes refer to them),
+///slots is an open addressing (linear probing) index over them
 struct Variables {
   Variable* items = NULL;
   size_t capacity = 0;
   size_t count = 0;
+  size_t* slots = NULL;     //index + 1 of an item, 0 is an empty slot
+  size_t slotCapacity = 0;  //always a power of two
+  VarNameBlock* names = NULL;
 };
 
 #include "ds/tree/node.h"
+#include "ds/tree/arena.h"
+#include "ds/tree/store.h"
+#include "diff/cache.h"
+#include "ds/tree/rewrite.h"
 
 Variables* varsAlloc(size_t initialCapacity, Error* status = NULL);
 Error varsDestroy(struct Variables* vars); 
+///Forgets every name but keeps the memory for the next ones. Only for when
+///no node refers to any index anymore
+Error varsClear(Variables* vars);
+///A name that is registered already keeps its index, which is returned
+///along with the soft AttemptedReregistration
 size_t regVar(Variables* vars, const char* varStr, Error* status = NULL); 
+///Same for the length bytes at varStr, which don't need a '\0' after them
+size_t regVarN(Variables* vars, const char* varStr, size_t length,
+               Error* status = NULL);
 Variable* getVar(Variables* vars, size_t index, Error* status = NULL);
 Variable* findVar(Variables* vars, const char* varStr, 
                   Error* status = NULL, size_t* indexPtr = NULL);
+Variable* findVarN(Variables* vars, const char* varStr, size_t length,
+                   Error* status = NULL, size_t* indexPtr = NULL);
 //NOTE: any error (e.g. NULL vars) and this will return false
 bool ofVar(Variables* vars, TreeNode* node, const char* varStr);
 Error setVarValue(Variables* vars, const char* varStr, double value);
@@ -35,11 +65,41 @@ Error varsVerify(Variables* vars);
 struct Context {
   FILE* sink = NULL;
   Variables* vars = NULL;
+  NodeArena* arena = NULL;
+  NodeStore* store = NULL; //NULL unless sharing is enabled
+  DiffCache* cache = NULL; //NULL unless the derivative cache is enabled
+  RewriteStats* rewrite = NULL; //NULL unless rewrite rules are enabled
+  uint rewriteSets = 0;
+  PtrMap* texTerms = NULL; //shared node -> term number, set only inside nodeToTexNamed()
+  Output tex = {}; //TeX on its way to sink, empty between calls
+  TexReport report = {}; //which derivation steps get printed and how
+  TexSteps* texSteps = NULL; //steps printed so far, set only inside a deduplicating differentiate()
   uint stepCount = 0;
 };
 
+//Also binds a node arena to the calling thread, so every node allocated
+//afterwards lives in it. Contexts made on one thread share that arena,
+//it goes (and the binding before it comes back) with the last of them
 Error contextInit(Context* context, size_t initialCapacity);
 Error contextDestroy(Context* context);
+///Opt-in: binds a NodeStore, so from now on structurally equal subtrees
+///are shared and differentiate() returns a DAG instead of a tree
+Error contextEnableSharing(Context* context);
+///Opt-in: repeated subexpressions get their derivative from a cache
+///holding at most maxEntries derivatives
+Error contextEnableDiffCache(Context* context,
+                             size_t maxEntries = DIFF_CACHE_DEFAULT_MAX_ENTRIES);
+///Opt-in: derivation steps are simplified with nodeRewrite() and every
+///rule of sets instead of nodeOptimize(), ctx->rewrite counts what fired
+Error contextEnableRewrite(Context* context, uint sets = REWRITE_DEFAULT);
+
+///Detail policy of the derivation report, see TexReport. A policy other than
+///TEX_REPORT_ALL (or deduplication) without exprBytes gets
+///TEX_REPORT_DEFAULT_EXPR_BYTES, so its output always has a bound
+Error contextSetReport(Context* context, TexReport report);
+
+///Enables sharing if it isn't yet and runs nodeCse() on *node
+Error contextCse(Context* context, TreeNode** node, NodeCseStats* stats = NULL);
 
 Error contextVerify(Context* context);
 
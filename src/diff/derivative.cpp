@@ -1,5 +1,7 @@
 #include "diff/derivative.h"
 #include "diff/io/io.h"
+#include "ds/stack/stack.h"
+#include "ds/tree/deps.h"
 #include <assert.h>
 #include <math.h>
 
@@ -8,7 +10,7 @@
 #define D_X \
         NUM_(1)
 #define D_(d) \
-        differentiateRec(ctx, d, var)
+        differentiateTake(state, d)
 #define D_L \
         D_(node->left)
 #define D_R \
@@ -24,13 +26,39 @@
 #define CHAIN_RULE_L(l) \
         MUL_(l, D_L)
 
-static TreeNode* differentiateRec(Context* ctx, TreeNode* node, const char* var);
-static TreeNode* differentiatePower(Context* ctx, TreeNode* node, const char* var);
+//Operands of a node whose derivatives its rule uses
+enum DiffOperand {
+  DIFF_LEFT  = 1 << 0,
+  DIFF_RIGHT = 1 << 1,
+};
+
+//Derivatives of the operands are taken before their parent's and wait here
+//until the parent's rule picks them up (D_L, D_R)
+struct DiffState {
+  Context* ctx = NULL;
+  size_t var = 0;
+  const char* varStr = NULL; //only for the TeX of the steps
+  PtrMap derivatives = {}; //node -> its derivative, 0 once a plain node's is taken
+  uint level = 0;     //of the node being differentiated, the root's is 0
+  size_t printed = 0; //steps ctx->report let through so far
+  uint step = 0;      //number of the step just printed, 0 if it wasn't
+  TexSteps steps = {}; //ctx->texSteps while the report is deduplicated
+};
+
+static bool differentiateIntro(Context* ctx, TreeNode* node);
+static TreeNode* differentiateRec(DiffState* state, TreeNode* node);
+static TreeNode* differentiateTake(DiffState* state, TreeNode* node);
+static uint differentiateOperands(DiffState* state, TreeNode* node);
+static TreeNode* differentiateNode(DiffState* state, TreeNode* node);
+static TreeNode* differentiateConst(DiffState* state, TreeNode* node);
+static TreeNode* differentiateStep(DiffState* state, TreeNode* node, TreeNode* result);
+static TreeNode* differentiateCacheGet(DiffState* state, TreeNode* node);
+static void differentiateCachePut(DiffState* state, TreeNode* node, TreeNode* result);
+static uint differentiatePowerOperands(DiffState* state, TreeNode* node);
+static TreeNode* differentiatePower(DiffState* state, TreeNode* node);
 
 #define DUMP_TO_TEX_AND_RETURN(returnNode)                                 \
-        return ctx->sink                                                   \
-               ? differentiationStepToTex(ctx, var, node, returnNode)      \
-               : returnNode;
+        return differentiateStep(state, node, returnNode);
 
 TreeNode* differentiate(Context* ctx, TreeNode* node, const char* var) {
   if (!node ||
@@ -38,36 +66,242 @@ TreeNode* differentiate(Context* ctx, TreeNode* node, const char* var) {
       !ctx)
     return NULL;
 
-  if (ctx->sink) {
-    if (contextVerify(ctx))
+  size_t index = 0;
+  //if the var is not found, that means that the entire expression will diff-te to 0
+  if (!findVar(ctx->vars, var, NULL, &index)) {
+    if (!differentiateIntro(ctx, node))
       return NULL;
-    fputs("A derivative of this expression is deemed quite trivial:\\\\", ctx->sink);
-    nodeToTex(ctx, node);
+    DiffState constState = {
+      .ctx    = ctx,
+      .varStr = var
+    };
+    return differentiateStep(&constState, node, D_CONST);
   }
+  return differentiateByIndex(ctx, node, index);
+}
 
-  //if the var is not found, that means that the entire expression will diff-te to 0
-  if (!findVar(ctx->vars, var))
-    DUMP_TO_TEX_AND_RETURN(D_CONST);
+TreeNode* differentiateByIndex(Context* ctx, TreeNode* node, size_t var) {
+  if (!node ||
+      !ctx  ||
+      varsVerify(ctx->vars) ||
+      var >= ctx->vars->count)
+    return NULL;
+
+  if (!differentiateIntro(ctx, node))
+    return NULL;
+  if (ctx->cache)
+    diffCacheNextEpoch(ctx->cache);
 
-  if (varsVerify(ctx->vars))
+  //with sharing on, the input has to be interned so C_() can share its subtrees
+  NodeStore* store = nodeStoreBound();
+  TreeNode* src = (store && !IS_INTERNED(node))
+                  ? nodeStoreImport(store, node)
+                  : node;
+  if (!src)
+    return NULL;
+  //trees built bottom up know their variables already, this is for the rest
+  if (nodeDepsAnnotate(src)) {
+    if (src != node)
+      nodeRelease(store, src);
     return NULL;
-  TreeNode* diff = differentiateRec(ctx, node, var);
+  }
+
+  DiffState state = {
+    .ctx    = ctx,
+    .var    = var,
+    .varStr = ctx->vars->items[var].str
+  };
+  if (ctx->sink && ctx->report.isDeduped) {
+    if (texStepsInit(&state.steps)) {
+      if (src != node)
+        nodeRelease(store, src);
+      return NULL;
+    }
+    ctx->texSteps = &state.steps;
+  }
+  TreeNode* diff = differentiateRec(&state, src);
+  ctx->texSteps = NULL;
+  texStepsDestroy(&state.steps);
   nodeFixParents(diff);
+  if (src != node)
+    nodeRelease(store, src);
   return diff;
 }
 
-static TreeNode* differentiateRec(Context* ctx, TreeNode* node, const char* var) {
-  assert(ctx && !varsVerify(ctx->vars));
+//The TeX preamble, false if the context can't be printed to
+static bool differentiateIntro(Context* ctx, TreeNode* node) {
+  assert(ctx && node);
+
+  if (!ctx->sink)
+    return true;
+  if (contextVerify(ctx))
+    return false;
+  fputs("A derivative of this expression is deemed quite trivial:\\\\", ctx->sink);
+  nodeToTexBounded(ctx, node, ctx->report.exprBytes);
+  return true;
+}
+
+//Postorder with an explicit stack, so the depth of the tree doesn't matter.
+//Only the operands a node's rule actually uses get differentiated
+static TreeNode* differentiateRec(DiffState* state, TreeNode* node) {
+  assert(state);
+  if (!node)
+    return NULL;
+
+  Context* ctx = state->ctx;
+  if (ptrMapInit(&state->derivatives))
+    return NULL;
+
+  NodeStack stack = {};
+  Error err = nodeStackPush(&stack, {.node = node});
+  while (!err &&
+         stack.count) {
+    NodeFrame* frame = nodeStackTop(&stack);
+    TreeNode* current = frame->node;
+    state->level = frame->level;
+    //a shared node may be reached through several parents
+    if (!frame->stage &&
+        ptrMapGet(&state->derivatives, current)) {
+      nodeStackPop(&stack);
+      continue;
+    }
+
+    if (!frame->stage++) {
+      //no var anywhere below: a constant, nothing to walk
+      if (IS_OP(current) &&
+          !nodeDependsOn(current, state->var)) {
+        TreeNode* zero = differentiateConst(state, current);
+        err = zero
+              ? ptrMapSet(&state->derivatives, current, (size_t)zero)
+              : FailMemoryAllocation;
+        nodeStackPop(&stack);
+        continue;
+      }
+      //leaves are cheaper to differentiate than to look up
+      TreeNode* cached = (ctx->cache && IS_OP(current))
+                         ? differentiateCacheGet(state, current)
+                         : NULL;
+      if (cached) {
+        err = ptrMapSet(&state->derivatives, current, (size_t)cached);
+        nodeStackPop(&stack);
+        continue;
+      }
+
+      uint operands = differentiateOperands(state, current);
+      uint level = frame->level + 1;
+      if (operands & DIFF_RIGHT)
+        err = nodeStackPush(&stack, {.node = current->right, .level = level});
+      if (!err && (operands & DIFF_LEFT))
+        err = nodeStackPush(&stack, {.node = current->left, .level = level});
+      continue;
+    }
+
+    TreeNode* result = differentiateNode(state, current);
+    if (result && ctx->cache && IS_OP(current))
+      differentiateCachePut(state, current, result);
+    err = ptrMapSet(&state->derivatives, current, (size_t)result);
+    nodeStackPop(&stack);
+  }
+  nodeStackDestroy(&stack);
+
+  size_t value = 0;
+  TreeNode* result = (!err && ptrMapGet(&state->derivatives, node, &value))
+                     ? (TreeNode*)value
+                     : NULL;
+  if (result)
+    ptrMapSet(&state->derivatives, node, 0);
+  //whatever no rule picked up
+  for (size_t i = 0; i < state->derivatives.capacity; i++) {
+    if (state->derivatives.items[i].key &&
+        state->derivatives.items[i].value)
+      nodeDestroy((TreeNode*)state->derivatives.items[i].value, true);
+  }
+  ptrMapDestroy(&state->derivatives);
+  return result;
+}
+
+//Plain nodes have one parent, which gets the derivative itself.
+//Interned ones may have more, each gets a (shared) copy
+static TreeNode* differentiateTake(DiffState* state, TreeNode* node) {
+  assert(state);
+
+  size_t value = 0;
+  if (!node ||
+      !ptrMapGet(&state->derivatives, node, &value) ||
+      !value)
+    return NULL;
+
+  TreeNode* derivative = (TreeNode*)value;
+  if (IS_INTERNED(node))
+    return nodeCopy(derivative, NULL);
+  ptrMapSet(&state->derivatives, node, 0);
+  return derivative;
+}
+
+static uint differentiateOperands(DiffState* state, TreeNode* node) {
+  assert(state);
+
+  if (!IS_OP(node))
+    return 0;
+  const OpTypeInfo* i = parseOpType(node->data.value.op);
+  if (!i)
+    return 0;
+
+  switch (node->data.value.op) {
+    case OP_POW: return differentiatePowerOperands(state, node);
+    case OP_LOG: return DIFF_RIGHT; //the base is taken as a constant
+    default:
+      return i->argCount == 1
+             ? DIFF_RIGHT
+             : DIFF_LEFT | DIFF_RIGHT;
+  }
+}
+
+//Cached derivative of node, NULL on a miss
+static TreeNode* differentiateCacheGet(DiffState* state, TreeNode* node) {
+  assert(state && state->ctx->cache);
+
+  Context* ctx = state->ctx;
+  uint step = 0;
+  TreeNode* cached = diffCacheGet(ctx->cache, node, state->var, &step);
+  if (!cached ||
+      !ctx->sink ||
+      !texReportWants(&ctx->report, state->level, state->printed))
+    return cached;
+
+  //printed once already, just refer to it
+  if (step) {
+    ctx->stepCount++;
+    state->printed++;
+    fprintf(ctx->sink,
+            "\\raggedright(%u): same as (%u)\\\\\n",
+            ctx->stepCount, step);
+    return cached;
+  }
+  //printed during another differentiate(), whose step numbers are gone
+  cached = differentiateStep(state, node, cached);
+  diffCachePut(ctx->cache, node, state->var, cached, state->step);
+  return cached;
+}
+
+static void differentiateCachePut(DiffState* state, TreeNode* node, TreeNode* result) {
+  assert(state && state->ctx->cache);
+
+  diffCachePut(state->ctx->cache, node, state->var, result, state->step);
+}
+
+static TreeNode* differentiateNode(DiffState* state, TreeNode* node) {
+  assert(state);
   if (!node)
     return NULL;
 
   if (IS_NUM(node) || 
       (IS_VAR(node) && 
-       !OF_VAR(ctx->vars, node, var))) {
+       node->data.value.var != state->var)) {
     DUMP_TO_TEX_AND_RETURN(D_CONST);
   }
 
-  if (OF_VAR(ctx->vars, node, var)) {
+  if (IS_VAR(node)) {
     DUMP_TO_TEX_AND_RETURN(D_X);
   }
 
@@ -77,7 +311,7 @@ static TreeNode* differentiateRec(Context* ctx, TreeNode* node, const char* var)
       case OP_SUB:  DUMP_TO_TEX_AND_RETURN(SUB_(D_L, D_R));
       case OP_MUL:  DUMP_TO_TEX_AND_RETURN(ADD_(MUL_(D_L, C_R), MUL_(C_L, D_R)));
       case OP_DIV:  DUMP_TO_TEX_AND_RETURN(DIV_(SUB_(MUL_(C_R, D_L), MUL_(D_R, C_L)), SQ_(C_R)));
-      case OP_POW:  DUMP_TO_TEX_AND_RETURN(differentiatePower(ctx, node, var));
+      case OP_POW:  DUMP_TO_TEX_AND_RETURN(differentiatePower(state, node));
       case OP_SIN:  DUMP_TO_TEX_AND_RETURN(CHAIN_RULE_R(COS_(C_R)));
       case OP_COS:  DUMP_TO_TEX_AND_RETURN(CHAIN_RULE_R(NEG_(SIN_(C_R))));
       case OP_TAN:  DUMP_TO_TEX_AND_RETURN(CHAIN_RULE_R(INV_(SQ_(COS_(C_R)))));
@@ -99,51 +333,66 @@ static TreeNode* differentiateRec(Context* ctx, TreeNode* node, const char* var)
   return NULL;
 }
 
+//A whole subtree without the var, printed as one step
+static TreeNode* differentiateConst(DiffState* state, TreeNode* node) {
+  assert(state);
+
+  DUMP_TO_TEX_AND_RETURN(D_CONST);
+}
+
+//A step that ctx->report leaves out isn't simplified either
+static TreeNode* differentiateStep(DiffState* state, TreeNode* node, TreeNode* result) {
+  assert(state && state->ctx);
+
+  Context* ctx = state->ctx;
+  state->step = 0;
+  if (!ctx->sink ||
+      !result    ||
+      !texReportWants(&ctx->report, state->level, state->printed))
+    return result;
+
+  state->printed++;
+  result = differentiationStepToTex(ctx, state->varStr, node, result);
+  state->step = ctx->stepCount;
+  return result;
+}
+
 #undef DUMP_TO_TEX_AND_RETURN
 
-static TreeNode* differentiatePower(Context* ctx, TreeNode* node, const char* var) {
-  assert(ctx && !varsVerify(ctx->vars));
+static uint differentiatePowerOperands(DiffState* state, TreeNode* node) {
+  assert(state);
   if (!node ||
       !node->left ||
       !node->right)
-    return NULL;
+    return 0;
 
-  Error err = OK;
-  size_t data = 0; //to store the index when successfully found
-  /*Variable* v = */ findVar(ctx->vars, var, &err, &data);
-  if (err) //UnknownVariable or other error
-    return D_CONST;
-  bool leftContainsX  = nodeTraverse(node->left, 
-                                     .infix = findVariableCallback, 
-                                     .infixData = (void*)&data);
-  bool rightContainsX = nodeTraverse(node->right, 
-                                     .infix = findVariableCallback, 
-                                     .infixData = (void*)&data);
-  
-  if (!leftContainsX &&
-      !rightContainsX)
-    return D_CONST; 
-
-  if (leftContainsX &&
-      !rightContainsX)
-    return CHAIN_RULE_L(MUL_(C_R, POW_(C_L, (SUB_(C_R, NUM_(1))))));
-
-  if (!leftContainsX &&
-      rightContainsX) {
-    if (OF_NUM(node->left, M_E))
-      return CHAIN_RULE_R(C_(node));
-    return CHAIN_RULE_R(MUL_(C_(node), LN_(C_L)));
-  }
+  return (nodeDependsOn(node->left,  state->var) ? DIFF_LEFT  : 0) |
+         (nodeDependsOn(node->right, state->var) ? DIFF_RIGHT : 0);
+}
 
-  if (leftContainsX &&
-      rightContainsX) {
-    TreeNode* temp = MUL_(C_R, LN_(C_L));
-    nodeFixParents(temp);
-    TreeNode* result = MUL_(C_(node), D_(temp));
-    nodeDestroy(temp, true);
-    return result;
+static TreeNode* differentiatePower(DiffState* state, TreeNode* node) {
+  assert(state);
+  if (!node ||
+      !node->left ||
+      !node->right)
+    return NULL;
+
+  switch (differentiatePowerOperands(state, node)) {
+    case 0:
+      return D_CONST;
+    case DIFF_LEFT:
+      return CHAIN_RULE_L(MUL_(C_R, POW_(C_L, (SUB_(C_R, NUM_(1))))));
+    case DIFF_RIGHT:
+      if (OF_NUM(node->left, M_E))
+        return CHAIN_RULE_R(C_(node));
+      return CHAIN_RULE_R(MUL_(C_(node), LN_(C_L)));
+    case DIFF_LEFT | DIFF_RIGHT:
+      //(u^v)' = u^v * (v * ln(u))', written out so u' and v' come from D_L, D_R
+      return MUL_(C_(node), ADD_(MUL_(D_R, LN_(C_L)),
+                                 MUL_(C_R, MUL_(INV_(C_L), D_L))));
+    default:
+      return NULL;
   }
-  return NULL;
 }
 
 #undef D_CONST
@@ -4,6 +4,10 @@
 #include "diff/context.h"
 #include "ds/tree/node.h"
  
+///Looks var up once and differentiates by its index, an unknown var gives 0
 TreeNode* differentiate(Context* context, TreeNode* node, const char* var);
+///Same for the variable with index var in context->vars. Nodes are matched
+///by index, the Variables are only verified here
+TreeNode* differentiateByIndex(Context* context, TreeNode* node, size_t var);
 
 #endif
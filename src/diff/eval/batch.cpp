@@ -0,0 +1,220 @@
+#include "diff/eval/batch.h"
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <assert.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define BATCH_HAS_X86 1
+#else
+#define BATCH_HAS_X86 0
+#endif
+
+//Points per block: all registers of a block should stay in L2
+static const size_t BATCH_REGS_BUDGET = 1 << 15; //doubles
+static const size_t BATCH_MIN_LANES   = 16;
+static const size_t BATCH_MAX_LANES   = 256;
+//Every path's vector width divides this, blocks are padded up to it
+static const size_t BATCH_ALIGN_LANES = 4;
+
+typedef void (*BatchKernel)(OpType op, const double* a, const double* b,
+                            double powExp, double* out, size_t lanes);
+
+#if BATCH_HAS_X86
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+namespace avx2 {
+  #define VMATH_WIDTH 4
+  #define VMATH_SQRT(v) __builtin_ia32_sqrtpd256(v)
+  #include "diff/eval/vmath.h"
+  #undef VMATH_WIDTH
+  #undef VMATH_SQRT
+}
+#pragma GCC pop_options
+
+namespace sse2 {
+  #define VMATH_WIDTH 2
+  #define VMATH_SQRT(v) __builtin_ia32_sqrtpd(v)
+  #include "diff/eval/vmath.h"
+  #undef VMATH_WIDTH
+  #undef VMATH_SQRT
+}
+#endif
+
+static BatchPath batchProbePath();
+static size_t batchLanes(const Tape* tape);
+static void batchRunScalar(const Tape* tape, const double* const* columns, size_t n,
+                           double* out, void* scratch);
+static void batchRunVector(const Tape* tape, const double* const* columns, size_t n,
+                           double* out, void* scratch, BatchKernel kernel);
+
+static const char* const BATCH_PATH_NAMES[] = {
+  #define X(enm, s) [enm] = s,
+  BATCH_PATH_LIST()
+  #undef X
+};
+
+const char* batchPathName(BatchPath path) {
+  return ((size_t)path >= sizer(BATCH_PATH_NAMES))
+         ? NULL
+         : BATCH_PATH_NAMES[path];
+}
+
+BatchPath batchDetectPath() {
+  static const BatchPath detected = batchProbePath();
+  return detected;
+}
+
+size_t tapeBatchScratchSize(const Tape* tape) {
+  if (!tape)
+    return 0;
+
+  //vector paths: a row per instruction and a row pointer per instruction,
+  //scalar path: var values and a register per instruction
+  return (tape->count * batchLanes(tape) + tape->varCount + tape->count) * sizeof(double)
+         + tape->count * sizeof(const double*);
+}
+
+Error tapeEvalBatch(const Tape* tape, const double* const* columns, size_t n,
+                    double* out, BatchPath path) {
+  if (!tape)
+    return InvalidParameters;
+
+  void* scratch = calloc(tapeBatchScratchSize(tape) + 1, 1);
+  if (!scratch)
+    return FailMemoryAllocation;
+
+  Error err = tapeEvalBatchScratch(tape, columns, n, out, scratch, path);
+  free(scratch);
+  return err;
+}
+
+Error tapeEvalBatchScratch(const Tape* tape, const double* const* columns, size_t n,
+                           double* out, void* scratch, BatchPath path) {
+  if (!tape    ||
+      !scratch ||
+      (!out && n) ||
+      (!columns && tape->varCount))
+    return InvalidParameters;
+  for (size_t v = 0; v < tape->varCount && n; v++)
+    if (!columns[v])
+      return InvalidParameters;
+  if (!n)
+    return OK;
+
+  if (!tape->count) {
+    for (size_t k = 0; k < n; k++)
+      out[k] = NAN;
+    return OK;
+  }
+
+  BatchPath best = batchDetectPath();
+  if (path == BATCH_AUTO ||
+      path > best)
+    path = best;
+
+  switch (path) {
+#if BATCH_HAS_X86
+    case BATCH_AVX2:
+      batchRunVector(tape, columns, n, out, scratch, avx2::vmathApply);
+      return OK;
+    case BATCH_SSE2:
+      batchRunVector(tape, columns, n, out, scratch, sse2::vmathApply);
+      return OK;
+#endif
+    case BATCH_SCALAR:
+      batchRunScalar(tape, columns, n, out, scratch);
+      return OK;
+    case BATCH_AUTO:
+    default:
+      return BadEnumItem;
+  }
+}
+
+static BatchPath batchProbePath() {
+#if BATCH_HAS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") &&
+      __builtin_cpu_supports("fma"))
+    return BATCH_AVX2;
+  return BATCH_SSE2; //part of x86_64 itself
+#else
+  return BATCH_SCALAR;
+#endif
+}
+
+static size_t batchLanes(const Tape* tape) {
+  size_t lanes = BATCH_MAX_LANES;
+  while (lanes > BATCH_MIN_LANES &&
+         lanes * tape->count > BATCH_REGS_BUDGET)
+    lanes /= 2;
+  return lanes;
+}
+
+static void batchRunScalar(const Tape* tape, const double* const* columns, size_t n,
+                           double* out, void* scratch) {
+  double* values = (double*)scratch;
+  double* regs   = values + tape->varCount;
+
+  for (size_t k = 0; k < n; k++) {
+    for (size_t v = 0; v < tape->varCount; v++)
+      values[v] = columns[v][k];
+    out[k] = tapeEval(tape, values, regs);
+  }
+}
+
+static void batchRunVector(const Tape* tape, const double* const* columns, size_t n,
+                           double* out, void* scratch, BatchKernel kernel) {
+  const unsigned char* ops = tape->ops;
+  const uint* lhs = tape->lhs;
+  const uint* rhs = tape->rhs;
+  size_t lanes = batchLanes(tape);
+  double* regs = (double*)scratch;
+  const double** rows = (const double**)(void*)(regs + tape->count * lanes);
+
+  //constants are the same in every block
+  for (size_t i = 0; i < tape->count; i++) {
+    if (ops[i] != TAPE_CONST)
+      continue;
+    double* row = regs + i * lanes;
+    for (size_t k = 0; k < lanes; k++)
+      row[k] = tape->imm[i];
+    rows[i] = row;
+  }
+
+  for (size_t offset = 0; offset < n; offset += lanes) {
+    size_t valid = (n - offset < lanes) ? n - offset : lanes;
+    size_t width = (valid + BATCH_ALIGN_LANES - 1) / BATCH_ALIGN_LANES * BATCH_ALIGN_LANES;
+
+    for (size_t i = 0; i < tape->count; i++) {
+      double* row = regs + i * lanes;
+      switch (ops[i]) {
+        case TAPE_CONST:
+          break;
+        case TAPE_VAR: {
+          const double* column = columns[lhs[i]] + offset;
+          if (valid == width) {
+            rows[i] = column; //whole vectors, read in place
+            break;
+          }
+          //the padding repeats a real value so it stays in every fast range
+          memcpy(row, column, valid * sizeof(double));
+          for (size_t k = valid; k < width; k++)
+            row[k] = column[valid - 1];
+          rows[i] = row;
+          break;
+        }
+        default: {
+          double powExp = (ops[i] == TAPE_OP_POW && ops[rhs[i]] == TAPE_CONST)
+                          ? tape->imm[rhs[i]]
+                          : NAN;
+          kernel((OpType)ops[i], rows[lhs[i]], rows[rhs[i]], powExp, row, width);
+          rows[i] = row;
+          break;
+        }
+      }
+    }
+    memcpy(out + offset, rows[tape->count - 1], valid * sizeof(double));
+  }
+}
@@ -0,0 +1,143 @@
+#include "diff/eval/grad.h"
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+
+static void tapeBackward(const Tape* tape, const double* regs,
+                         double* adjoints, double* grad);
+
+#define RETURN_WITH_STATUS(value, returnValue) \
+  {                                            \
+  if (status)                                  \
+    *status = value;                           \
+  return returnValue;                          \
+  }
+
+double tapeGrad(const Tape* tape, const double* values,
+                double* regs, double* adjoints, double* grad) {
+  assert(tape && regs && adjoints);
+  assert(grad || !tape->varCount);
+
+  double result = tapeEval(tape, values, regs);
+  tapeBackward(tape, regs, adjoints, grad);
+  return result;
+}
+
+double tapeGradVars(const Tape* tape, Variables* vars, double* grad, Error* status) {
+  if (!tape ||
+      !vars ||
+      (!grad && tape->varCount))
+    RETURN_WITH_STATUS(InvalidParameters, NAN);
+  Error err = varsVerify(vars);
+  if (err)
+    RETURN_WITH_STATUS(err, NAN);
+  if (tape->varCount > vars->count)
+    RETURN_WITH_STATUS(UnknownVariable, NAN);
+
+  double* values = (double*)calloc(tape->varCount + 2 * tape->count, sizeof(double));
+  if (!values)
+    RETURN_WITH_STATUS(FailMemoryAllocation, NAN);
+  for (size_t i = 0; i < tape->varCount; i++)
+    values[i] = vars->items[i].value;
+
+  double* regs = values + tape->varCount;
+  double result = tapeGrad(tape, values, regs, regs + tape->count, grad);
+  free(values);
+  return result;
+}
+
+Error tapeGradMany(const Tape* tape, const double* points, size_t stride,
+                   size_t n, double* values, double* grads) {
+  if (!tape ||
+      (!grads  && tape->varCount && n) ||
+      (!points && tape->varCount) ||
+      stride < tape->varCount)
+    return InvalidParameters;
+
+  double* regs = (double*)calloc(tape->count ? 2 * tape->count : 1, sizeof(double));
+  if (!regs)
+    return FailMemoryAllocation;
+
+  for (size_t k = 0; k < n; k++) {
+    double value = tapeGrad(tape, points + k * stride, regs, regs + tape->count,
+                            grads + k * tape->varCount);
+    if (values)
+      values[k] = value;
+  }
+
+  free(regs);
+  return OK;
+}
+
+//adjoints[i] is d(result)/d(regs[i]), filled from the last instruction back,
+//an instruction hands its adjoint to its operands times the local derivative
+static void tapeBackward(const Tape* tape, const double* regs,
+                         double* adjoints, double* grad) {
+  for (size_t v = 0; v < tape->varCount; v++)
+    grad[v] = 0;
+  if (!tape->count)
+    return;
+
+  for (size_t i = 0; i < tape->count; i++)
+    adjoints[i] = 0;
+  adjoints[tape->count - 1] = 1;
+
+  const unsigned char* ops = tape->ops;
+  const uint* lhs = tape->lhs;
+  const uint* rhs = tape->rhs;
+  for (size_t i = tape->count; i-- > 0; ) {
+    double g = adjoints[i];
+    double a = regs[lhs[i]];
+    double b = regs[rhs[i]];
+    double r = regs[i];
+    //unary ops only ever touch adjoints[lhs[i]]
+    switch (ops[i]) {
+      case TAPE_CONST: break;
+      case TAPE_VAR:   grad[lhs[i]] += g; break;
+      case TAPE_OP_ADD:
+        adjoints[lhs[i]] += g;
+        adjoints[rhs[i]] += g;
+        break;
+      case TAPE_OP_SUB:
+        adjoints[lhs[i]] += g;
+        adjoints[rhs[i]] -= g;
+        break;
+      case TAPE_OP_MUL:
+        adjoints[lhs[i]] += g * b;
+        adjoints[rhs[i]] += g * a;
+        break;
+      case TAPE_OP_DIV:
+        adjoints[lhs[i]] += g / b;
+        adjoints[rhs[i]] -= g * r / b;
+        break;
+      case TAPE_OP_POW:
+        adjoints[lhs[i]] += g * b * pow(a, b - 1);
+        //a constant exponent is the common case and log(a) may be NAN there
+        if (ops[rhs[i]] != TAPE_CONST)
+          adjoints[rhs[i]] += g * r * log(a);
+        break;
+      case TAPE_OP_LOG: //log base a of b
+        adjoints[lhs[i]] -= g * r / (a * log(a));
+        adjoints[rhs[i]] += g / (b * log(a));
+        break;
+      case TAPE_OP_SIN:  adjoints[lhs[i]] += g * cos(a);                break;
+      case TAPE_OP_COS:  adjoints[lhs[i]] -= g * sin(a);                break;
+      case TAPE_OP_TAN:  adjoints[lhs[i]] += g * (1 + r * r);           break;
+      case TAPE_OP_COT:  adjoints[lhs[i]] -= g * (1 + r * r);           break;
+      case TAPE_OP_LN:   adjoints[lhs[i]] += g / a;                     break;
+      case TAPE_OP_ASIN: adjoints[lhs[i]] += g / sqrt(1 - a * a);       break;
+      case TAPE_OP_ACOS: adjoints[lhs[i]] -= g / sqrt(1 - a * a);       break;
+      case TAPE_OP_ATAN: adjoints[lhs[i]] += g / (1 + a * a);           break;
+      case TAPE_OP_ACOT: adjoints[lhs[i]] -= g / (1 + a * a);           break;
+      case TAPE_OP_SINH: adjoints[lhs[i]] += g * cosh(a);               break;
+      case TAPE_OP_COSH: adjoints[lhs[i]] += g * sinh(a);               break;
+      case TAPE_OP_TANH: adjoints[lhs[i]] += g * (1 - r * r);           break;
+      case TAPE_OP_COTH: adjoints[lhs[i]] += g * (1 - r * r);           break;
+      default:
+        assert(0 && "Unknown tape opcode");
+        break;
+    }
+  }
+}
+
+#undef RETURN_WITH_STATUS
@@ -0,0 +1,22 @@
+#ifndef GRAD_H
+#define GRAD_H
+
+#include <stddef.h>
+#include "diff/eval/tape.h"
+
+///Reverse mode: value and every partial derivative at one point, in one
+///forward sweep (tapeEval) and one backward sweep over the same tape.
+///regs and adjoints must hold tape->count doubles each,
+///grad gets tape->varCount partial derivatives (grad[v] is by var v).
+///Returns the value
+double tapeGrad(const Tape* tape, const double* values,
+                double* regs, double* adjoints, double* grad);
+///Takes values from Variables (Variable::value)
+double tapeGradVars(const Tape* tape, Variables* vars, double* grad,
+                    Error* status = NULL);
+///n points laid out like in tapeEvalMany. Point k gets its value in values[k]
+///(values may be NULL) and its gradient at grads + k * tape->varCount
+Error tapeGradMany(const Tape* tape, const double* points, size_t stride,
+                   size_t n, double* values, double* grads);
+
+#endif
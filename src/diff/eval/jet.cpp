@@ -0,0 +1,101 @@
+#include "diff/eval/jet.h"
+#include "diff/eval/series.h"
+#include "diff/eval/tape.h"
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+
+static void jetEval(const Tape* tape, const double* values, size_t var,
+                    uint order, Jet* regs, double* derivatives);
+
+#define RETURN_WITH_STATUS(value, returnValue) \
+  {                                            \
+  if (status)                                  \
+    *status = value;                           \
+  return returnValue;                          \
+  }
+
+Error nodeEvalJet(const TreeNode* node, const double* values, size_t var,
+                  uint order, double* derivatives) {
+  return nodeEvalJetMany(node, values, 0, 1, var, order, derivatives);
+}
+
+double nodeEvalDual(const TreeNode* node, const double* values, size_t var,
+                    double* derivative, Error* status) {
+  double result[2] = {NAN, NAN};
+  Error err = nodeEvalJet(node, values, var, 1, result);
+  if (err)
+    RETURN_WITH_STATUS(err, NAN);
+
+  if (derivative)
+    *derivative = result[1];
+  return result[0];
+}
+
+//Jets go over the tape, so a shared subterm is expanded once
+//and the depth of the tree doesn't matter
+Error nodeEvalJetMany(const TreeNode* node, const double* points, size_t stride,
+                      size_t n, size_t var, uint order, double* derivatives) {
+  if (!node ||
+      !derivatives ||
+      order > JET_MAX_ORDER)
+    return InvalidParameters;
+
+  Error err = OK;
+  Tape* tape = tapeCompile(const_cast<TreeNode*>(node), &err);
+  if (err)
+    return err;
+  if (!points && tape->varCount) {
+    tapeDestroy(tape, true);
+    return InvalidParameters;
+  }
+  Jet* regs = (Jet*)calloc(tape->count, sizeof(Jet));
+  if (!regs)
+    err = FailMemoryAllocation;
+
+  for (size_t k = 0; k < n && !err; k++)
+    jetEval(tape, points ? points + k * stride : NULL, var, order, regs,
+            derivatives + k * (order + 1));
+
+  free(regs);
+  tapeDestroy(tape, true);
+  return err;
+}
+
+//regs holds a jet per instruction of tape
+static void jetEval(const Tape* tape, const double* values, size_t var,
+                    uint order, Jet* regs, double* derivatives) {
+  assert(tape && tape->count && regs && derivatives);
+
+  double scratch[SERIES_SCRATCH_COUNT * (JET_MAX_ORDER + 1)] = {};
+  for (size_t i = 0; i < tape->count; i++) {
+    Jet* result = regs + i;
+    uint lhs = tape->lhs[i];
+    switch (tape->ops[i]) {
+      case TAPE_CONST:
+        *result = {};
+        result->c[0] = tape->imm[i];
+        break;
+      case TAPE_VAR:
+        *result = {};
+        result->c[0] = values[lhs];
+        result->c[1] = (lhs == var) ? 1 : 0;
+        break;
+      default:
+        //every result keeps applyOperation's value as c[0], so order 0 is nodeEval.
+        //Unary ops have rhs pointing at lhs, which they don't read anyway
+        seriesApply((OpType)tape->ops[i], result->c, regs[lhs].c,
+                    regs[tape->rhs[i]].c, order, scratch);
+        break;
+    }
+  }
+  const Jet* jet = regs + tape->count - 1;
+  double factorial = 1;
+  for (uint k = 0; k <= order; k++) {
+    if (k)
+      factorial *= k;
+    derivatives[k] = jet->c[k] * factorial;
+  }
+}
+
+#undef RETURN_WITH_STATUS
@@ -0,0 +1,31 @@
+#ifndef JET_H
+#define JET_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "ds/tree/node.h"
+
+const uint JET_MAX_ORDER = 3;
+
+///Truncated Taylor series of a subexpression around the evaluation point:
+///c[k] = f^(k) / k!, terms past the requested order are left as they are
+struct Jet {
+  double c[JET_MAX_ORDER + 1] = {};
+};
+
+///Forward mode over the node's tape (a shared subterm is expanded once),
+///no derivative tree is built.
+///Fills derivatives[k] = d^k node / d var^k for k = 0..order (order <= JET_MAX_ORDER),
+///derivatives[0] is exactly what nodeEval gives.
+///values[i] is the value of var with index i, like in nodeEval
+Error nodeEvalJet(const TreeNode* node, const double* values, size_t var,
+                  uint order, double* derivatives);
+///Order 1 (dual numbers): returns the value, derivative goes to *derivative
+double nodeEvalDual(const TreeNode* node, const double* values, size_t var,
+                    double* derivative, Error* status = NULL);
+///n points like in tapeEvalMany, point k gets its derivatives
+///at derivatives + k * (order + 1). The tape is compiled once for all of them
+Error nodeEvalJetMany(const TreeNode* node, const double* points, size_t stride,
+                      size_t n, size_t var, uint order, double* derivatives);
+
+#endif
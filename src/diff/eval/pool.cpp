@@ -0,0 +1,231 @@
+#include "diff/eval/pool.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <assert.h>
+
+static const size_t EVAL_POOL_MIN_CHUNK  = 1024; //points
+static const size_t EVAL_POOL_CHUNK_STEP = 256;  //a batch block
+//at least this many chunks per thread, so a slow thread doesn't hold up the rest
+static const size_t EVAL_POOL_CHUNKS_PER_THREAD = 4;
+
+static void* evalPoolWorkerMain(void* arg);
+static Error evalPoolWork(EvalPoolWorker* worker);
+static Error evalPoolReserve(EvalPoolWorker* worker, const Tape* tape);
+static size_t evalPoolChunk(const EvalPool* pool, const Tape* tape, size_t n);
+static void evalPoolStop(EvalPool* pool, size_t started);
+
+#define RETURN_WITH_STATUS(value, returnValue) \
+  {                                            \
+  if (status)                                  \
+    *status = value;                           \
+  return returnValue;                          \
+  }
+
+EvalPool* evalPoolAlloc(size_t threadCount, size_t chunkBytes, Error* status) {
+  if (!chunkBytes)
+    RETURN_WITH_STATUS(InvalidParameters, NULL);
+  if (!threadCount) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threadCount = online > 0
+                  ? (size_t)online
+                  : 1;
+  }
+
+  EvalPool* pool = (EvalPool*)calloc(1, sizeof(EvalPool));
+  if (!pool)
+    RETURN_WITH_STATUS(FailMemoryAllocation, NULL);
+  *pool = {};
+  pool->threadCount = threadCount;
+  pool->chunkBytes  = chunkBytes;
+
+  pool->workers = (EvalPoolWorker*)calloc(threadCount, sizeof(EvalPoolWorker));
+  if (!pool->workers) {
+    free(pool);
+    RETURN_WITH_STATUS(FailMemoryAllocation, NULL);
+  }
+  for (size_t i = 0; i < threadCount; i++)
+    pool->workers[i] = {.pool = pool};
+
+  pthread_mutex_init(&pool->lock,   NULL);
+  pthread_cond_init (&pool->start,  NULL);
+  pthread_cond_init (&pool->finish, NULL);
+
+  for (size_t i = 1; i < threadCount; i++) {
+    if (pthread_create(&pool->workers[i].thread, NULL,
+                       evalPoolWorkerMain, pool->workers + i)) {
+      evalPoolStop(pool, i);
+      pool->threadCount = i;
+      evalPoolDestroy(pool, true);
+      RETURN_WITH_STATUS(FailMemoryAllocation, NULL);
+    }
+  }
+  return pool;
+}
+
+Error evalPoolDestroy(EvalPool* pool, bool isAlloced) {
+  if (!pool)
+    return InvalidParameters;
+
+  if (!pool->stop)
+    evalPoolStop(pool, pool->threadCount);
+
+  //workers are done, their memory can be freed from here
+  for (size_t i = 0; i < pool->threadCount; i++) {
+    free(pool->workers[i].scratch);
+    free(pool->workers[i].columns);
+  }
+  free(pool->workers);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy (&pool->start);
+  pthread_cond_destroy (&pool->finish);
+  *pool = {};
+
+  if (isAlloced)
+    free(pool);
+  return OK;
+}
+
+Error evalPoolRun(EvalPool* pool, const Tape* tape, const double* const* columns,
+                  size_t n, double* out, BatchPath path) {
+  if (!pool          ||
+      !pool->workers ||
+      pool->stop     ||
+      !tape          ||
+      (!out && n)    ||
+      (!columns && tape->varCount))
+    return InvalidParameters;
+  for (size_t v = 0; v < tape->varCount && n; v++)
+    if (!columns[v])
+      return InvalidParameters;
+  if (!n)
+    return OK;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->job = {
+    .tape    = tape,
+    .columns = columns,
+    .out     = out,
+    .n       = n,
+    .chunk   = evalPoolChunk(pool, tape, n),
+    .next    = 0,
+    .path    = path,
+    .err     = OK
+  };
+  pool->running = pool->threadCount - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  Error err = evalPoolWork(pool->workers);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->running)
+    pthread_cond_wait(&pool->finish, &pool->lock);
+  if (!err)
+    err = pool->job.err;
+  pool->job = {};
+  pool->runs++;
+  pthread_mutex_unlock(&pool->lock);
+  return err;
+}
+
+static void* evalPoolWorkerMain(void* arg) {
+  EvalPoolWorker* worker = (EvalPoolWorker*)arg;
+  EvalPool* pool = worker->pool;
+  size_t seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (!pool->stop &&
+           pool->generation == seen)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    if (pool->stop)
+      break;
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    Error err = evalPoolWork(worker);
+
+    pthread_mutex_lock(&pool->lock);
+    if (err && !pool->job.err)
+      pool->job.err = err;
+    if (--pool->running == 0)
+      pthread_cond_signal(&pool->finish);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+static Error evalPoolWork(EvalPoolWorker* worker) {
+  EvalPoolJob* job = &worker->pool->job;
+  Error err = evalPoolReserve(worker, job->tape);
+  if (err)
+    return err;
+
+  while (true) {
+    size_t first = __atomic_fetch_add(&job->next, job->chunk, __ATOMIC_RELAXED);
+    if (first >= job->n)
+      return OK;
+    size_t count = (job->n - first < job->chunk)
+                   ? job->n - first
+                   : job->chunk;
+
+    for (size_t v = 0; v < job->tape->varCount; v++)
+      worker->columns[v] = job->columns[v] + first;
+    err = tapeEvalBatchScratch(job->tape, worker->columns, count, job->out + first,
+                               worker->scratch, job->path);
+    if (err)
+      return err;
+    worker->chunks++;
+  }
+}
+
+//Called by the worker's own thread, so its scratch is first touched there
+static Error evalPoolReserve(EvalPoolWorker* worker, const Tape* tape) {
+  assert(worker && tape);
+
+  size_t scratchSize = tapeBatchScratchSize(tape);
+  if (scratchSize > worker->scratchSize) {
+    free(worker->scratch);
+    worker->scratchSize = 0;
+    worker->scratch = calloc(scratchSize, 1);
+    if (!worker->scratch)
+      return FailMemoryAllocation;
+    worker->scratchSize = scratchSize;
+  }
+
+  if (tape->varCount > worker->columnCount) {
+    free(worker->columns);
+    worker->columnCount = 0;
+    worker->columns = (const double**)calloc(tape->varCount, sizeof(const double*));
+    if (!worker->columns)
+      return FailMemoryAllocation;
+    worker->columnCount = tape->varCount;
+  }
+  return OK;
+}
+
+static size_t evalPoolChunk(const EvalPool* pool, const Tape* tape, size_t n) {
+  size_t pointBytes = (tape->varCount + 1) * sizeof(double);
+  size_t chunk = pool->chunkBytes / pointBytes;
+
+  size_t balanced = n / (pool->threadCount * EVAL_POOL_CHUNKS_PER_THREAD);
+  if (balanced < chunk)
+    chunk = balanced;
+  if (chunk < EVAL_POOL_MIN_CHUNK)
+    chunk = EVAL_POOL_MIN_CHUNK;
+  return chunk / EVAL_POOL_CHUNK_STEP * EVAL_POOL_CHUNK_STEP;
+}
+
+//Joins workers 1..started-1
+static void evalPoolStop(EvalPool* pool, size_t started) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (size_t i = 1; i < started; i++)
+    pthread_join(pool->workers[i].thread, NULL);
+}
+
+#undef RETURN_WITH_STATUS
@@ -0,0 +1,67 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "diff/eval/batch.h"
+
+//L2 sized: var columns and results of one chunk
+const size_t EVAL_POOL_DEFAULT_CHUNK_BYTES = 1 << 18;
+
+struct EvalPool;
+
+///One per thread, the calling thread is worker 0.
+///scratch and columns are allocated by the thread that uses them
+struct EvalPoolWorker {
+  EvalPool* pool = NULL;
+  pthread_t thread = {};
+  void* scratch = NULL;
+  size_t scratchSize = 0;
+  const double** columns = NULL; //var columns shifted to the current chunk
+  size_t columnCount = 0;
+  size_t chunks = 0;             //chunks done, over all runs
+};
+
+///What evalPoolRun is doing right now, read only for workers except next
+struct EvalPoolJob {
+  const Tape* tape = NULL;
+  const double* const* columns = NULL;
+  double* out = NULL;
+  size_t n     = 0;
+  size_t chunk = 0;
+  size_t next  = 0; //first point of the next free chunk, taken atomically
+  BatchPath path = BATCH_AUTO;
+  Error err = OK;   //first error any worker hit
+};
+
+///Fixed set of threads evaluating one tape over a large set of points.
+///Points are split into chunks that workers take one by one, the tape is
+///shared and never written to, Variables aren't used at all
+struct EvalPool {
+  EvalPoolWorker* workers = NULL;
+  size_t threadCount = 0;
+  size_t chunkBytes  = EVAL_POOL_DEFAULT_CHUNK_BYTES;
+  size_t runs = 0;
+
+  pthread_mutex_t lock   = {};
+  pthread_cond_t  start  = {};
+  pthread_cond_t  finish = {};
+  size_t generation = 0; //bumped by every run, workers wait for a change
+  size_t running    = 0; //workers that haven't finished the current run
+  bool   stop       = false;
+  EvalPoolJob job = {};
+};
+
+///threadCount of 0 means one per online cpu
+EvalPool* evalPoolAlloc(size_t threadCount = 0,
+                        size_t chunkBytes = EVAL_POOL_DEFAULT_CHUNK_BYTES,
+                        Error* status = NULL);
+Error evalPoolDestroy(EvalPool* pool, bool isAlloced = false);
+
+///Same contract as tapeEvalBatch (columns[v][k] is var v at point k),
+///the calling thread works too and returns when every point is done.
+///A pool runs one job at a time
+Error evalPoolRun(EvalPool* pool, const Tape* tape, const double* const* columns,
+                  size_t n, double* out, BatchPath path = BATCH_AUTO);
+
+#endif
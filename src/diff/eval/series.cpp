@@ -0,0 +1,218 @@
+#include "diff/eval/series.h"
+#include <math.h>
+#include <limits.h>
+#include <assert.h>
+
+static void seriesDiv(double* r, const double* a, const double* b, double value, uint n);
+static void seriesExp(double* r, const double* a, double value, uint n);
+static void seriesLn(double* r, const double* a, double value, uint n);
+static void seriesPow(double* r, const double* a, const double* b, double value,
+                      uint n, double* scratch);
+static void seriesSinCos(double* s, double* c, const double* a, bool hyperbolic, uint n);
+static void seriesIntegrate(double* r, const double* a, const double* q, double value, uint n);
+
+void seriesApply(OpType op, double* r, const double* a, const double* b,
+                 uint n, double* scratch) {
+  assert(r && a && scratch);
+
+  double value = applyOperation(op, a[0], b ? b[0] : NAN);
+  double* t[SERIES_SCRATCH_COUNT] = {};
+  for (size_t k = 0; k < SERIES_SCRATCH_COUNT; k++)
+    t[k] = scratch + k * (n + 1);
+
+  switch (op) {
+    case OP_ADD:
+      for (uint k = 0; k <= n; k++)
+        r[k] = a[k] + b[k];
+      break;
+    case OP_SUB:
+      for (uint k = 0; k <= n; k++)
+        r[k] = a[k] - b[k];
+      break;
+    case OP_MUL: seriesMul(r, a, b, n);                 break;
+    case OP_DIV: seriesDiv(r, a, b, value, n);          break;
+    case OP_POW: seriesPow(r, a, b, value, n, scratch); break;
+    case OP_LN:  seriesLn(r, a, value, n);              break;
+    case OP_LOG:
+      seriesLn(t[0], a, log(a[0]), n);
+      seriesLn(t[1], b, log(b[0]), n);
+      seriesDiv(r, t[1], t[0], value, n);
+      break;
+    case OP_SIN:
+    case OP_COS:
+    case OP_TAN:
+    case OP_COT:
+    case OP_SINH:
+    case OP_COSH:
+    case OP_TANH:
+    case OP_COTH: {
+      bool hyperbolic = (op == OP_SINH || op == OP_COSH ||
+                         op == OP_TANH || op == OP_COTH);
+      double* s = t[0];
+      double* c = t[1];
+      seriesSinCos(s, c, a, hyperbolic, n);
+      const double* src = NULL;
+      if      (op == OP_SIN  || op == OP_SINH) src = s;
+      else if (op == OP_COS  || op == OP_COSH) src = c;
+      else if (op == OP_TAN  || op == OP_TANH) seriesDiv(r, s, c, value, n);
+      else                                     seriesDiv(r, c, s, value, n);
+      for (uint k = 0; src && k <= n; k++)
+        r[k] = src[k];
+      break;
+    }
+    case OP_ASIN:
+    case OP_ACOS:
+    case OP_ATAN:
+    case OP_ACOT: {
+      //f' = q * a', q is (1 - a^2)^(-1/2) or 1 / (1 + a^2) up to sign
+      double* sq       = t[0];
+      double* base     = t[1];
+      double* exponent = t[2];
+      double* q        = t[3];
+      seriesMul(sq, a, a, n);
+      bool isSin = (op == OP_ASIN || op == OP_ACOS);
+      for (uint k = 0; k <= n; k++) {
+        base[k]     = isSin ? -sq[k] : sq[k];
+        exponent[k] = 0;
+      }
+      base[0] += 1;
+      exponent[0] = isSin ? -0.5 : -1;
+
+      seriesPow(q, base, exponent, pow(base[0], exponent[0]), n, t[4]);
+      if (op == OP_ACOS || op == OP_ACOT)
+        for (uint k = 0; k <= n; k++)
+          q[k] = -q[k];
+      seriesIntegrate(r, a, q, value, n);
+      break;
+    }
+    default:
+      for (uint k = 0; k <= n; k++)
+        r[k] = NAN;
+      break;
+  }
+
+  r[0] = value;
+}
+
+void seriesMul(double* r, const double* a, const double* b, uint n) {
+  for (uint k = 0; k <= n; k++) {
+    double sum = 0;
+    for (uint j = 0; j <= k; j++)
+      sum += a[j] * b[k - j];
+    r[k] = sum;
+  }
+}
+
+bool seriesIsConst(const double* a, uint n) {
+  for (uint k = 1; k <= n; k++)
+    if (fpclassify(a[k]) != FP_ZERO)
+      return false;
+  return true;
+}
+
+static void seriesDiv(double* r, const double* a, const double* b, double value, uint n) {
+  r[0] = value;
+  for (uint k = 1; k <= n; k++) {
+    double sum = a[k];
+    for (uint j = 1; j <= k; j++)
+      sum -= b[j] * r[k - j];
+    r[k] = sum / b[0];
+  }
+}
+
+static void seriesExp(double* r, const double* a, double value, uint n) {
+  r[0] = value;
+  for (uint k = 1; k <= n; k++) {
+    double sum = 0;
+    for (uint j = 1; j <= k; j++)
+      sum += j * a[j] * r[k - j];
+    r[k] = sum / k;
+  }
+}
+
+static void seriesLn(double* r, const double* a, double value, uint n) {
+  r[0] = value;
+  for (uint k = 1; k <= n; k++) {
+    double sum = 0;
+    for (uint j = 1; j < k; j++)
+      sum += j * r[j] * a[k - j];
+    r[k] = (a[k] - sum / k) / a[0];
+  }
+}
+
+//Uses 2 series of scratch
+static void seriesPow(double* r, const double* a, const double* b, double value,
+                      uint n, double* scratch) {
+  double* lnA      = scratch;
+  double* exponent = scratch + (n + 1);
+
+  if (seriesIsConst(b, n)) {
+    double e = b[0];
+    if (fpclassify(a[0]) != FP_ZERO) {
+      r[0] = value;
+      for (uint k = 1; k <= n; k++) {
+        double sum = 0;
+        for (uint j = 1; j <= k; j++)
+          sum += ((e + 1) * j - k) * a[j] * r[k - j];
+        r[k] = sum / (k * a[0]);
+      }
+      return;
+    }
+
+    //the recurrence divides by a, at a = 0 natural powers are plain products
+    if (e >= 0 && e <= UINT_MAX && fpclassify(e - floor(e)) == FP_ZERO) {
+      double* square = lnA;
+      double* product = exponent;
+      for (uint k = 0; k <= n; k++) {
+        r[k] = 0;
+        square[k] = a[k];
+      }
+      r[0] = 1;
+      for (uint p = (uint)e; p; p >>= 1) {
+        if (p & 1) {
+          seriesMul(product, r, square, n);
+          for (uint k = 0; k <= n; k++)
+            r[k] = product[k];
+        }
+        seriesMul(product, square, square, n);
+        for (uint k = 0; k <= n; k++)
+          square[k] = product[k];
+      }
+      return;
+    }
+  }
+
+  //a^b = exp(b * ln(a))
+  seriesLn(lnA, a, log(a[0]), n);
+  seriesMul(exponent, b, lnA, n);
+  seriesExp(r, exponent, value, n);
+}
+
+//s and c are sin and cos (or sinh and cosh) of a: s' = c a', c' = -+s a'
+static void seriesSinCos(double* s, double* c, const double* a, bool hyperbolic, uint n) {
+  s[0] = hyperbolic ? sinh(a[0]) : sin(a[0]);
+  c[0] = hyperbolic ? cosh(a[0]) : cos(a[0]);
+  for (uint k = 1; k <= n; k++) {
+    double sumS = 0;
+    double sumC = 0;
+    for (uint j = 1; j <= k; j++) {
+      sumS += j * a[j] * c[k - j];
+      sumC += j * a[j] * s[k - j];
+    }
+    s[k] = sumS / k;
+    c[k] = hyperbolic
+           ? sumC / k
+           : -sumC / k;
+  }
+}
+
+//f with f' = q * a'
+static void seriesIntegrate(double* r, const double* a, const double* q, double value, uint n) {
+  r[0] = value;
+  for (uint k = 1; k <= n; k++) {
+    double sum = 0;
+    for (uint j = 1; j <= k; j++)
+      sum += j * a[j] * q[k - j];
+    r[k] = sum / k;
+  }
+}
@@ -0,0 +1,22 @@
+#ifndef SERIES_H
+#define SERIES_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "ds/tree/nodetype.h"
+
+//Truncated power series: s[k] is the coefficient of t^k, k = 0..n
+
+///Series seriesApply() needs as scratch, each n + 1 doubles long
+const size_t SERIES_SCRATCH_COUNT = 6;
+
+///r = op(a, b), b is ignored by unary ops and may be NULL for them.
+///r[0] is exactly applyOperation's value. Every op costs O(n^2).
+///r must not alias a, b or scratch
+void seriesApply(OpType op, double* r, const double* a, const double* b,
+                 uint n, double* scratch);
+
+void seriesMul(double* r, const double* a, const double* b, uint n);
+bool seriesIsConst(const double* a, uint n);
+
+#endif
@@ -0,0 +1,266 @@
+#include "diff/eval/tape.h"
+#include "ds/map/ptrmap.h"
+#include "ds/stack/stack.h"
+#include <stdlib.h>
+#include <assert.h>
+
+static const size_t TAPE_DEFAULT_CAPACITY = 64;
+
+static Error tapeEmit(Tape* tape, TreeNode* node, PtrMap* shared);
+static Error tapePush(Tape* tape, unsigned char op, uint lhs, uint rhs, double imm);
+static Error tapeGrow(Tape* tape);
+
+#define RETURN_WITH_STATUS(value, returnValue) \
+  {                                            \
+  if (status)                                  \
+    *status = value;                           \
+  return returnValue;                          \
+  }
+
+Tape* tapeCompile(TreeNode* node, Error* status) {
+  if (!node)
+    RETURN_WITH_STATUS(InvalidParameters, NULL);
+
+  Tape* tape = (Tape*)calloc(1, sizeof(Tape));
+  if (!tape)
+    RETURN_WITH_STATUS(FailMemoryAllocation, NULL);
+
+  PtrMap shared = {};
+  Error err = ptrMapInit(&shared);
+  if (!err)
+    err = tapeEmit(tape, node, &shared);
+  ptrMapDestroy(&shared);
+  if (err) {
+    tapeDestroy(tape, true);
+    RETURN_WITH_STATUS(err, NULL);
+  }
+  return tape;
+}
+
+Error tapeDestroy(Tape* tape, bool isAlloced) {
+  if (!tape)
+    return InvalidParameters;
+
+  free(tape->ops);
+  free(tape->lhs);
+  free(tape->rhs);
+  free(tape->imm);
+  *tape = {};
+
+  if (isAlloced)
+    free(tape);
+  return OK;
+}
+
+double tapeEval(const Tape* tape, const double* values, double* regs) {
+  assert(tape && regs);
+  assert(values || !tape->varCount);
+
+  const unsigned char* ops = tape->ops;
+  const uint* lhs = tape->lhs;
+  const uint* rhs = tape->rhs;
+  for (size_t i = 0; i < tape->count; i++) {
+    switch (ops[i]) {
+      case TAPE_CONST:  regs[i] = tape->imm[i];                  break;
+      case TAPE_VAR:    regs[i] = values[lhs[i]];                break;
+      case TAPE_OP_ADD: regs[i] = regs[lhs[i]] + regs[rhs[i]];   break;
+      case TAPE_OP_SUB: regs[i] = regs[lhs[i]] - regs[rhs[i]];   break;
+      case TAPE_OP_MUL: regs[i] = regs[lhs[i]] * regs[rhs[i]];   break;
+      case TAPE_OP_DIV: regs[i] = regs[lhs[i]] / regs[rhs[i]];   break;
+      default:
+        regs[i] = applyOperation((OpType)ops[i], regs[lhs[i]], regs[rhs[i]]);
+        break;
+    }
+  }
+  return tape->count
+         ? regs[tape->count - 1]
+         : NAN;
+}
+
+double tapeEvalVars(const Tape* tape, Variables* vars, Error* status) {
+  if (!tape ||
+      !vars)
+    RETURN_WITH_STATUS(InvalidParameters, NAN);
+  Error err = varsVerify(vars);
+  if (err)
+    RETURN_WITH_STATUS(err, NAN);
+  if (tape->varCount > vars->count)
+    RETURN_WITH_STATUS(UnknownVariable, NAN);
+
+  double* values = (double*)calloc(tape->varCount + tape->count, sizeof(double));
+  if (!values)
+    RETURN_WITH_STATUS(FailMemoryAllocation, NAN);
+  for (size_t i = 0; i < tape->varCount; i++)
+    values[i] = vars->items[i].value;
+
+  double result = tapeEval(tape, values, values + tape->varCount);
+  free(values);
+  return result;
+}
+
+Error tapeEvalMany(const Tape* tape, const double* points, size_t stride,
+                   size_t n, double* out) {
+  if (!tape ||
+      !out  ||
+      (!points && tape->varCount) ||
+      stride < tape->varCount)
+    return InvalidParameters;
+
+  double* regs = (double*)calloc(tape->count ? tape->count : 1, sizeof(double));
+  if (!regs)
+    return FailMemoryAllocation;
+
+  for (size_t k = 0; k < n; k++)
+    out[k] = tapeEval(tape, points + k * stride, regs);
+
+  free(regs);
+  return OK;
+}
+
+double nodeEval(TreeNode* node, const double* values) {
+  if (!node)
+    return NAN;
+
+  switch (node->data.type) {
+    case NUM_TYPE: return node->data.value.num;
+    case VAR_TYPE: return values[node->data.value.var];
+    case OP_TYPE: {
+      const OpTypeInfo* i = parseOpType(node->data.value.op);
+      if (!i)
+        return NAN;
+      return i->argCount == 1
+             ? applyOperation(node->data.value.op, nodeEval(node->right, values))
+             : applyOperation(node->data.value.op, nodeEval(node->left,  values),
+                                                   nodeEval(node->right, values));
+    }
+    default:
+      return NAN;
+  }
+}
+
+//Postorder with an explicit stack, so the depth of the tree doesn't matter.
+//slot is the register of the node finished last, which is the operand
+//its parent reads once the walk gets back to it
+static Error tapeEmit(Tape* tape, TreeNode* node, PtrMap* shared) {
+  assert(tape && node && shared);
+
+  NodeStack stack = {};
+  uint slot = 0;
+  Error err = nodeStackPush(&stack, {.node = node});
+  while (!err &&
+         stack.count) {
+    NodeFrame* frame = nodeStackTop(&stack);
+    TreeNode* current = frame->node;
+    size_t known = 0;
+    if (!frame->stage &&
+        IS_INTERNED(current) &&
+        ptrMapGet(shared, current, &known)) {
+      slot = (uint)known;
+      nodeStackPop(&stack);
+      continue;
+    }
+
+    switch (current->data.type) {
+      case NUM_TYPE:
+        err = tapePush(tape, TAPE_CONST, 0, 0, current->data.value.num);
+        break;
+      case VAR_TYPE:
+        if (current->data.value.var >= tape->varCount)
+          tape->varCount = current->data.value.var + 1;
+        err = tapePush(tape, TAPE_VAR, (uint)current->data.value.var, 0, NAN);
+        break;
+      case OP_TYPE: {
+        const OpTypeInfo* i = parseOpType(current->data.value.op);
+        if (!i) {
+          err = UnknownEnumItem;
+          break;
+        }
+        //unary ops keep their argument on the right
+        bool isUnary = (i->argCount == 1);
+        if (!current->right ||
+            (!isUnary && !current->left)) {
+          err = InvalidParameters;
+          break;
+        }
+        unsigned char op = (unsigned char)current->data.value.op;
+        switch (frame->stage++) {
+          case 0:
+            err = nodeStackPush(&stack, {.node = isUnary
+                                                 ? current->right
+                                                 : current->left});
+            continue;
+          case 1:
+            if (isUnary) {
+              err = tapePush(tape, op, slot, 0, NAN);
+              break;
+            }
+            frame->level = slot; //the left operand's register
+            err = nodeStackPush(&stack, {.node = current->right});
+            continue;
+          default:
+            err = tapePush(tape, op, frame->level, slot, NAN);
+            break;
+        }
+        break;
+      }
+      default:
+        err = BadEnumItem;
+        break;
+    }
+    if (err)
+      break;
+
+    slot = (uint)(tape->count - 1);
+    if (IS_INTERNED(current))
+      err = ptrMapSet(shared, current, slot);
+    nodeStackPop(&stack);
+  }
+
+  nodeStackDestroy(&stack);
+  return err;
+}
+
+static Error tapePush(Tape* tape, unsigned char op, uint lhs, uint rhs, double imm) {
+  if (tape->count == tape->capacity) {
+    Error err = tapeGrow(tape);
+    if (err)
+      return err;
+  }
+
+  size_t i = tape->count++;
+  tape->ops[i] = op;
+  tape->lhs[i] = lhs;
+  //unary ops read rhs too (applyOperation ignores it), point it somewhere valid
+  tape->rhs[i] = (op < TAPE_CONST && parseOpType((OpType)op)->argCount == 1)
+                 ? lhs
+                 : rhs;
+  tape->imm[i] = imm;
+  return OK;
+}
+
+static Error tapeGrow(Tape* tape) {
+  size_t newCapacity = tape->capacity
+                       ? tape->capacity * 2
+                       : TAPE_DEFAULT_CAPACITY;
+  unsigned char* ops = (unsigned char*)realloc(tape->ops, newCapacity * sizeof(unsigned char));
+  if (!ops)
+    return FailMemoryReallocation;
+  tape->ops = ops;
+  uint* lhs = (uint*)realloc(tape->lhs, newCapacity * sizeof(uint));
+  if (!lhs)
+    return FailMemoryReallocation;
+  tape->lhs = lhs;
+  uint* rhs = (uint*)realloc(tape->rhs, newCapacity * sizeof(uint));
+  if (!rhs)
+    return FailMemoryReallocation;
+  tape->rhs = rhs;
+  double* imm = (double*)realloc(tape->imm, newCapacity * sizeof(double));
+  if (!imm)
+    return FailMemoryReallocation;
+  tape->imm = imm;
+
+  tape->capacity = newCapacity;
+  return OK;
+}
+
+#undef RETURN_WITH_STATUS
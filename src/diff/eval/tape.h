@@ -0,0 +1,46 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "diff/context.h"
+
+//Tape opcodes: every OpType keeps its value, leaves come after them
+enum TapeOpcode {
+  #define X(enm, ...) TAPE_##enm,
+  OP_TYPE_LIST()
+  #undef X
+  TAPE_CONST,
+  TAPE_VAR,
+};
+
+///Flat post-order form of an expression. Instruction i writes register i,
+///so evaluation is one pass over contiguous arrays without pointer chasing.
+///Operands: binary ops read lhs and rhs, unary ops read lhs only,
+///TAPE_VAR reads var value lhs, TAPE_CONST reads imm
+struct Tape {
+  unsigned char* ops = NULL;
+  uint*   lhs = NULL;
+  uint*   rhs = NULL;
+  double* imm = NULL;
+  size_t count    = 0;
+  size_t capacity = 0;
+  size_t varCount = 0; //highest var index used + 1
+};
+
+///Shared (interned) subtrees are compiled once
+Tape* tapeCompile(TreeNode* node, Error* status = NULL);
+Error tapeDestroy(Tape* tape, bool isAlloced = false);
+
+///values[i] is the value of var with index i, regs must hold tape->count doubles
+double tapeEval(const Tape* tape, const double* values, double* regs);
+///Takes values from Variables (Variable::value)
+double tapeEvalVars(const Tape* tape, Variables* vars, Error* status = NULL);
+///Evaluates at n points: point k has its values at points + k * stride
+Error tapeEvalMany(const Tape* tape, const double* points, size_t stride,
+                   size_t n, double* out);
+
+///Naive recursive evaluation of the tree itself, the reference for the tape
+double nodeEval(TreeNode* node, const double* values);
+
+#endif
@@ -0,0 +1,277 @@
+#include "diff/eval/taylor.h"
+#include "diff/eval/series.h"
+#include "ds/tree/store.h"
+#include "ds/stack/stack.h"
+#include "ds/map/ptrmap.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+const size_t TAYLOR_DEFAULT_ROWS = 64;
+
+//Rows of order + 1 coefficients, one per finished operand that is still
+//waiting for its op. A shared (interned) node is expanded once, its row is
+//kept in memo and copied whenever the node comes up again
+struct TaylorRows {
+  double* data = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+};
+
+struct TaylorState {
+  const double* values = NULL;
+  size_t var = 0;
+  uint order = 0;
+  TaylorRows operands = {};
+  TaylorRows memoRows = {};
+  PtrMap memo = {};       //interned node -> its row in memoRows
+  double* scratch = NULL; //the op's result and what seriesApply() needs
+};
+
+static Error taylorEval(const TreeNode* node, TaylorState* state);
+static Error taylorApply(const TreeNode* node, TaylorState* state);
+static double* taylorRowPush(TaylorRows* rows, size_t rowSize, Error* err);
+static TreeNode* taylorNode(NodeUnit data, TreeNode* left, TreeNode* right,
+                            Error* err);
+static TreeNode* taylorTerm(double coeff, uint power, size_t var, double x0,
+                            Error* err);
+
+#define RETURN_WITH_STATUS(value, returnValue) \
+  {                                            \
+  if (status)                                  \
+    *status = value;                           \
+  return returnValue;                          \
+  }
+
+Error nodeTaylor(const TreeNode* node, const double* values, size_t var,
+                 uint order, double* coeffs) {
+  if (!node   ||
+      !values ||
+      !coeffs)
+    return InvalidParameters;
+
+  size_t rowSize = order + 1;
+  TaylorState state = {
+    .values  = values,
+    .var     = var,
+    .order   = order,
+    .scratch = (double*)calloc((1 + SERIES_SCRATCH_COUNT) * rowSize, sizeof(double))
+  };
+  Error err = state.scratch
+              ? ptrMapInit(&state.memo)
+              : FailMemoryAllocation;
+  if (!err)
+    err = taylorEval(node, &state);
+  if (!err)
+    memcpy(coeffs, state.operands.data, rowSize * sizeof(double));
+
+  free(state.operands.data);
+  free(state.memoRows.data);
+  free(state.scratch);
+  ptrMapDestroy(&state.memo);
+  return err;
+}
+
+TreeNode* taylorToTree(const double* coeffs, uint order, size_t var, double x0,
+                       Error* status) {
+  if (!coeffs)
+    RETURN_WITH_STATUS(InvalidParameters, NULL);
+
+  Error err = OK;
+  TreeNode* sum = NULL;
+  for (uint k = 0; k <= order && !err; k++) {
+    double coeff = coeffs[k];
+    if (fpclassify(coeff) == FP_ZERO)
+      continue;
+
+    //- |c| * term reads better than + (-c) * term
+    bool isSubtracted = (sum && coeff < 0);
+    TreeNode* term = taylorTerm(isSubtracted ? -coeff : coeff, k, var, x0, &err);
+    if (err)
+      break;
+    sum = !sum
+          ? term
+          : taylorNode({.type = OP_TYPE, .value = {.op = isSubtracted ? OP_SUB : OP_ADD}},
+                       sum, term, &err);
+  }
+  if (!err && !sum)
+    sum = taylorNode({.type = NUM_TYPE, .value = {.num = 0}}, NULL, NULL, &err);
+  if (err) {
+    if (sum)
+      nodeDestroy(sum, true);
+    RETURN_WITH_STATUS(err, NULL);
+  }
+
+  nodeFixParents(sum);
+  return sum;
+}
+
+//Postorder with an explicit stack, every node leaves one row on top of
+//state->operands
+static Error taylorEval(const TreeNode* node, TaylorState* state) {
+  assert(node && state);
+
+  size_t rowSize = state->order + 1;
+  NodeStack stack = {};
+  Error err = nodeStackPush(&stack, {.node = const_cast<TreeNode*>(node)});
+  while (!err &&
+         stack.count) {
+    NodeFrame* frame = nodeStackTop(&stack);
+    const TreeNode* current = frame->node;
+    size_t known = 0;
+    if (!frame->stage &&
+        IS_INTERNED(current) &&
+        ptrMapGet(&state->memo, current, &known)) {
+      double* row = taylorRowPush(&state->operands, rowSize, &err);
+      if (row)
+        memcpy(row, state->memoRows.data + known * rowSize, rowSize * sizeof(double));
+      nodeStackPop(&stack);
+      continue;
+    }
+
+    switch (current->data.type) {
+      case NUM_TYPE:
+      case VAR_TYPE: {
+        double* row = taylorRowPush(&state->operands, rowSize, &err);
+        if (!row)
+          break;
+        bool isVar = IS_VAR(current);
+        row[0] = isVar
+                 ? state->values[current->data.value.var]
+                 : current->data.value.num;
+        for (uint k = 1; k <= state->order; k++)
+          row[k] = 0;
+        if (state->order && isVar && current->data.value.var == state->var)
+          row[1] = 1;
+        break;
+      }
+      case OP_TYPE: {
+        const OpTypeInfo* i = parseOpType(current->data.value.op);
+        if (!i) {
+          err = UnknownEnumItem;
+          break;
+        }
+        //unary ops keep their argument on the right
+        bool isUnary = (i->argCount == 1);
+        if (frame->stage < (isUnary ? 1u : 2u)) {
+          const TreeNode* operand = (isUnary || frame->stage)
+                                    ? current->right
+                                    : current->left;
+          frame->stage++;
+          err = operand
+                ? nodeStackPush(&stack, {.node = const_cast<TreeNode*>(operand)})
+                : InvalidParameters;
+          continue;
+        }
+        err = taylorApply(current, state);
+        break;
+      }
+      default:
+        err = BadEnumItem;
+        break;
+    }
+    if (err)
+      break;
+
+    if (IS_INTERNED(current)) {
+      double* row = taylorRowPush(&state->memoRows, rowSize, &err);
+      if (row)
+        memcpy(row, state->operands.data + (state->operands.count - 1) * rowSize,
+               rowSize * sizeof(double));
+      if (!err)
+        err = ptrMapSet(&state->memo, current, state->memoRows.count - 1);
+    }
+    nodeStackPop(&stack);
+  }
+
+  nodeStackDestroy(&stack);
+  return err;
+}
+
+//The operands' rows on top of state->operands make way for node's
+static Error taylorApply(const TreeNode* node, TaylorState* state) {
+  assert(node && state);
+
+  uint n = state->order;
+  size_t rowSize = n + 1;
+  const OpTypeInfo* i = parseOpType(node->data.value.op);
+  if (!i)
+    return UnknownEnumItem;
+  size_t argCount = (i->argCount == 1) ? 1 : 2;
+  assert(state->operands.count >= argCount);
+
+  double* a = state->operands.data + (state->operands.count - argCount) * rowSize;
+  const double* b = (argCount == 1) ? NULL : a + rowSize;
+  seriesApply(node->data.value.op, state->scratch, a, b, n, state->scratch + rowSize);
+  memcpy(a, state->scratch, rowSize * sizeof(double));
+  state->operands.count -= argCount - 1;
+  return OK;
+}
+
+//New row at the end of rows, valid until the next push
+static double* taylorRowPush(TaylorRows* rows, size_t rowSize, Error* err) {
+  assert(rows && err);
+
+  if (rows->count == rows->capacity) {
+    size_t newCapacity = rows->capacity
+                         ? rows->capacity * 2
+                         : TAYLOR_DEFAULT_ROWS;
+    double* data = (double*)realloc(rows->data, newCapacity * rowSize * sizeof(double));
+    if (!data) {
+      *err = FailMemoryReallocation;
+      return NULL;
+    }
+    rows->data     = data;
+    rows->capacity = newCapacity;
+  }
+  return rows->data + rows->count++ * rowSize;
+}
+
+static TreeNode* taylorNode(NodeUnit data, TreeNode* left, TreeNode* right,
+                            Error* err) {
+  assert(err);
+
+  TreeNode* node = NULL;
+  if (!*err)
+    node = nodeAlloc(data, NULL, left, right, err);
+  if (!node) {
+    if (!*err)
+      *err = FailMemoryAllocation;
+    if (left)
+      nodeDestroy(left, true);
+    if (right)
+      nodeDestroy(right, true);
+  }
+  return node;
+}
+
+//coeff * (var - x0)^power, leaving out whatever is 1 or 0
+static TreeNode* taylorTerm(double coeff, uint power, size_t var, double x0,
+                            Error* err) {
+  assert(err);
+
+  if (!power)
+    return taylorNode({.type = NUM_TYPE, .value = {.num = coeff}}, NULL, NULL, err);
+
+  TreeNode* term = taylorNode({.type = VAR_TYPE, .value = {.var = var}}, NULL, NULL, err);
+  if (fpclassify(x0) != FP_ZERO) {
+    TreeNode* shift = taylorNode({.type = NUM_TYPE, .value = {.num = fabs(x0)}},
+                                 NULL, NULL, err);
+    term = taylorNode({.type = OP_TYPE, .value = {.op = x0 > 0 ? OP_SUB : OP_ADD}},
+                      term, shift, err);
+  }
+  if (power > 1) {
+    TreeNode* exponent = taylorNode({.type = NUM_TYPE, .value = {.num = (double)power}},
+                                    NULL, NULL, err);
+    term = taylorNode({.type = OP_TYPE, .value = {.op = OP_POW}}, term, exponent, err);
+  }
+  if (fpclassify(coeff - 1) != FP_ZERO) {
+    TreeNode* factor = taylorNode({.type = NUM_TYPE, .value = {.num = coeff}},
+                                  NULL, NULL, err);
+    term = taylorNode({.type = OP_TYPE, .value = {.op = OP_MUL}}, factor, term, err);
+  }
+  return term;
+}
+
+#undef RETURN_WITH_STATUS
@@ -0,0 +1,21 @@
+#ifndef TAYLOR_H
+#define TAYLOR_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "ds/tree/node.h"
+
+///Taylor expansion of node in var around values[var] = x0, every other
+///variable is held at its values[i]. Truncated power series go through the
+///tree once, so it is O(order^2) per distinct node (a shared subterm of a DAG
+///is expanded once) and no derivative tree is built.
+///Fills coeffs[k] = f^(k)(x0) / k! for k = 0..order
+Error nodeTaylor(const TreeNode* node, const double* values, size_t var,
+                 uint order, double* coeffs);
+
+///Polynomial sum of coeffs[k] * (var - x0)^k for k = 0..order as a tree
+///(e.g. for nodeToTex), zero terms are left out
+TreeNode* taylorToTree(const double* coeffs, uint order, size_t var, double x0,
+                       Error* status = NULL);
+
+#endif
@@ -0,0 +1,414 @@
+//NOTE: no include guard on purpose. batch.cpp includes this file once per
+//instruction set, each time inside its own namespace and target pragma,
+//with VMATH_WIDTH (doubles per vector) and VMATH_SQRT(v) defined.
+//
+//Vectorized double precision approximations (mostly Cephes algorithms).
+//Each one is only valid on its fast range, callers redo other lanes in scalar.
+//Their measured accuracy per tape op is listed in batch.h
+
+typedef double    vd __attribute__((vector_size(VMATH_WIDTH * sizeof(double))));
+typedef long long vl __attribute__((vector_size(VMATH_WIDTH * sizeof(long long))));
+
+static const size_t VMATH_LANES = VMATH_WIDTH;
+
+static const double    ROUND_MAGIC = 6755399441055744.0; // 1.5 * 2^52
+static const long long SIGN_BIT    = (long long)0x8000000000000000ull;
+static const long long ABS_MASK    = 0x7FFFFFFFFFFFFFFFll;
+
+static const double SINCOS_MAX_ARG = 1048576.0; //2^20, past it the reduction loses bits near zeros
+static const double EXP_MAX_ARG    = 708.0;
+
+static inline vd vload(const double* p) {
+  vd v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline void vstore(double* p, vd v) {
+  memcpy(p, &v, sizeof(v));
+}
+
+static inline vd vsplat(double x) {
+  vd v = {};
+  return v + x;
+}
+
+static inline vd vabs(vd x) {
+  return (vd)((vl)x & ABS_MASK);
+}
+
+static inline vl vsignbit(vd x) {
+  return (vl)x & SIGN_BIT;
+}
+
+static inline vd vflipsign(vd x, vl sign) {
+  return (vd)((vl)x ^ sign);
+}
+
+static inline vd vselect(vl mask, vd a, vd b) {
+  return (vd)(((vl)a & mask) | ((vl)b & ~mask));
+}
+
+//round to nearest, only for |x| < 2^51
+static inline vd vround(vd x) {
+  return (x + ROUND_MAGIC) - ROUND_MAGIC;
+}
+
+static inline vd vfloor(vd x) {
+  vd r = vround(x);
+  return vselect(r > x, r - 1.0, r);
+}
+
+//integral x with |x| < 2^51 to integer
+static inline vl vtoint(vd x) {
+  return (vl)(x + ROUND_MAGIC) - (vl)vsplat(ROUND_MAGIC);
+}
+
+//small integer back to double
+static inline vd vfromint(vl k) {
+  return (vd)(k + (vl)vsplat(ROUND_MAGIC)) - ROUND_MAGIC;
+}
+
+//2^n for n in [-1022, 1023]
+static inline vd vpow2i(vl n) {
+  return (vd)((n + 1023) << 52);
+}
+
+static inline vd vpoly(vd x, const double* c, int n) {
+  vd y = vsplat(c[0]);
+  for (int i = 1; i <= n; i++)
+    y = y * x + c[i];
+  return y;
+}
+
+//same as vpoly() with an implicit leading coefficient of 1
+static inline vd vpoly1(vd x, const double* c, int n) {
+  vd y = x + c[0];
+  for (int i = 1; i < n; i++)
+    y = y * x + c[i];
+  return y;
+}
+
+static const double EXP_P[] = {
+  1.26177193074810590878E-4,
+  3.02994407707441961300E-2,
+  9.99999999999999999910E-1,
+};
+static const double EXP_Q[] = {
+  3.00198505138664455042E-6,
+  2.52448340349684104192E-3,
+  2.27265548208155028766E-1,
+  2.00000000000000000009E0,
+};
+
+static inline vd vexp(vd x) {
+  vd n = vround(x * 1.4426950408889634073599);
+  x = x - n * 6.93145751953125E-1;
+  x = x - n * 1.42860682030941723212E-6;
+
+  vd xx = x * x;
+  vd px = x * vpoly(xx, EXP_P, 2);
+  x = px / (vpoly(xx, EXP_Q, 3) - px);
+  x = 1.0 + 2.0 * x;
+  return x * vpow2i(vtoint(n));
+}
+
+static const double LOG_P[] = {
+  1.01875663804580931796E-4,
+  4.97494994976747001425E-1,
+  4.70579119878881725854E0,
+  1.44989225341610930846E1,
+  1.79368678507819816313E1,
+  7.70838733755885391666E0,
+};
+static const double LOG_Q[] = {
+  1.12873587189167450590E1,
+  4.52279145837532221105E1,
+  8.29875266912776603211E1,
+  7.11544750618563894466E1,
+  2.31251620126765340583E1,
+};
+
+static inline vd vlog(vd x) {
+  vl bits = (vl)x;
+  vl e = ((bits >> 52) & 0x7FF) - 1022;
+  vd m = (vd)((bits & 0x000FFFFFFFFFFFFFll) | 0x3FE0000000000000ll); //[0.5, 1)
+
+  vl small = m < 0.70710678118654752440;
+  e = e + small; //mask is -1 where true
+  x = vselect(small, m + m, m) - 1.0;
+
+  vd z = x * x;
+  vd y = x * (z * vpoly(x, LOG_P, 5) / vpoly1(x, LOG_Q, 5));
+  vd fe = vfromint(e);
+  y = y - fe * 2.121944400546905827679e-4;
+  y = y - 0.5 * z;
+  z = x + y;
+  return z + fe * 0.693359375;
+}
+
+static const double SIN_COF[] = {
+  1.58962301576546568060E-10,
+ -2.50507477628578072866E-8,
+  2.75573136213857245213E-6,
+ -1.98412698295895385996E-4,
+  8.33333333332211858878E-3,
+ -1.66666666666666307295E-1,
+};
+static const double COS_COF[] = {
+ -1.13585365213876817300E-11,
+  2.08757008419747316778E-9,
+ -2.75573141792967388112E-7,
+  2.48015872888517045348E-5,
+ -1.38888888888730564116E-3,
+  4.16666666666665929218E-2,
+};
+
+static inline void vsincos(vd x, vd* s, vd* c) {
+  vl sign = vsignbit(x);
+  x = vabs(x);
+
+  vd y = vfloor(x * 1.27323954473516268615); //x / (pi/4)
+  vl j = vtoint(y);
+  vl odd = j & 1;
+  j = j + odd;
+  y = y + vfromint(odd);
+  j = j & 7;
+
+  vl upper = j > 3;
+  j = j - (upper & 4);
+
+  vd z = ((x - y * 7.85398125648498535156E-1)
+              - y * 3.77489470793079817668E-8)
+              - y * 2.69515142907905952645E-15;
+  vd zz = z * z;
+  vd ps = z + z * zz * vpoly(zz, SIN_COF, 5);
+  vd pc = 1.0 - 0.5 * zz + zz * zz * vpoly(zz, COS_COF, 5);
+
+  vl swap = (j == 1) | (j == 2);
+  *s = vflipsign(vselect(swap, pc, ps), sign ^ (upper & SIGN_BIT));
+  *c = vflipsign(vselect(swap, ps, pc), (upper ^ (j > 1)) & SIGN_BIT);
+}
+
+static const double ATAN_P[] = {
+ -8.750608600031904122785E-1,
+ -1.615753718733365076637E1,
+ -7.500855792314704667340E1,
+ -1.228866684490136173410E2,
+ -6.485021904942025371773E1,
+};
+static const double ATAN_Q[] = {
+  2.485846490142306297962E1,
+  1.650270098316988542046E2,
+  4.328810604912902668951E2,
+  4.853903996359136964868E2,
+  1.945506571482613964425E2,
+};
+
+static inline vd vatan(vd x) {
+  const double MOREBITS = 6.123233995736765886130E-17;
+  vl sign = vsignbit(x);
+  x = vabs(x);
+
+  vl big = x > 2.41421356237309504880; //tan(3pi/8)
+  vl mid = ~big & (x > 0.66);
+  vd y = vselect(big, vsplat(M_PI_2),
+                 vselect(mid, vsplat(M_PI_4), vsplat(0)));
+  //denominators are kept away from zero in lanes that don't use them
+  vd xr = vselect(big, -1.0 / vselect(big, x, vsplat(1)),
+                  vselect(mid, (x - 1.0) / (x + 1.0), x));
+
+  vd z = xr * xr;
+  z = z * vpoly(z, ATAN_P, 4) / vpoly1(z, ATAN_Q, 5);
+  z = xr * z + xr;
+  z = z + vselect(big, vsplat(MOREBITS),
+                  vselect(mid, vsplat(0.5 * MOREBITS), vsplat(0)));
+  return vflipsign(y + z, sign);
+}
+
+static const double SINH_P[] = {
+ -7.89474443963537015605E-1,
+ -1.63725857525983828727E2,
+ -1.15614435765005216044E4,
+ -3.51754964808151394800E5,
+};
+static const double SINH_Q[] = {
+ -2.77711081420602794433E2,
+  3.61578279834431989373E4,
+ -2.11052978884890840399E6,
+};
+
+//|x| <= EXP_MAX_ARG
+static inline vd vsinh(vd x) {
+  vl sign = vsignbit(x);
+  vd a = vabs(x);
+  vl small = a <= 1.0;
+
+  vd z = a * a;
+  vd series = a + a * z * (vpoly(z, SINH_P, 3) / vpoly1(z, SINH_Q, 3));
+  vd e = vexp(vselect(small, vsplat(0), a));
+  vd big = 0.5 * e - 0.5 / e;
+  return vflipsign(vselect(small, series, big), sign);
+}
+
+//|x| <= EXP_MAX_ARG
+static inline vd vcosh(vd x) {
+  vd e = vexp(vabs(x));
+  return 0.5 * e + 0.5 / e;
+}
+
+static const double TANH_P[] = {
+ -9.64399179425052238628E-1,
+ -9.92877231001918586564E1,
+ -1.61468768441708447952E3,
+};
+static const double TANH_Q[] = {
+  1.12811678491632931402E2,
+  2.23548839060100448583E3,
+  4.84406305325125486048E3,
+};
+
+static inline vd vtanh(vd x) {
+  vl sign = vsignbit(x);
+  vd a = vabs(x);
+  vl small = a < 0.625;
+  vl huge  = a > 22.0; //tanh is 1 up to the last bit
+  vl nan   = ~(a <= a);
+  vd clamped = vselect(huge | nan, vsplat(0), a);
+
+  vd z = a * a;
+  vd series = a + a * z * (vpoly(z, TANH_P, 2) / vpoly1(z, TANH_Q, 3));
+  vd e2 = vexp(2.0 * vselect(small, vsplat(0), clamped));
+  vd tail = 1.0 - 2.0 / (e2 + 1.0);
+
+  vd r = vselect(small, series, vselect(huge, vsplat(1), tail));
+  r = vselect(nan, x, r); //NaN stays NaN
+  return vflipsign(r, sign);
+}
+
+static inline vd vsqrt(vd x) {
+  return VMATH_SQRT(x);
+}
+
+//out[k] = op(a[k], b[k]) for k < lanes, lanes is a multiple of VMATH_LANES.
+//Unary ops get b == a. powExp is the exponent when the rhs of OP_POW
+//is a constant, NAN otherwise
+static void vmathApply(OpType op, const double* a, const double* b,
+                       double powExp, double* out, size_t lanes);
+
+static void vmathFixLanes(OpType op, const double* a, const double* b,
+                          double* out, vl fast) {
+  for (size_t i = 0; i < VMATH_LANES; i++)
+    if (!fast[i])
+      out[i] = applyOperation(op, a[i], b[i]);
+}
+
+//Lanes that fail fastExpr get harmless arguments and are redone in scalar
+#define VMATH_LOOP(fastExpr, resultExpr)              \
+  for (size_t k = 0; k < lanes; k += VMATH_LANES) {   \
+    vd x = vload(a + k);                              \
+    vd y = vload(b + k);                              \
+    vl fast = (fastExpr);                             \
+    x = vselect(fast, x, vsplat(0.5));                \
+    y = vselect(fast, y, vsplat(0.5));                \
+    vstore(out + k, (resultExpr));                    \
+    vmathFixLanes(op, a + k, b + k, out + k, fast);   \
+  }                                                   \
+  return;
+
+#define VMATH_EXACT_LOOP(resultExpr)                  \
+  for (size_t k = 0; k < lanes; k += VMATH_LANES) {   \
+    vd x = vload(a + k);                              \
+    vd y = vload(b + k);                              \
+    vstore(out + k, (resultExpr));                    \
+  }                                                   \
+  return;
+
+static inline vl vnormal(vd x) {
+  return (x >= DBL_MIN) & (x <= DBL_MAX);
+}
+
+static inline vd vsin(vd x) {
+  vd s, c;
+  vsincos(x, &s, &c);
+  return s;
+}
+
+static inline vd vcos(vd x) {
+  vd s, c;
+  vsincos(x, &s, &c);
+  return c;
+}
+
+static inline vd vtan(vd x, bool inverse) {
+  vd s, c;
+  vsincos(x, &s, &c);
+  return inverse ? c / s : s / c;
+}
+
+static inline vd vpowi(vd x, int e) {
+  vd r = x;
+  switch (e < 0 ? -e : e) {
+    case 1:  break;
+    case 2:  r = x * x;             break;
+    case 3:  r = x * x * x;         break;
+    default: r = (x * x) * (x * x); break;
+  }
+  return e < 0 ? 1.0 / r : r;
+}
+
+static void vmathApply(OpType op, const double* a, const double* b,
+                       double powExp, double* out, size_t lanes) {
+  assert(a && b && out);
+  assert(lanes % VMATH_LANES == 0);
+
+  switch (op) {
+    case OP_ADD: VMATH_EXACT_LOOP(x + y)
+    case OP_SUB: VMATH_EXACT_LOOP(x - y)
+    case OP_MUL: VMATH_EXACT_LOOP(x * y)
+    case OP_DIV: VMATH_EXACT_LOOP(x / y)
+    case OP_SIN: VMATH_LOOP(vabs(x) <= SINCOS_MAX_ARG, vsin(x))
+    case OP_COS: VMATH_LOOP(vabs(x) <= SINCOS_MAX_ARG, vcos(x))
+    case OP_TAN: VMATH_LOOP(vabs(x) <= SINCOS_MAX_ARG,
+                            vtan(x, false))
+    //zero is left to scalar so there is no vector division by zero
+    case OP_COT: VMATH_LOOP((vabs(x) <= SINCOS_MAX_ARG) & (vabs(x) > 0),
+                            vtan(x, true))
+    case OP_LN:  VMATH_LOOP(vnormal(x), vlog(x))
+    case OP_LOG: VMATH_LOOP(vnormal(x) & vnormal(y) & ((x < 1.0) | (x > 1.0)),
+                            vlog(y) / vlog(x))
+    case OP_ASIN: VMATH_LOOP(vabs(x) < 1.0,
+                             vatan(x / vsqrt((1.0 - x) * (1.0 + x))))
+    case OP_ACOS: VMATH_LOOP(vabs(x) < 1.0,
+                             2.0 * vatan(vsqrt((1.0 - x) / (1.0 + x))))
+    case OP_ATAN: VMATH_LOOP(x <= x, vatan(x))
+    case OP_ACOT: VMATH_LOOP(x <= x, M_PI_2 - vatan(x))
+    case OP_SINH: VMATH_LOOP(vabs(x) <= EXP_MAX_ARG, vsinh(x))
+    case OP_COSH: VMATH_LOOP(vabs(x) <= EXP_MAX_ARG, vcosh(x))
+    case OP_TANH: VMATH_LOOP(x <= x, vtanh(x))
+    case OP_COTH: VMATH_LOOP((x < 0) | (x > 0), 1.0 / vtanh(x))
+    case OP_POW: {
+      if (!(fabs(powExp) <= 4)) //NAN too
+        break;
+      if (!(powExp < 0.5 || powExp > 0.5)) {
+        VMATH_LOOP(x > 0, vsqrt(x))
+      }
+      int e = (int)powExp;
+      if (e && !(e < powExp || e > powExp)) {
+        //past these bounds x^e can over/underflow while the products
+        //on the way don't (or the other way around)
+        VMATH_LOOP((vabs(x) >= 1e-70) & (vabs(x) <= 1e70), vpowi(x, e))
+      }
+      break;
+    }
+    default:
+      break;
+  }
+
+  //no vector version, lane by lane
+  for (size_t k = 0; k < lanes; k++)
+    out[k] = applyOperation(op, a[k], b[k]);
+}
+
+#undef VMATH_LOOP
+#undef VMATH_EXACT_LOOP
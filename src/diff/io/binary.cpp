@@ -0,0 +1,439 @@
+#include "diff/io/binary.h"
+#include "ds/stack/stack.h"
+#include "misc/input.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static const size_t BINARY_MAGIC_LENGTH = sizeof(BINARY_TREE_MAGIC) - 1;
+static const size_t BINARY_DOUBLE_SIZE  = 8;
+//a size_t takes at most that many 7 bit groups
+static const size_t BINARY_MAX_VARINT_LENGTH = (sizeof(size_t) * 8 + 6) / 7;
+static const size_t BINARY_UNUSED_NAME = (size_t)-1;
+
+struct BinaryWriter {
+  FILE* sink = NULL;
+  Variables* vars = NULL;
+  size_t* names = NULL; //vars index -> name table index, BINARY_UNUSED_NAME if unused
+  size_t nodeCount = 0;
+  Error err = OK;
+};
+
+struct BinaryReader {
+  Input* input = NULL;
+  size_t p = 0;
+  Variables* vars = NULL;
+  size_t* names = NULL; //name table index -> vars index
+  size_t nameCount = 0;
+};
+
+static Error binaryCollectCallback(TreeNode* node, void* data, uint level);
+static Error binaryWriteCallback(TreeNode* node, void* data, uint level);
+static Error binaryWriteNames(BinaryWriter* writer);
+static void binaryPutVarint(FILE* sink, size_t value);
+static void binaryPutDouble(FILE* sink, double value);
+
+static Error binaryReadHeader(BinaryReader* reader, size_t* nodeCount);
+static TreeNode* binaryReadNodes(BinaryReader* reader, size_t expectedCount,
+                                 Error* status);
+static TreeNode* binaryReadNode(BinaryReader* reader, uint8_t* children,
+                                Error* status);
+static bool binaryGetByte(BinaryReader* reader, uint8_t* byte);
+static bool binaryGetVarint(BinaryReader* reader, size_t* value);
+static bool binaryGetDouble(BinaryReader* reader, double* value);
+
+#define RETURN_WITH_STATUS(value, returnValue) \
+  {                                            \
+  if (status)                                  \
+    *status = value;                           \
+  return returnValue;                          \
+  }
+
+#define DUMP_ERROR_RETURN(commentary, returnValue)                   \
+  {                                                                  \
+  fprintf(stderr,                                                    \
+          "[ERROR]: Failed to read binary node at position %lu\n"    \
+          "Comment: %s\n",                                           \
+          reader->p,                                                 \
+          commentary);                                               \
+  RETURN_WITH_STATUS(FailReadNode, returnValue);                     \
+  }
+
+Error nodeWriteBinary(FILE* f, Variables* vars, TreeNode* node) {
+  if (!f ||
+      !vars)
+    return InvalidParameters;
+  Error err = OK;
+  if ((err = varsVerify(vars)))
+    return err;
+
+  BinaryWriter writer = {
+    .sink  = f,
+    .vars  = vars,
+    .names = (size_t*)calloc(vars->count + 1, sizeof(size_t))
+  };
+  if (!writer.names)
+    return FailMemoryAllocation;
+  for (size_t i = 0; i < vars->count; i++)
+    writer.names[i] = BINARY_UNUSED_NAME;
+
+  //first pass: which variables are used and how many nodes there are
+  nodeTraverse(node, .prefix = binaryCollectCallback, .prefixData = &writer);
+  if (!writer.err) {
+    fwrite(BINARY_TREE_MAGIC, sizeof(char), BINARY_MAGIC_LENGTH, f);
+    fputc(BINARY_TREE_VERSION, f);
+    writer.err = binaryWriteNames(&writer);
+  }
+  if (!writer.err) {
+    binaryPutVarint(f, writer.nodeCount);
+    nodeTraverse(node, .prefix = binaryWriteCallback, .prefixData = &writer);
+  }
+  free(writer.names);
+
+  if (!writer.err &&
+      ferror(f))
+    return EndOfFile;
+  return writer.err;
+}
+
+Error treeWriteBinary(FILE* f, Variables* vars, TreeRoot* root) {
+  if (!root)
+    return InvalidParameters;
+
+  return nodeWriteBinary(f, vars, root->rootNode);
+}
+
+TreeNode* nodeReadBinary(FILE* f, Variables* vars, Error* status, size_t* nodeCount) {
+  if (!f ||
+      !vars)
+    RETURN_WITH_STATUS(InvalidParameters, NULL);
+  Error err = OK;
+  if ((err = varsVerify(vars)))
+    RETURN_WITH_STATUS(err, NULL);
+
+  Input input = {};
+  if ((err = inputOpen(&input, f)))
+    RETURN_WITH_STATUS(err, NULL);
+
+  BinaryReader reader = {
+    .input = &input,
+    .vars  = vars
+  };
+  size_t count = 0;
+  TreeNode* node = NULL;
+  if (!(err = binaryReadHeader(&reader, &count)))
+    node = binaryReadNodes(&reader, count, &err);
+  free(reader.names);
+  inputClose(&input);
+  if (err)
+    RETURN_WITH_STATUS(err, NULL);
+
+  if (nodeCount)
+    *nodeCount += count;
+  return node;
+}
+
+TreeRoot* treeReadBinary(FILE* f, Variables* vars, Error* status) {
+  if (!f ||
+      !vars)
+    RETURN_WITH_STATUS(InvalidParameters, NULL);
+
+  Error err = OK;
+  TreeRoot* root = treeAlloc((NodeUnit){}, NULL, NULL, &err);
+  if (err)
+    RETURN_WITH_STATUS(err, NULL);
+
+  root->nodeCount = 0;
+  TreeNode* node = nodeReadBinary(f, vars, &err, &root->nodeCount);
+  if (err) {
+    treeDestroy(root, true);
+    RETURN_WITH_STATUS(err, NULL);
+  }
+
+  nodeDestroy(root->rootNode, true);
+  root->rootNode = node;
+  return root;
+}
+
+static Error binaryCollectCallback(TreeNode* node, void* data,
+                                   unused uint level) {
+  assert(node && data);
+
+  BinaryWriter* writer = (BinaryWriter*)data;
+  writer->nodeCount++;
+  if (IS_VAR(node)) {
+    if (node->data.value.var >= writer->vars->count)
+      return writer->err = UnknownVariable;
+    writer->names[node->data.value.var] = 0;
+  }
+  return OK;
+}
+
+//Names get table indices in the order they are in vars
+static Error binaryWriteNames(BinaryWriter* writer) {
+  assert(writer);
+
+  size_t nameCount = 0;
+  for (size_t i = 0; i < writer->vars->count; i++)
+    if (writer->names[i] != BINARY_UNUSED_NAME)
+      writer->names[i] = nameCount++;
+
+  binaryPutVarint(writer->sink, nameCount);
+  for (size_t i = 0; i < writer->vars->count; i++) {
+    if (writer->names[i] == BINARY_UNUSED_NAME)
+      continue;
+    const char* str = writer->vars->items[i].str;
+    if (!str)
+      return NullPointerField;
+    size_t length = strlen(str);
+    binaryPutVarint(writer->sink, length);
+    fwrite(str, sizeof(char), length, writer->sink);
+  }
+  return OK;
+}
+
+static Error binaryWriteCallback(TreeNode* node, void* data,
+                                 unused uint level) {
+  assert(node && data);
+
+  BinaryWriter* writer = (BinaryWriter*)data;
+  uint8_t opcode = 0;
+  switch (node->data.type) {
+    case NUM_TYPE: opcode = BINARY_NUM;                                   break;
+    case VAR_TYPE: opcode = BINARY_VAR;                                   break;
+    case OP_TYPE:  opcode = (uint8_t)(BINARY_OP_BASE + node->data.value.op); break;
+    default:       return writer->err = UnknownEnumItem;
+  }
+  if (node->left)
+    opcode |= BINARY_HAS_LEFT;
+  if (node->right)
+    opcode |= BINARY_HAS_RIGHT;
+  fputc(opcode, writer->sink);
+
+  if (IS_NUM(node))
+    binaryPutDouble(writer->sink, node->data.value.num);
+  else if (IS_VAR(node))
+    binaryPutVarint(writer->sink, writer->names[node->data.value.var]);
+  return OK;
+}
+
+static void binaryPutVarint(FILE* sink, size_t value) {
+  assert(sink);
+
+  while (value >= 0x80) {
+    fputc((int)((value & 0x7f) | 0x80), sink);
+    value >>= 7;
+  }
+  fputc((int)value, sink);
+}
+
+static void binaryPutDouble(FILE* sink, double value) {
+  assert(sink);
+
+  uint64_t bits = 0;
+  memcpy(&bits, &value, sizeof(bits));
+  for (size_t i = 0; i < BINARY_DOUBLE_SIZE; i++, bits >>= 8)
+    fputc((int)(bits & 0xff), sink);
+}
+
+//Magic, version and the name table, whose names are registered in vars
+static Error binaryReadHeader(BinaryReader* reader, size_t* nodeCount) {
+  assert(reader && nodeCount);
+  Error* status = NULL;
+
+  size_t length = 0;
+  const char* magic = inputView(reader->input, 0, BINARY_MAGIC_LENGTH, &length);
+  if (length != BINARY_MAGIC_LENGTH ||
+      memcmp(magic, BINARY_TREE_MAGIC, BINARY_MAGIC_LENGTH) != 0)
+    DUMP_ERROR_RETURN("Not a binary tree", FailReadNode);
+  reader->p = BINARY_MAGIC_LENGTH;
+
+  uint8_t version = 0;
+  if (!binaryGetByte(reader, &version) ||
+      version != BINARY_TREE_VERSION)
+    DUMP_ERROR_RETURN("Unsupported format version", FailReadNode);
+
+  size_t nameCount = 0;
+  if (!binaryGetVarint(reader, &nameCount))
+    DUMP_ERROR_RETURN("No name count", FailReadNode);
+  reader->names = (size_t*)calloc(nameCount + 1, sizeof(size_t));
+  if (!reader->names)
+    return FailMemoryAllocation;
+
+  for (; reader->nameCount < nameCount; reader->nameCount++) {
+    inputRelease(reader->input, reader->p);
+    if (!binaryGetVarint(reader, &length))
+      DUMP_ERROR_RETURN("No name length", FailReadNode);
+    size_t available = 0;
+    const char* name = inputView(reader->input, reader->p, length, &available);
+    if (!length ||
+        available != length ||
+        memchr(name, '\0', length))
+      DUMP_ERROR_RETURN("Name is empty, cut short or longer than the input window",
+                        FailReadNode);
+
+    Error err = OK;
+    size_t index = regVarN(reader->vars, name, length, &err);
+    if (err != OK &&
+        err != AttemptedReregistration)
+      return err;
+    reader->names[reader->nameCount] = index;
+    reader->p += length;
+  }
+
+  if (!binaryGetVarint(reader, nodeCount))
+    DUMP_ERROR_RETURN("No node count", FailReadNode);
+  return OK;
+}
+
+//Preorder, every frame is a node still waiting for children
+//(stage holds the BINARY_HAS_LEFT/RIGHT bits of those)
+static TreeNode* binaryReadNodes(BinaryReader* reader, size_t expectedCount,
+                                 Error* status) {
+  assert(reader && status);
+
+  TreeNode* root = NULL;
+  NodeStack stack = {};
+  Error err = OK;
+  for (size_t count = 0; count < expectedCount && !err; count++) {
+    if (root && !stack.count) {
+      fprintf(stderr,
+              "[ERROR]: Failed to read binary node at position %lu\n"
+              "Comment: %s\n",
+              reader->p,
+              "Tree ends before its node count");
+      err = FailReadNode;
+      break;
+    }
+    uint8_t children = 0;
+    TreeNode* node = binaryReadNode(reader, &children, &err);
+    if (err)
+      break;
+
+    NodeFrame* frame = nodeStackTop(&stack);
+    if (!frame) {
+      root = node;
+    } else {
+      node->parent = frame->node;
+      if (frame->stage & BINARY_HAS_LEFT) {
+        frame->node->left = node;
+        frame->stage &= ~(uint)BINARY_HAS_LEFT;
+      } else {
+        frame->node->right = node;
+        frame->stage = 0;
+      }
+      if (!frame->stage)
+        nodeStackPop(&stack);
+    }
+    if (children)
+      err = nodeStackPush(&stack, {.node = node, .stage = children});
+  }
+  if (!err &&
+      stack.count) {
+    fprintf(stderr,
+            "[ERROR]: Failed to read binary node at position %lu\n"
+            "Comment: %s\n",
+            reader->p,
+            "Node count ends before the tree");
+    err = FailReadNode;
+  }
+  nodeStackDestroy(&stack);
+
+  if (err) {
+    nodeDestroy(root, true);
+    RETURN_WITH_STATUS(err, NULL);
+  }
+  return root;
+}
+
+static TreeNode* binaryReadNode(BinaryReader* reader, uint8_t* children,
+                                Error* status) {
+  assert(reader && children);
+
+  inputRelease(reader->input, reader->p);
+  uint8_t opcode = 0;
+  if (!binaryGetByte(reader, &opcode))
+    DUMP_ERROR_RETURN("Input ends before the tree", NULL);
+
+  NodeUnit data = {};
+  uint8_t code = opcode & BINARY_OPCODE_MASK;
+  uint8_t expectedChildren = 0;
+  if (code == BINARY_NUM) {
+    data.type = NUM_TYPE;
+    if (!binaryGetDouble(reader, &data.value.num))
+      DUMP_ERROR_RETURN("No valid value in node", NULL);
+  } else if (code == BINARY_VAR) {
+    size_t name = 0;
+    if (!binaryGetVarint(reader, &name) ||
+        name >= reader->nameCount)
+      DUMP_ERROR_RETURN("No valid name in node", NULL);
+    data.type = VAR_TYPE;
+    data.value.var = reader->names[name];
+  } else {
+    const OpTypeInfo* info = parseOpType((OpType)(code - BINARY_OP_BASE));
+    if (!info)
+      DUMP_ERROR_RETURN("Unknown opcode", NULL);
+    data.type = OP_TYPE;
+    data.value.op = info->type;
+    //the operand of a unary op lives on the right
+    expectedChildren = info->argCount == 1
+                       ? BINARY_HAS_RIGHT
+                       : BINARY_HAS_LEFT | BINARY_HAS_RIGHT;
+  }
+
+  *children = opcode & (BINARY_HAS_LEFT | BINARY_HAS_RIGHT);
+  if (*children != expectedChildren)
+    DUMP_ERROR_RETURN("Node has its children on the wrong sides!", NULL);
+
+  //built top down, which a bound NodeStore can't intern
+  TreeNode* node = nodeAllocBlank(status);
+  if (node)
+    node->data = data;
+  return node;
+}
+
+static bool binaryGetByte(BinaryReader* reader, uint8_t* byte) {
+  assert(reader && byte);
+
+  if (!inputHas(reader->input, reader->p))
+    return false;
+  *byte = (uint8_t)inputChar(reader->input, reader->p++);
+  return true;
+}
+
+static bool binaryGetVarint(BinaryReader* reader, size_t* value) {
+  assert(reader && value);
+
+  *value = 0;
+  for (size_t i = 0; i < BINARY_MAX_VARINT_LENGTH; i++) {
+    uint8_t byte = 0;
+    if (!binaryGetByte(reader, &byte))
+      return false;
+    size_t bits = (size_t)(byte & 0x7f) << (7 * i);
+    if ((bits >> (7 * i)) != (size_t)(byte & 0x7f))
+      return false; //doesn't fit in size_t
+    *value |= bits;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+static bool binaryGetDouble(BinaryReader* reader, double* value) {
+  assert(reader && value);
+
+  size_t available = 0;
+  const char* bytes = inputView(reader->input, reader->p, BINARY_DOUBLE_SIZE, &available);
+  if (available != BINARY_DOUBLE_SIZE)
+    return false;
+
+  uint64_t bits = 0;
+  for (size_t i = BINARY_DOUBLE_SIZE; i-- > 0; )
+    bits = (bits << 8) | (uint8_t)bytes[i];
+  memcpy(value, &bits, sizeof(bits));
+  reader->p += BINARY_DOUBLE_SIZE;
+  return true;
+}
+
+#undef DUMP_ERROR_RETURN
+#undef RETURN_WITH_STATUS
@@ -0,0 +1,45 @@
+#ifndef BINARY_H
+#define BINARY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "diff/context.h"
+#include "ds/tree/tree.h"
+
+//NOTE: the binary tree format, version BINARY_TREE_VERSION
+//  magic     "DIFT"
+//  version   1 byte
+//  nameCount varint, then nameCount names: varint length + bytes (no '\0')
+//  nodeCount varint, then nodeCount nodes in preorder:
+//    opcode  1 byte, low bits are BinaryOpcode, BINARY_HAS_LEFT/RIGHT
+//            tell which children follow
+//    NUM     8 bytes, IEEE double, little endian
+//    VAR     varint index into the names above
+//varint is LEB128: 7 bits per byte, least significant first, high bit = more
+const char    BINARY_TREE_MAGIC[] = "DIFT";
+const uint8_t BINARY_TREE_VERSION = 1;
+
+enum BinaryOpcode {
+  BINARY_NUM     = 0,
+  BINARY_VAR     = 1,
+  BINARY_OP_BASE = 2, //BINARY_OP_BASE + OpType
+};
+
+const uint8_t BINARY_HAS_LEFT    = 1 << 6;
+const uint8_t BINARY_HAS_RIGHT   = 1 << 7;
+const uint8_t BINARY_OPCODE_MASK = BINARY_HAS_LEFT - 1;
+
+///Only the variables node uses get into the name table. DAGs (see
+///contextEnableSharing()) are written out as trees
+Error nodeWriteBinary(FILE* file, Variables* vars, TreeNode* node);
+Error treeWriteBinary(FILE* file, Variables* vars, TreeRoot* root);
+
+///Counterparts of nodeRead()/treeRead() for the binary format. Names of
+///the table are registered in vars (unless they are there already) and
+///nodes get their indices in vars. The nodes are plain ones even if
+///sharing is enabled, see nodeStoreImport()
+TreeNode* nodeReadBinary(FILE* file, Variables* vars, Error* status = NULL,
+                         size_t* nodeCount = NULL);
+TreeRoot* treeReadBinary(FILE* file, Variables* vars, Error* status = NULL);
+
+#endif
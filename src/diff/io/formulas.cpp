@@ -0,0 +1,314 @@
+#include "diff/io/formulas.h"
+#include "diff/io/parse.h"
+#include "diff/io/io.h"
+#include "diff/derivative.h"
+#include "misc/input.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+
+static const size_t FORMULA_BATCH_VARS_CAPACITY = 8;
+//how many chunks workers may get ahead of the writer, per worker,
+//so a slow sink doesn't make every output pile up in memory
+static const size_t FORMULA_BATCH_CHUNKS_AHEAD = 4;
+
+struct FormulaChunk {
+  const char* begin = NULL;
+  const char* end   = NULL;
+  char*  out     = NULL; //TeX of every formula in the chunk
+  size_t outSize = 0;
+  size_t formulas = 0;
+  size_t failed   = 0;
+  Error err = OK;
+  bool isDone = false;
+};
+
+struct FormulaBatch {
+  const char* var = NULL;
+  FormulaChunk* chunks = NULL;
+  size_t chunkCount = 0;
+  size_t next    = 0; //first chunk no worker has taken yet
+  size_t written = 0; //chunks already in the sink
+  size_t ahead   = 0;
+
+  pthread_mutex_t lock = {};
+  pthread_cond_t  done = {}; //a chunk is done
+  pthread_cond_t  room = {}; //the writer moved on
+  bool  stop = false;
+  Error err  = OK; //first error that stopped the batch
+};
+
+static Error formulaBatchSplit(FormulaBatch* batch, const char* data, size_t size,
+                               size_t chunkBytes);
+static Error formulaBatchWrite(FormulaBatch* batch, FILE* sink, FormulaBatchStats* stats);
+static void* formulaBatchWorkerMain(void* arg);
+static Error formulaChunkRun(Context* ctx, FormulaChunk* chunk, const char* var);
+static Error formulaRun(Context* ctx, FILE* out, const char* line, size_t length,
+                        const char* var, bool* isParsed);
+static void formulaBatchStop(FormulaBatch* batch, Error err);
+static bool isBlank(const char* line, size_t length);
+
+Error formulaBatchRun(const char* path, FILE* sink, const char* var,
+                      size_t threadCount, size_t chunkBytes,
+                      FormulaBatchStats* stats) {
+  if (!path ||
+      !sink ||
+      !var  ||
+      !chunkBytes)
+    return InvalidParameters;
+  if (!threadCount) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threadCount = online > 0
+                  ? (size_t)online
+                  : 1;
+  }
+  FormulaBatchStats ignored = {};
+  if (!stats)
+    stats = &ignored;
+  *stats = {};
+
+  FILE* file = fopen(path, "r");
+  if (!file)
+    return FailFileOpen;
+  Input input = {};
+  Error err = inputOpen(&input, file);
+  //the mapping outlives the file
+  fclose(file);
+  if (err)
+    return err;
+  //chunks are taken out of order, which needs the whole file at hand
+  if (input.kind == INPUT_STREAM) {
+    inputClose(&input);
+    return InvalidParameters;
+  }
+  size_t size = input.size;
+  if (!size) {
+    inputClose(&input);
+    return OK;
+  }
+
+  FormulaBatch batch = {
+    .var   = var,
+    .ahead = threadCount * FORMULA_BATCH_CHUNKS_AHEAD
+  };
+  err = formulaBatchSplit(&batch, input.data, size, chunkBytes);
+  if (err) {
+    inputClose(&input);
+    return err;
+  }
+  pthread_mutex_init(&batch.lock, NULL);
+  pthread_cond_init (&batch.done, NULL);
+  pthread_cond_init (&batch.room, NULL);
+
+  pthread_t* threads = (pthread_t*)calloc(threadCount, sizeof(pthread_t));
+  size_t started = 0;
+  if (!threads)
+    err = FailMemoryAllocation;
+  for (; !err && started < threadCount; started++) {
+    if (pthread_create(threads + started, NULL, formulaBatchWorkerMain, &batch))
+      break;
+  }
+  if (!err && !started)
+    err = FailMemoryAllocation;
+
+  //the calling thread is the writer
+  if (!err)
+    err = formulaBatchWrite(&batch, sink, stats);
+  if (err)
+    formulaBatchStop(&batch, err);
+  for (size_t i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  if (!err)
+    err = batch.err;
+
+  for (size_t i = 0; i < batch.chunkCount; i++)
+    free(batch.chunks[i].out);
+  free(batch.chunks);
+  free(threads);
+  pthread_mutex_destroy(&batch.lock);
+  pthread_cond_destroy (&batch.done);
+  pthread_cond_destroy (&batch.room);
+  inputClose(&input);
+  stats->bytes = size;
+  return err;
+}
+
+//Chunks end right after a '\n' (or at the end of data)
+static Error formulaBatchSplit(FormulaBatch* batch, const char* data, size_t size,
+                               size_t chunkBytes) {
+  assert(batch && data && chunkBytes);
+
+  batch->chunks = (FormulaChunk*)calloc(size / chunkBytes + 1, sizeof(FormulaChunk));
+  if (!batch->chunks)
+    return FailMemoryAllocation;
+
+  const char* dataEnd = data + size;
+  for (const char* begin = data; begin < dataEnd; ) {
+    const char* end = (size_t)(dataEnd - begin) > chunkBytes
+                      ? begin + chunkBytes
+                      : dataEnd;
+    if (end < dataEnd) {
+      const char* newline = (const char*)memchr(end - 1, '\n', (size_t)(dataEnd - end + 1));
+      end = newline
+            ? newline + 1
+            : dataEnd;
+    }
+    batch->chunks[batch->chunkCount++] = {
+      .begin = begin,
+      .end   = end
+    };
+    begin = end;
+  }
+  return OK;
+}
+
+//Writes chunks as soon as they and every chunk before them are done
+static Error formulaBatchWrite(FormulaBatch* batch, FILE* sink, FormulaBatchStats* stats) {
+  assert(batch && sink && stats);
+
+  for (size_t i = 0; i < batch->chunkCount; i++) {
+    FormulaChunk* chunk = batch->chunks + i;
+    pthread_mutex_lock(&batch->lock);
+    while (!chunk->isDone &&
+           !batch->stop)
+      pthread_cond_wait(&batch->done, &batch->lock);
+    bool isStopped = batch->stop;
+    pthread_mutex_unlock(&batch->lock);
+    if (isStopped)
+      return OK;
+    if (chunk->err)
+      return chunk->err;
+
+    if (chunk->outSize &&
+        fwrite(chunk->out, 1, chunk->outSize, sink) != chunk->outSize)
+      return EndOfFile;
+    free(chunk->out);
+    chunk->out = NULL;
+    stats->formulas += chunk->formulas;
+    stats->failed   += chunk->failed;
+    stats->chunks++;
+
+    pthread_mutex_lock(&batch->lock);
+    batch->written++;
+    pthread_cond_broadcast(&batch->room);
+    pthread_mutex_unlock(&batch->lock);
+  }
+  return OK;
+}
+
+static void* formulaBatchWorkerMain(void* arg) {
+  FormulaBatch* batch = (FormulaBatch*)arg;
+
+  //binds the context's arena to this thread, nodes never cross threads
+  Context ctx = {};
+  Error err = contextInit(&ctx, FORMULA_BATCH_VARS_CAPACITY);
+  if (err) {
+    formulaBatchStop(batch, err);
+    return NULL;
+  }
+
+  while (true) {
+    pthread_mutex_lock(&batch->lock);
+    while (!batch->stop &&
+           batch->next < batch->chunkCount &&
+           batch->next >= batch->written + batch->ahead)
+      pthread_cond_wait(&batch->room, &batch->lock);
+    if (batch->stop ||
+        batch->next == batch->chunkCount) {
+      pthread_mutex_unlock(&batch->lock);
+      break;
+    }
+    FormulaChunk* chunk = batch->chunks + batch->next++;
+    pthread_mutex_unlock(&batch->lock);
+
+    chunk->err = formulaChunkRun(&ctx, chunk, batch->var);
+
+    pthread_mutex_lock(&batch->lock);
+    chunk->isDone = true;
+    pthread_cond_signal(&batch->done);
+    pthread_mutex_unlock(&batch->lock);
+  }
+
+  contextDestroy(&ctx);
+  return NULL;
+}
+
+static Error formulaChunkRun(Context* ctx, FormulaChunk* chunk, const char* var) {
+  assert(ctx && chunk && var);
+
+  FILE* out = open_memstream(&chunk->out, &chunk->outSize);
+  if (!out)
+    return FailMemoryAllocation;
+
+  Error err = OK;
+  for (const char* line = chunk->begin; line < chunk->end && !err; ) {
+    const char* newline = (const char*)memchr(line, '\n', (size_t)(chunk->end - line));
+    const char* lineEnd = newline
+                          ? newline
+                          : chunk->end;
+    size_t length = (size_t)(lineEnd - line);
+    if (!isBlank(line, length)) {
+      bool isParsed = false;
+      err = formulaRun(ctx, out, line, length, var, &isParsed);
+      chunk->formulas++;
+      if (!isParsed)
+        chunk->failed++;
+    }
+    line = lineEnd + 1;
+  }
+
+  fclose(out);
+  return err;
+}
+
+static Error formulaRun(Context* ctx, FILE* out, const char* line, size_t length,
+                        const char* var, bool* isParsed) {
+  assert(ctx && out && line && var && isParsed);
+
+  //names of earlier formulas would only push the indices of this one up
+  Error err = varsClear(ctx->vars);
+  if (err)
+    return err;
+  TreeNode* tree = parseFormula(line, length, ctx->vars);
+  *isParsed = (tree != NULL);
+  if (!tree) {
+    fputs("% failed to parse\n", out);
+    return OK;
+  }
+
+  //no sink while differentiating, so no derivation steps are printed
+  TreeNode* diff = differentiate(ctx, tree, var);
+  nodeDestroy(tree, true);
+  if (!diff)
+    return FailMemoryAllocation;
+  err = nodeOptimize(&diff);
+  if (!err) {
+    ctx->sink = out;
+    err = nodeToTex(ctx, diff);
+    ctx->sink = NULL;
+  }
+  nodeDestroy(diff, true);
+  return err;
+}
+
+static void formulaBatchStop(FormulaBatch* batch, Error err) {
+  assert(batch);
+
+  pthread_mutex_lock(&batch->lock);
+  if (!batch->err)
+    batch->err = err;
+  batch->stop = true;
+  pthread_cond_broadcast(&batch->done);
+  pthread_cond_broadcast(&batch->room);
+  pthread_mutex_unlock(&batch->lock);
+}
+
+static bool isBlank(const char* line, size_t length) {
+  for (size_t i = 0; i < length; i++)
+    if (!isspace(line[i]))
+      return false;
+  return true;
+}
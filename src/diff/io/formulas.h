@@ -0,0 +1,30 @@
+#ifndef FORMULAS_H
+#define FORMULAS_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "error/error.h"
+
+//Lines of the input a worker takes at once, rounded up to a whole line
+const size_t FORMULA_BATCH_DEFAULT_CHUNK_BYTES = 1 << 20;
+
+struct FormulaBatchStats {
+  size_t formulas = 0; //non-blank lines
+  size_t failed   = 0; //of those, how many didn't parse
+  size_t chunks   = 0;
+  size_t bytes    = 0; //of input
+};
+
+///Batch mode: every line of the file at path is a formula for parseFormula().
+///The file has to be a regular one, it is mmapped (see Input) and split into
+///line-aligned chunks that threadCount workers (0 is one per online cpu)
+///parse, differentiate by var and simplify on their own, each with its own
+///Context. The derivatives go to sink as TeX
+///(nodeToTex()) strictly in input order, a line that doesn't parse gets a
+///"% failed to parse" line instead. Blank lines are skipped
+Error formulaBatchRun(const char* path, FILE* sink, const char* var,
+                      size_t threadCount = 0,
+                      size_t chunkBytes = FORMULA_BATCH_DEFAULT_CHUNK_BYTES,
+                      FormulaBatchStats* stats = NULL);
+
+#endif
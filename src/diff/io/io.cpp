@@ -1,26 +1,63 @@
 #include "ds/tree/tree.h"
+#include "ds/stack/stack.h"
 #include "diff/io/io.h"
 #include "misc/util.h"
+#include "misc/input.h"
+#include "misc/output.h"
 #include "misc/quotes.h"
 #include <cctype>
 #include <time.h>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <charconv>
 
-static Error nodeToTexTraverse(Context* ctx, TreeNode* node,
+static Error nodeToTexTraverse(Context* ctx, TreeNode* node, TreeNode* parent,
                                size_t* writtenCount,
                                bool suppressBrackets = false, 
                                bool suppressNewline = false);
-static bool compareParentPriority(TreeNode* node);
+static Error nodeToTexUnit(Context* ctx, TreeNode* node, size_t* writtenCount);
+static void nodeToTexCut(Context* ctx, TreeNode* node, size_t* writtenCount,
+                         size_t maxBytes, bool suppressBrackets = false);
+static Output* texBegin(Context* ctx);
+static bool compareParentPriority(TreeNode* parent, TreeNode* node);
+static Error nodeNumberTerms(TreeNode* node, const PtrMap* uses,
+                             PtrMap* terms, size_t* termCount);
+static Error countNodesUpToCallback(TreeNode* node, void* data, uint level);
+
+//Text tree reader state
+struct NodeReader {
+  Input* input = NULL;
+  size_t p = 0;
+  Variables* vars = NULL;
+};
 
-static TreeNode* nodeReadRecursion(Variables* vars, 
-                                   char* buf, size_t bufSize, size_t* p,
-                                   Error* status, size_t* nodeCount);
+static TreeNode* nodeReadRecursion(NodeReader* reader, Error* status, size_t* nodeCount);
+static const char* nodeReadToken(NodeReader* reader, size_t* length);
 
 static const char* NULL_STRING_REPRESENTATION   = "nil";
 static size_t NULL_STRING_REPRESENTATION_LENGTH = strlen(NULL_STRING_REPRESENTATION);
 static const size_t MAX_CHAR_PER_LINE = 54;
 
+struct TexOpStr {
+  const char* str = NULL;
+  size_t length = 0;
+};
+
+//NodeFrame::level of nodeToTexTraverse(): how the node is printed
+static const uint TEX_SUPPRESS_BRACKETS = 1 << 0;
+static const uint TEX_SUPPRESS_NEWLINE  = 1 << 1;
+static const uint TEX_NEEDS_BRACKETS    = 1 << 2;
+
+//What nodeToTexTraverse() prints for each op, supported ones are TeX commands
+static constexpr TexOpStr TEX_OP_STRS[] = {
+  #define X(enm, s, aS, aC, pr, isSupp) \
+    {("\\" s) + !(isSupp), sizeof("\\" s) - 1 - !(isSupp)},
+  OP_TYPE_LIST()
+  #undef X
+};
+
 #define RETURN_WITH_STATUS(value, returnValue) \
   {                                            \
   if (status)                                  \
@@ -29,20 +66,78 @@ static const size_t MAX_CHAR_PER_LINE = 54;
   }
 
 Error nodeToTex(Context* ctx, TreeNode* node) {
+  return nodeToTexBounded(ctx, node, 0);
+}
+
+Error nodeToTexBounded(Context* ctx, TreeNode* node, size_t maxBytes) {
   Error err = OK;
   if ((err = contextVerify(ctx)))
     return err;
 
   ctx->stepCount = 1;
 
-  fprintf(ctx->sink,
-          "\\raggedright(%u):\\begin{align*}\n",
-          ctx->stepCount);
+  Output* out = texBegin(ctx);
+  outputPuts(out, "\\raggedright(");
+  outputSize(out, ctx->stepCount);
+  outputPuts(out, "):\\begin{align*}\n");
   size_t writtenCount = 0;
-  nodeToTexTraverse(ctx, node, &writtenCount);
-  fputs("\n\\end{align*}\\\\\n", ctx->sink);
+  nodeToTexCut(ctx, node, &writtenCount, maxBytes);
+  outputPuts(out, "\n\\end{align*}\\\\\n");
 
-  return OK;
+  return outputFlush(out);
+}
+
+Error nodeToTexNamed(Context* ctx, TreeNode* node) {
+  if (!node)
+    return InvalidParameters;
+  Error err = OK;
+  if ((err = contextVerify(ctx)))
+    return err;
+
+  PtrMap uses  = {};
+  PtrMap terms = {};
+  TreeNode** order = NULL;
+  size_t termCount = 0;
+  if (!(err = ptrMapInit(&uses)) &&
+      !(err = ptrMapInit(&terms)) &&
+      !(err = nodeCountUses(node, &uses)))
+    err = nodeNumberTerms(node, &uses, &terms, &termCount);
+  if (!err && termCount) {
+    order = (TreeNode**)calloc(termCount, sizeof(TreeNode*));
+    if (!order)
+      err = FailMemoryAllocation;
+  }
+  ptrMapDestroy(&uses);
+  if (err) {
+    ptrMapDestroy(&terms);
+    return err;
+  }
+  for (size_t i = 0; i < terms.capacity; i++)
+    if (terms.items[i].key && terms.items[i].value)
+      order[terms.items[i].value - 1] = (TreeNode*)(uintptr_t)terms.items[i].key;
+
+  ctx->stepCount = 1;
+  ctx->texTerms = &terms;
+  Output* out = texBegin(ctx);
+  outputPuts(out, "\\raggedright(");
+  outputSize(out, ctx->stepCount);
+  outputPuts(out, "):\\begin{align*}\n&");
+  size_t writtenCount = 0;
+  nodeToTexTraverse(ctx, node, NULL, &writtenCount);
+  //a term only refers to terms with smaller numbers
+  for (size_t i = 0; i < termCount; i++) {
+    outputPuts(out, "\\\\\n\\tau_{");
+    outputSize(out, i + 1);
+    outputPuts(out, "} &= ");
+    writtenCount = 0;
+    nodeToTexTraverse(ctx, order[i], NULL, &writtenCount);
+  }
+  outputPuts(out, "\n\\end{align*}\\\\\n");
+  ctx->texTerms = NULL;
+
+  free(order);
+  ptrMapDestroy(&terms);
+  return outputFlush(out);
 }
 
 TreeNode* differentiationStepToTex(Context* ctx, const char* var, 
@@ -57,19 +152,60 @@ TreeNode* differentiationStepToTex(Context* ctx, const char* var,
   if ((err = contextVerify(ctx)))
     RETURN_WITH_STATUS(err, NULL);
 
-  nodeFixParents(after);
   ctx->stepCount++;
-  fprintf(ctx->sink,
-          "\\raggedright(%u):\\begin{align*}\n\\frac{d}{d%s}(",
-          ctx->stepCount, var);
+  Output* out = texBegin(ctx);
+  size_t stepStart = out->size;
+  outputPuts(out, "\\raggedright(");
+  outputSize(out, ctx->stepCount);
+  outputPuts(out, "):\\begin{align*}\n\\frac{d}{d");
+  outputPuts(out, var);
+  outputPuts(out, "}(");
   size_t writtenCount = 0;
-  nodeToTexTraverse(ctx, before, &writtenCount, true);
-  fputs(") = ", ctx->sink);
+  size_t beforeStart = out->size;
+  nodeToTexCut(ctx, before, &writtenCount, ctx->report.exprBytes, true);
+
+  //a cut one isn't the same as anything
+  const char* beforeTex = out->data + beforeStart;
+  size_t beforeLength = out->size - beforeStart;
+  if (ctx->texSteps &&
+      !(beforeLength == strlen(TEX_REPORT_CUT) &&
+        memcmp(beforeTex, TEX_REPORT_CUT, beforeLength) == 0)) {
+    uint same = texStepsMatch(ctx->texSteps, beforeTex, beforeLength,
+                              ctx->stepCount, &err);
+    if (err) {
+      outputFlush(out);
+      RETURN_WITH_STATUS(err, after);
+    }
+    if (same) {
+      outputRewind(out, stepStart);
+      outputPuts(out, "\\raggedright(");
+      outputSize(out, ctx->stepCount);
+      outputPuts(out, "): same as (");
+      outputSize(out, same);
+      outputPuts(out, ")\\\\\n");
+      if ((err = outputFlush(out)) && status)
+        *status = err;
+      return after;
+    }
+  }
+  outputPuts(out, ") = ");
   // nodeToTexTraverse(after, ctx->sink, &writtenCount);
   // fputs(" = ", ctx->sink);
-  nodeOptimize(&after);
-  nodeToTexTraverse(ctx, after, &writtenCount);
-  fputs("\n\\end{align*}\\\\\n", ctx->sink);
+  //simplifying costs as much as the expression is big, so with a bound on the
+  //report one of more nodes than exprBytes (likely cut anyway) is printed as is
+  size_t nodesLeft = ctx->report.exprBytes;
+  if (!nodesLeft ||
+      !nodeTraverse(after, .prefix = countNodesUpToCallback, .prefixData = &nodesLeft)) {
+    nodeFixParents(after);
+    if (ctx->rewrite)
+      nodeRewrite(&after, ctx->rewriteSets, ctx->rewrite);
+    else
+      nodeOptimize(&after);
+  }
+  nodeToTexCut(ctx, after, &writtenCount, ctx->report.exprBytes);
+  outputPuts(out, "\n\\end{align*}\\\\\n");
+  if ((err = outputFlush(out)) && status)
+    *status = err;
   return after;
 }
 
@@ -137,131 +273,283 @@ Error closeTexFile(Context* ctx) {
 #define ADD_TO_COUNT(x)           \
   {                               \
   if (writtenCount)               \
-      *writtenCount += (size_t)x; \
+      *writtenCount += x;         \
   }
 #else
-#define ADD_TO_COUNT(x)
+#define ADD_TO_COUNT(x) ((void)(x), (void)writtenCount)
 #endif
 
-static Error nodeToTexTraverse(Context* ctx, TreeNode* node, size_t* writtenCount,
-                              bool suppressBrackets, bool suppressNewline) {
-	if (!node ||
+//Context is verified by whoever prints, so that isn't done per node.
+//parent is passed explicitly since shared (interned) nodes have many of them.
+//An explicit stack keeps the depth unlimited: NodeFrame::other is the parent,
+//level the TEX_ flags above and stage the number of operands printed so far
+static Error nodeToTexTraverse(Context* ctx, TreeNode* node, TreeNode* parent,
+                               size_t* writtenCount,
+                               bool suppressBrackets, bool suppressNewline) {
+  if (!node ||
       !ctx)
     return InvalidParameters;
-  Error err = OK;
-  if ((err = contextVerify(ctx)))
-    return err;
-
-  //node needs brackets if it's parent exists, we don't suppress brackets,
-  //and the node is either a negative number, it's parent is a supported function
-  //(the parent being OP is implied by it being a parent)
-  //or it is an operator of a lower priority than it's parent
-  bool needsBrackets = (node->parent &&
-                        !suppressBrackets &&
-                        ((IS_NUM(node) && node->data.value.num < 0) ||
-                          parseOpType(node->parent->data.value.op)->isSupported ||
-                          (IS_OP(node) && compareParentPriority(node))));
-  bool isDivision = OF_OP(node, OP_DIV);
-  bool isLog      = (!isDivision &&
-                     OF_OP(node, OP_LOG));
-  // is this an expression of type (smth)^(1/number)
-  bool isRoot     = (!isDivision &&
-                     !isLog &&
-                     OF_OP(node, OP_POW) &&
-                     OF_OP(node->right, OP_DIV) &&
-                     OF_NUM(node->right->left, 1) &&
-                     IS_NUM(node->right->left));
-
-  if (needsBrackets) {
-    fputc('(', ctx->sink);
-    ADD_TO_COUNT(1);
-  }
-
-  if (isDivision) {
-    fputs("\\frac{", ctx->sink);
-    nodeToTexTraverse(ctx, node->left, writtenCount, true, true);
-    fputs("}{", ctx->sink);
-    nodeToTexTraverse(ctx, node->right, writtenCount, true, true);
-    fputc('}', ctx->sink);
-  } else if (isLog) {
-    fputs("\\log_{", ctx->sink);
-    nodeToTexTraverse(ctx, node->left, writtenCount, true, true);
-    fputs("}", ctx->sink);
-    nodeToTexTraverse(ctx, node->right, writtenCount, false, suppressNewline);
-  } else if (isRoot) {
-    if (doubleEqual(node->right->right->data.value.num, 2)) {
-      fputs("\\sqrt{", ctx->sink);
-    } else {
-      fputs("\\sqrt[", ctx->sink);
-      nodeToTexTraverse(ctx, node->right->right, writtenCount, true, true);
-      fputs("]{", ctx->sink);
-    }
-    nodeToTexTraverse(ctx, node->left, writtenCount, true, true);
-    fputc('}', ctx->sink);
-  } else {
-    bool isPow = OF_OP(node, OP_POW);
-    if (isPow) fputc('{', ctx->sink);
-	  nodeToTexTraverse(ctx, node->left, writtenCount, suppressNewline);
-    if (isPow) fputc('}', ctx->sink);
-    switch (node->data.type) {
-      case NUM_TYPE: {
-        long written = 0;
-        fprintf(ctx->sink, "%lg%ln", node->data.value.num, &written);
+  Output* out = &ctx->tex;
+
+  NodeStack stack = {};
+  Error result = OK;
+  Error err = nodeStackPush(&stack, {
+    .node  = node,
+    .other = parent,
+    .level = (suppressBrackets ? TEX_SUPPRESS_BRACKETS : 0u) |
+             (suppressNewline  ? TEX_SUPPRESS_NEWLINE  : 0u)
+  });
+  //past the limit of nodeToTexCut(), the rest is thrown away anyway
+  while (!err &&
+         stack.count &&
+         !out->isCut) {
+    NodeFrame* frame = nodeStackTop(&stack);
+    TreeNode* current = frame->node;
+    TreeNode* currentParent = frame->other;
+    uint stage = frame->stage++;
+
+    if (!stage) {
+      //named terms are spelled out only at their own definition (no parent)
+      size_t term = 0;
+      if (currentParent &&
+          ctx->texTerms &&
+          ptrMapGet(ctx->texTerms, current, &term) &&
+          term) {
+        outputPuts(out, "\\tau_{");
+        size_t written = strlen("\\tau_{}") + outputSize(out, term);
+        outputPutc(out, '}');
         ADD_TO_COUNT(written);
+        nodeStackPop(&stack);
+        continue;
       }
-      break;
-      case VAR_TYPE: {
-        Variable* v = getVar(ctx->vars, node->data.value.var, &err);
-        if (err) {
-          fprintf(stderr, "%s: %s\n", parseError(err)->str, parseError(err)->desc);
-          fputs("Error: invalid var index", ctx->sink);
-          return err;
-        }
-        fprintf(ctx->sink, "%s", v->str);
+
+      //node needs brackets if it's parent exists, we don't suppress brackets,
+      //and the node is either a negative number, it's parent is a supported function
+      //(the parent being OP is implied by it being a parent)
+      //or it is an operator of a lower priority than it's parent
+      bool needsBrackets = (currentParent &&
+                            !(frame->level & TEX_SUPPRESS_BRACKETS) &&
+                            ((IS_NUM(current) && current->data.value.num < 0) ||
+                              parseOpType(currentParent->data.value.op)->isSupported ||
+                              (IS_OP(current) && compareParentPriority(currentParent, current))));
+      if (needsBrackets) {
+        frame->level |= TEX_NEEDS_BRACKETS;
+        outputPutc(out, '(');
         ADD_TO_COUNT(1);
       }
-      break;
-      case OP_TYPE: {
-        OpType opType = node->data.value.op;
-        long written = 0;
-        const OpTypeInfo* i = parseOpType(opType);
-        if (!i) {
-          fputs("Error: unknown op type", ctx->sink);
-          return UnknownEnumItem; 
-        }
-        fprintf(ctx->sink, "%s%s%ln",
-                    i->isSupported ? "\\" : "", i->str, &written);
-        ADD_TO_COUNT(written);
+    }
+
+    uint flags = frame->level;
+    bool isNewlineSuppressed = flags & TEX_SUPPRESS_NEWLINE;
+    bool isDivision = OF_OP(current, OP_DIV);
+    bool isLog      = (!isDivision &&
+                       OF_OP(current, OP_LOG));
+    // is this an expression of type (smth)^(1/number)
+    bool isRoot     = (!isDivision &&
+                       !isLog &&
+                       OF_OP(current, OP_POW) &&
+                       OF_OP(current->right, OP_DIV) &&
+                       OF_NUM(current->right->left, 1) &&
+                       IS_NUM(current->right->left));
+
+    //the operand to print next, none once the node is done
+    NodeFrame operand = {.other = current};
+    bool isDone = false;
+    if (isDivision) {
+      switch (stage) {
+        case 0:  outputPuts(out, "\\frac{"); operand.node = current->left;  break;
+        case 1:  outputPuts(out, "}{");      operand.node = current->right; break;
+        default: outputPutc(out, '}');       isDone = true;                 break;
+      }
+      operand.level = TEX_SUPPRESS_BRACKETS | TEX_SUPPRESS_NEWLINE;
+    } else if (isLog) {
+      switch (stage) {
+        case 0:
+          outputPuts(out, "\\log_{");
+          operand.node  = current->left;
+          operand.level = TEX_SUPPRESS_BRACKETS | TEX_SUPPRESS_NEWLINE;
+          break;
+        case 1:
+          outputPutc(out, '}');
+          operand.node  = current->right;
+          operand.level = flags & TEX_SUPPRESS_NEWLINE;
+          break;
+        default:
+          isDone = true;
+          break;
+      }
+    } else if (isRoot) {
+      operand.level = TEX_SUPPRESS_BRACKETS | TEX_SUPPRESS_NEWLINE;
+      switch (stage) {
+        case 0:
+          if (doubleEqual(current->right->right->data.value.num, 2)) {
+            outputPuts(out, "\\sqrt{");
+            operand.node = current->left;
+            frame->stage = 2;
+          } else {
+            outputPuts(out, "\\sqrt[");
+            operand.node  = current->right->right;
+            operand.other = current->right;
+          }
+          break;
+        case 1:
+          outputPuts(out, "]{");
+          operand.node = current->left;
+          break;
+        default:
+          outputPutc(out, '}');
+          isDone = true;
+          break;
+      }
+    } else {
+      bool isPow = OF_OP(current, OP_POW);
+      switch (stage) {
+        case 0:
+          if (isPow) outputPutc(out, '{');
+          operand.node  = current->left;
+          operand.level = isNewlineSuppressed ? TEX_SUPPRESS_BRACKETS : 0u;
+          break;
+        case 1:
+          if (isPow) outputPutc(out, '}');
+          if ((err = nodeToTexUnit(ctx, current, writtenCount))) {
+            //like a failed call, the parent goes on
+            if (stack.count == 1)
+              result = err;
+            err = OK;
+            nodeStackPop(&stack);
+            continue;
+          }
+          if (isPow) outputPutc(out, '{');
+          operand.node  = current->right;
+          operand.level = (isPow ? TEX_SUPPRESS_BRACKETS : 0u) |
+                          (isPow || isNewlineSuppressed ? TEX_SUPPRESS_NEWLINE : 0u);
+          break;
+        default:
+          if (isPow) outputPutc(out, '}');
+          isDone = true;
+          break;
       }
-      break;
-      default:
-        fputs("Error: unknown node type", ctx->sink);
-        return BadEnumItem;
     }
-    if (isPow) fputc('{', ctx->sink);
-    nodeToTexTraverse(ctx, node->right, writtenCount, isPow, isPow || suppressNewline);
-    if (isPow) fputc('}', ctx->sink);
-  }
 
-  if (needsBrackets) {
-    fputc(')', ctx->sink);
-    ADD_TO_COUNT(1);
-  }
+    if (!isDone) {
+      if (operand.node)
+        err = nodeStackPush(&stack, operand);
+      continue;
+    }
+
+    if (flags & TEX_NEEDS_BRACKETS) {
+      outputPutc(out, ')');
+      ADD_TO_COUNT(1);
+    }
 
-  #ifndef DISABLE_NEWLINES
-  if (!suppressNewline &&
-      writtenCount &&
-      *writtenCount > MAX_CHAR_PER_LINE) {
-    fputs("\\\\\n", ctx->sink);
-    *writtenCount = 0;
+    #ifndef DISABLE_NEWLINES
+    if (!isNewlineSuppressed &&
+        writtenCount &&
+        *writtenCount > MAX_CHAR_PER_LINE) {
+      outputPuts(out, "\\\\\n");
+      *writtenCount = 0;
+    }
+    #endif
+    nodeStackPop(&stack);
   }
-  #endif
 
+  nodeStackDestroy(&stack);
+  return err
+         ? err
+         : result;
+}
+
+//The node itself: a number, a var or an op's name
+static Error nodeToTexUnit(Context* ctx, TreeNode* node, size_t* writtenCount) {
+  assert(ctx && node);
+
+  Output* out = &ctx->tex;
+  switch (node->data.type) {
+    case NUM_TYPE: {
+      size_t written = outputDouble(out, node->data.value.num);
+      ADD_TO_COUNT(written);
+    }
+    break;
+    case VAR_TYPE: {
+      size_t index = node->data.value.var;
+      if (index >= ctx->vars->capacity) {
+        const ErrorInfo* info = parseError(InvalidParameters);
+        fprintf(stderr, "%s: %s\n", info->str, info->desc);
+        outputPuts(out, "Error: invalid var index");
+        return InvalidParameters;
+      }
+      const Variable* v = ctx->vars->items + index;
+      outputPut(out, v->str, v->length);
+      ADD_TO_COUNT(1);
+    }
+    break;
+    case OP_TYPE: {
+      OpType opType = node->data.value.op;
+      if ((size_t)opType >= sizer(TEX_OP_STRS)) {
+        outputPuts(out, "Error: unknown op type");
+        return UnknownEnumItem; 
+      }
+      const TexOpStr* op = TEX_OP_STRS + opType;
+      outputPut(out, op->str, op->length);
+      ADD_TO_COUNT(op->length);
+    }
+    break;
+    default:
+      outputPuts(out, "Error: unknown node type");
+      return BadEnumItem;
+  }
   return OK;
 }
 
 #undef ADD_TO_COUNT
 
+//Children first, so a term is numbered after every term it uses.
+//terms[n] is 0 for visited nodes that don't get a name
+static Error nodeNumberTerms(TreeNode* node, const PtrMap* uses,
+                             PtrMap* terms, size_t* termCount) {
+  if (!node)
+    return OK;
+
+  NodeStack stack = {};
+  Error err = nodeStackPush(&stack, {.node = node});
+  while (!err &&
+         stack.count) {
+    NodeFrame* frame = nodeStackTop(&stack);
+    TreeNode* current = frame->node;
+    if (!frame->stage++) {
+      if (ptrMapGet(terms, current)) {
+        nodeStackPop(&stack);
+        continue;
+      }
+      //the left one is on top, so it's numbered first
+      if (current->right)
+        err = nodeStackPush(&stack, {.node = current->right});
+      if (!err && current->left)
+        err = nodeStackPush(&stack, {.node = current->left});
+      continue;
+    }
+    nodeStackPop(&stack);
+
+    size_t useCount = 0;
+    ptrMapGet(uses, current, &useCount);
+    bool isNamed = IS_OP(current) && useCount > 1;
+    err = ptrMapSet(terms, current, isNamed ? ++*termCount : 0);
+  }
+
+  nodeStackDestroy(&stack);
+  return err;
+}
+
+//Stops the walk once *data (nodes left to count) runs out
+static Error countNodesUpToCallback(unused TreeNode* node, void* data,
+                                    unused uint level) {
+  size_t* nodesLeft = (size_t*)data;
+  if (!*nodesLeft)
+    return 1;
+  (*nodesLeft)--;
+  return OK;
+}
+
 TreeNode* nodeRead(FILE* f, Variables* vars, Error* status, size_t* nodeCount) {
   if (!f ||
       !vars)
@@ -270,14 +558,16 @@ TreeNode* nodeRead(FILE* f, Variables* vars, Error* status, size_t* nodeCount) {
   if ((err = varsVerify(vars)))
     RETURN_WITH_STATUS(err, NULL);
 
-  char* buffer = NULL;
-  size_t bufferSize = 0;
-  if ((err = readBufferFromFile(f, &buffer, &bufferSize)))
+  Input input = {};
+  if ((err = inputOpen(&input, f)))
     RETURN_WITH_STATUS(err, NULL);
 
-  size_t p = 0;
-  TreeNode* node = nodeReadRecursion(vars, buffer, bufferSize, &p, &err, nodeCount);
-  free(buffer);
+  NodeReader reader = {
+    .input = &input,
+    .vars  = vars
+  };
+  TreeNode* node = nodeReadRecursion(&reader, &err, nodeCount);
+  inputClose(&input);
   if (err)
     RETURN_WITH_STATUS(err, NULL);
   return node;
@@ -307,83 +597,71 @@ TreeRoot* treeRead(FILE* f, Variables* vars, Error* status) {
   return root;
 }
 
-#define DUMP_ERROR_RETURN(commentary)                      \
-  {                                                        \
-  fprintf(stderr,                                          \
-          "[ERROR]: Failed to read node at pition %lu\n" \
-          "Comment: %s\n"                                  \
-          "\tLine snippet:\n"                              \
-          "\t->%.10s...\n",                                \
-          *p,                                            \
-          commentary,                                      \
-          buf + *p);                                     \
-  RETURN_WITH_STATUS(FailReadNode, NULL);                  \
+#define DUMP_ERROR_RETURN(commentary)                                      \
+  {                                                                        \
+  size_t snippetLength = 0;                                                \
+  const char* snippet = inputView(input, *p, 10, &snippetLength);          \
+  fprintf(stderr,                                                          \
+          "[ERROR]: Failed to read node at pition %lu\n"                   \
+          "Comment: %s\n"                                                  \
+          "\tLine snippet:\n"                                              \
+          "\t->%.*s...\n",                                                 \
+          *p,                                                              \
+          commentary,                                                      \
+          (int)snippetLength,                                              \
+          snippet ? snippet : "");                                         \
+  RETURN_WITH_STATUS(FailReadNode, NULL);                                  \
   }
 
-#define SKIP_WHITESPACE      \
-  while (isspace(buf[*p])) { \
-      (*p)++;                \
+#define SKIP_WHITESPACE                     \
+  while (isspace(inputChar(input, *p))) { \
+      (*p)++;                               \
   }
 
-static TreeNode* nodeReadRecursion(Variables* vars,
-                                   char* buf, size_t bufSize, size_t* p,
-                                   Error* status, size_t* nodeCount) {
-  if (!buf || 
-      *p >= bufSize || 
-      !vars)
+static TreeNode* nodeReadRecursion(NodeReader* reader, Error* status, size_t* nodeCount) {
+  if (!reader ||
+      !reader->input ||
+      !inputHas(reader->input, reader->p) ||
+      !reader->vars)
     RETURN_WITH_STATUS(InvalidParameters, NULL);
-  Error err = OK;
-  if ((err = varsVerify(vars)))
-    RETURN_WITH_STATUS(err, NULL);
+  Input*  input = reader->input;
+  size_t* p     = &reader->p;
 
-  // fprintf(stderr,
-  //             "[INFO]: at pition %lu\n"
-  //             "\tLine snippet:\n"
-  //             "\t->%.10s...\n",
-  //             *p,
-  //             buf + *p);
+  inputRelease(input, *p);
   SKIP_WHITESPACE;
-  if (buf[*p] == '(') {
+  if (inputChar(input, *p) == '(') {
     (*p)++;
     SKIP_WHITESPACE;
     NodeUnit data = {};
-    int charReadN = 0;
-    if (isdigit(buf[*p]) ||
-        (buf[*p] == '-' && isdigit(buf[*p + 1]))) {
-      if (sscanf(buf + *p,
-                 "%lg%n",
-                 &data.value.num, &charReadN) != 1)
+    size_t tokenLength = 0;
+    const char* token = nodeReadToken(reader, &tokenLength);
+    if (!token)
+      DUMP_ERROR_RETURN("Name of a variable or operator is too long")
+    if (isdigit(token[0]) ||
+        (token[0] == '-' && tokenLength > 1 && isdigit(token[1]))) {
+      std::from_chars_result result = std::from_chars(token, token + tokenLength,
+                                                      data.value.num);
+      if (result.ec != std::errc())
         DUMP_ERROR_RETURN("No valid value in node");
       data.type = NUM_TYPE;
-      *p += (size_t)charReadN;
+      *p += (size_t)(result.ptr - token);
     } else {
-      char valStr[MAX_VALUE_STRING_LENGTH] = {0};
-      //char* valBuf = (char*)calloc(BASE_VALUE_BUF_LEN, sizeof(char));
-      //if (!valBuf)
-      //  DUMP_ERROR_RETURN("Memory allocation failed");
-      //while (...)
-      //
-      //OVERFLOW, bad sscanf - use smth else 
-      if (sscanf(buf + *p, "%s%n", 
-                 valStr, &charReadN) != 1)
+      if (!tokenLength)
         DUMP_ERROR_RETURN("No valid var/op value in node");
-      if (valStr[MAX_VALUE_STRING_LENGTH - 1] != '\0')
-        DUMP_ERROR_RETURN("Name of a variable or operator is too long")
-      int opType = getOpType(valStr);
-      //fprintf(stderr, "returned opType %d\n", opType);
+      int opType = getOpType(token, tokenLength);
       if (opType >= 0) {
         data.value.op = (OpType)opType;
         data.type = OP_TYPE;
-        *p += (size_t)charReadN;
       } else {
-        size_t index = regVar(vars, valStr, &err);
+        Error err = OK;
+        size_t index = regVarN(reader->vars, token, tokenLength, &err);
         if (err != OK &&
             err != AttemptedReregistration)
           RETURN_WITH_STATUS(err, NULL);
         data.value.var = index;
         data.type = VAR_TYPE;
-        *p += (size_t)charReadN;
       }
+      *p += tokenLength;
     }
     if (data.type == UNKNOWN_TYPE)
       DUMP_ERROR_RETURN("No value in node");
@@ -392,12 +670,12 @@ static TreeNode* nodeReadRecursion(Variables* vars,
                           ? parseOpType(data.value.op)->argCount
                           : 0;
 
-    TreeNode* left  = nodeReadRecursion(vars, buf, bufSize, p, status, nodeCount);
+    TreeNode* left  = nodeReadRecursion(reader, status, nodeCount);
     if (*status) {
       nodeDestroy(left, true);
       return NULL;
     }
-    TreeNode* right = nodeReadRecursion(vars, buf, bufSize, p, status, nodeCount);
+    TreeNode* right = nodeReadRecursion(reader, status, nodeCount);
     if (*status) {
       //Я знаю что тут всегда ноды и так нулевой указатель
       //однако на будущие случаи лучше иметь деструктор чем не иметь
@@ -413,9 +691,8 @@ static TreeNode* nodeReadRecursion(Variables* vars,
       DUMP_ERROR_RETURN("Node has too few or too many null children!");
     }
 
-    //fprintf(stderr, "Pos is %lu BufSize is %lu\n", *p, bufSize);
     SKIP_WHITESPACE;
-    if (buf[*p] == ')') {
+    if (inputChar(input, *p) == ')') {
       (*p)++;
     } else {
       nodeDestroy(left, true);
@@ -439,9 +716,14 @@ static TreeNode* nodeReadRecursion(Variables* vars,
     if (nodeCount)
       (*nodeCount)++;
     return node;
-  } else if (strncmp(buf + *p,
-                     NULL_STRING_REPRESENTATION,
-                     NULL_STRING_REPRESENTATION_LENGTH) == 0) {
+  }
+
+  size_t nilLength = 0;
+  const char* nil = inputView(input, *p, NULL_STRING_REPRESENTATION_LENGTH, &nilLength);
+  if (nilLength == NULL_STRING_REPRESENTATION_LENGTH &&
+      strncmp(nil,
+              NULL_STRING_REPRESENTATION,
+              NULL_STRING_REPRESENTATION_LENGTH) == 0) {
     *p += NULL_STRING_REPRESENTATION_LENGTH;
     return NULL;
   }
@@ -449,6 +731,32 @@ static TreeNode* nodeReadRecursion(Variables* vars,
   DUMP_ERROR_RETURN("Illegal character at the start of a node declaration");
 }
 
+//The whitespace-delimited token at reader->p, straight from the input.
+//NULL if it is longer than a stream's window
+static const char* nodeReadToken(NodeReader* reader, size_t* length) {
+  assert(reader && length);
+
+  Input* input = reader->input;
+  size_t end = reader->p;
+  for (char c = inputChar(input, end);
+       c && !isspace(c);
+       c = inputChar(input, ++end))
+    ;
+  *length = end - reader->p;
+  //a stream stops short of the end only if the window is full
+  if (!input->isEof &&
+      !inputHas(input, end))
+    return NULL;
+
+  size_t available = 0;
+  const char* token = inputView(input, reader->p, *length, &available);
+  if (available < *length)
+    return NULL;
+  return token
+         ? token
+         : "";
+}
+
 #undef DUMP_ERROR_RETURN
 #undef SKIP_WHITESPACE
 #undef RETURN_WITH_STATUS
@@ -510,13 +818,48 @@ Error nodePrint(FILE* f, Variables* vars, TreeNode* node) {
   return OK;
 }
 
+//The whole expression or TEX_REPORT_CUT instead of it
+static void nodeToTexCut(Context* ctx, TreeNode* node, size_t* writtenCount,
+                         size_t maxBytes, bool suppressBrackets) {
+  assert(ctx);
+
+  if (!maxBytes) {
+    nodeToTexTraverse(ctx, node, NULL, writtenCount, suppressBrackets);
+    return;
+  }
+
+  Output* out = &ctx->tex;
+  outputLimit(out, maxBytes);
+  size_t start = out->size;
+  size_t startCount = writtenCount
+                      ? *writtenCount
+                      : 0;
+  nodeToTexTraverse(ctx, node, NULL, writtenCount, suppressBrackets);
+  bool isCut = out->isCut;
+  outputUnlimit(out);
+  if (!isCut)
+    return;
+
+  outputRewind(out, start);
+  outputPuts(out, TEX_REPORT_CUT);
+  if (writtenCount)
+    *writtenCount = startCount + strlen(TEX_REPORT_CUT);
+}
+
+static Output* texBegin(Context* ctx) {
+  assert(ctx);
+
+  ctx->tex.sink = ctx->sink;
+  return &ctx->tex;
+}
+
 ///Returns true if parent has higher priority than the node
-static bool compareParentPriority(TreeNode* node) {
+static bool compareParentPriority(TreeNode* parent, TreeNode* node) {
   assert(node);
   assert(IS_OP(node) &&
-         IS_OP(node->parent));
+         IS_OP(parent));
 
-  const OpTypeInfo* par  = parseOpType(node->parent->data.value.op);
+  const OpTypeInfo* par  = parseOpType(parent->data.value.op);
   const OpTypeInfo* self = parseOpType(node->data.value.op);
   assert(par && self);
   return par->priority > self->priority;
@@ -6,7 +6,16 @@
 #include "ds/tree/tree.h"
 
 Error nodeToTex(Context* context, TreeNode* node);
+///Same, but an expression whose TeX is longer than maxBytes (0 is no limit)
+///comes out as TEX_REPORT_CUT
+Error nodeToTexBounded(Context* context, TreeNode* node, size_t maxBytes);
 Error treeToTex(Context* context, TreeRoot* root);
+///For DAGs (see nodeCse()): every operator subterm used more than once is
+///printed once as a named term \tau_k and referred to by that name
+Error nodeToTexNamed(Context* context, TreeNode* node);
+///Prints a step and returns after simplified. Both sides are cut to
+///ctx->report.exprBytes, and with ctx->texSteps a step that reads like an
+///earlier one is printed as "same as" that one and after stays as it is
 TreeNode* differentiationStepToTex(Context* context, const char* var, 
                                    TreeNode* before, TreeNode* after,
                                    Error* status = NULL);
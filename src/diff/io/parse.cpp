@@ -1,157 +1,477 @@
 #include "diff/io/parse.h"
+#include "ds/stack/stack.h"
+#include "misc/input.h"
 #include "misc/util.h"
+#include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
+#include <assert.h>
+#include <charconv>
 
-static TreeNode* getE(const char* buf, size_t* p, Variables* vars);
-static TreeNode* getT(const char* buf, size_t* p, Variables* vars);
-static TreeNode* getP(const char* buf, size_t* p, Variables* vars);
-static TreeNode* getN(const char* buf, size_t* p, Variables* vars);
-static TreeNode* getV(const char* buf, size_t* p, Variables* vars);
+static const size_t PARSE_OPS_DEFAULT_CAPACITY = 32;
 
-static bool isvar(const char c);
+enum ParseOpKind {
+  PARSE_BINARY,
+  PARSE_NEG,   //unary minus
+  PARSE_GROUP, //(
+  PARSE_CALL,  //function(
+};
 
-#define SYNTAX_ERROR(commentary, expectedCharStr, p)                \
-  {                                                                 \
-  fprintf(stderr,                                                   \
-          "[ERROR]: Failed to read given mathematical expression\n" \
-          "\tAt position %lu\n"                                     \
-          "\t%s\n"                                                  \
-          "\tExpected char: %s\n"                                   \
-          "\tString snippet:\n"                                     \
-          "\t%.10s...\n"                                            \
-          "\t^\n",                                                  \
-          p,                                                        \
-          commentary,                                               \
-          expectedCharStr,                                          \
-          buf + p);                                                 \
-  return NULL;                                                      \
-  }
+//An operator still waiting for its right operand (or a bracket for its ')')
+struct ParseOp {
+  ParseOpKind kind = PARSE_BINARY;
+  OpType op = OP_ADD;
+  uint args = 0;  //PARSE_CALL: arguments finished so far
+};
+
+struct ParseOps {
+  ParseOp* items = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+};
+
+//Everything a parse is in the middle of
+struct Parser {
+  Input* input = NULL;
+  size_t p = 0;
+  Variables* vars = NULL;
+  NodeStack operands = {};
+  ParseOps ops = {};
+};
+
+static bool parseOperand(Parser* parser);
+static bool parseOperator(Parser* parser, bool* isEnd);
+static bool parseNumber(Parser* parser);
+static bool parseName(Parser* parser, bool* isCall);
+static bool parseClose(Parser* parser, bool isComma);
+static bool parseReduceAbove(Parser* parser, uint priority, bool isRightAssoc);
+static bool parseReduce(Parser* parser);
+static bool parsePushOperand(Parser* parser, TreeNode* node);
+static TreeNode* parsePopOperand(Parser* parser);
+static bool parsePushOp(Parser* parser, ParseOp op);
+static uint parseOpPriority(const ParseOp* op);
+static int parseBinaryOp(char c);
+static char parseChar(Parser* parser, size_t p);
+static size_t parseNumberLength(Parser* parser);
+static void parserDestroy(Parser* parser);
+static void syntaxError(Parser* parser, size_t p,
+                        const char* commentary, const char* expectedCharStr);
 
-#define SKIP_WHITESPACE(a)    \
-  while (isspace(buf[(a)])) { \
-      (a)++;                  \
+static bool isvar(const char c);
+
+#define SKIP_WHITESPACE(a)                 \
+  while (isspace(parseChar(parser, (a)))) { \
+      (a)++;                               \
   }
 
+//Operator precedence parsing with explicit stacks (the iterative form of
+//a Pratt parser), so nesting depth is only limited by memory.
+//Priorities come from OP_TYPE_LIST, ^ is right associative,
+//a unary minus binds like * (so -x^2 is -(x^2)).
+//Functions are name(arg), log is log(base, arg)
 TreeNode* parseFormula(const char* buf, Variables* vars) {
-  if (!buf ||
+  if (!buf)
+    return NULL;
+  return parseFormula(buf, strlen(buf), vars);
+}
+
+TreeNode* parseFormula(const char* buf, size_t length, Variables* vars) {
+  Input input = {};
+  if (inputOpenMemory(&input, buf, length))
+    return NULL;
+  return parseFormula(&input, vars);
+}
+
+TreeNode* parseFormula(Input* input, Variables* vars) {
+  if (!input ||
       !vars)
     return NULL;
 
-  size_t p = 0;
-  TreeNode* val = getE(buf, &p, vars);
-  SKIP_WHITESPACE(p);
-  if (buf[p] != '\0')
-    SYNTAX_ERROR("Illegal character at the end of given expression", "NULL character ('\\0')", p);
-  p++;
+  Parser parser = {
+    .input = input,
+    .vars  = vars
+  };
+  bool isOk = true;
+  bool isEnd = false;
+  while (isOk && !isEnd) {
+    isOk = parseOperand(&parser) &&
+           parseOperator(&parser, &isEnd);
+  }
+  if (isOk &&
+      inputHas(input, parser.p)) {
+    syntaxError(&parser, parser.p,
+                "Illegal character at the end of given expression",
+                "NULL character ('\\0')");
+    isOk = false;
+  }
+
+  TreeNode* val = isOk
+                  ? parsePopOperand(&parser)
+                  : NULL;
+  parserDestroy(&parser);
   nodeFixParents(val);
   return val;
 }
 
-static TreeNode* getE(const char* buf, size_t* p, Variables* vars) {
-  SKIP_WHITESPACE(*p);
-  TreeNode* val = getT(buf, p, vars);
-  while (buf[*p] == '+' ||
-         buf[*p] == '-') {
-    char op = buf[*p];
-    (*p)++;
-    TreeNode* val2 = getT(buf, p, vars);
-    if (op == '+')
-      val = ADD_(val, val2);
-    else
-      val = SUB_(val, val2);
-  }
-  SKIP_WHITESPACE(*p);
-  return val;
+//Reads prefix operators and brackets up to and including one operand
+static bool parseOperand(Parser* parser) {
+  assert(parser);
+
+  while (true) {
+    //nothing before the current token is looked at again
+    inputRelease(parser->input, parser->p);
+    SKIP_WHITESPACE(parser->p);
+    char c = parseChar(parser, parser->p);
+    if (c == '(') {
+      if (!parsePushOp(parser, {.kind = PARSE_GROUP}))
+        return false;
+      parser->p++;
+    } else if (c == '-') {
+      if (!parsePushOp(parser, {.kind = PARSE_NEG, .op = OP_MUL}))
+        return false;
+      parser->p++;
+    } else if (c == '+') {
+      parser->p++;
+    } else if (isdigit(c) || c == '.') {
+      return parseNumber(parser);
+    } else if (isvar(c)) {
+      bool isCall = false;
+      if (!parseName(parser, &isCall))
+        return false;
+      if (!isCall)
+        return true;
+    } else {
+      syntaxError(parser, parser->p,
+                  "Illegal char at the start of a primary expression",
+                  "[0-9, ., -, (, a-z]");
+      return false;
+    }
+  }
 }
 
-static TreeNode* getT(const char* buf, size_t* p, Variables* vars) {
-  SKIP_WHITESPACE(*p);
-  TreeNode* val = getP(buf, p, vars);
-  while (buf[*p] == '*' ||
-         buf[*p] == '/') {
-    char op = buf[*p];
-    (*p)++;
-    TreeNode* val2 = getP(buf, p, vars);
-    if (op == '*')
-      val = MUL_(val, val2);
-    else
-      val = DIV_(val, val2);
-  }
-  SKIP_WHITESPACE(*p);
-  return val;
+//Reads closing brackets and commas up to and including one binary operator.
+//isEnd is set once there is nothing more to read, every operator is then reduced
+static bool parseOperator(Parser* parser, bool* isEnd) {
+  assert(parser && isEnd);
+
+  while (true) {
+    inputRelease(parser->input, parser->p);
+    SKIP_WHITESPACE(parser->p);
+    char c = parseChar(parser, parser->p);
+    if (c == ')' ||
+        c == ',') {
+      if (!parseClose(parser, c == ','))
+        return false;
+      parser->p++;
+      if (c == ',')
+        return true;
+      continue;
+    }
+
+    int op = parseBinaryOp(c);
+    if (op < 0) {
+      *isEnd = true;
+      if (!parseReduceAbove(parser, 0, false))
+        return false;
+      if (parser->ops.count) {
+        syntaxError(parser, parser->p,
+                    "Illegal character at the end of a primary expression", ")");
+        return false;
+      }
+      return true;
+    }
+
+    const OpTypeInfo* i = parseOpType((OpType)op);
+    if (!parseReduceAbove(parser, i->priority, op == OP_POW) ||
+        !parsePushOp(parser, {.kind = PARSE_BINARY, .op = (OpType)op}))
+      return false;
+    parser->p++;
+    return true;
+  }
 }
 
-static TreeNode* getP(const char* buf, size_t* p, Variables* vars) {
-  SKIP_WHITESPACE(*p);
-  while (buf[*p] == '(') {
-    (*p)++;
-    SKIP_WHITESPACE(*p);
-    TreeNode* val = getE(buf, p, vars);
-    SKIP_WHITESPACE(*p);
-    if (buf[*p] == ')')
-      (*p)++;
-    else
-      SYNTAX_ERROR("Illegal character at the end of a primary expression", ")", *p);
-    return val;
-  }
-  SKIP_WHITESPACE(*p);
-  TreeNode* res = getV(buf, p, vars); 
-  return res 
-         ? res 
-         : getN(buf, p, vars);
-}
-
-static TreeNode* getN(const char* buf, size_t* p, unused Variables* vars) {
-  SKIP_WHITESPACE(*p);
-  bool neg = false;
+static bool parseNumber(Parser* parser) {
+  assert(parser);
+
+  size_t length = parseNumberLength(parser);
+  size_t available = 0;
+  const char* start = inputView(parser->input, parser->p, length, &available);
+  if (available < length) {
+    syntaxError(parser, parser->p, "Number is too long", "[0-9, .]");
+    return false;
+  }
   double val = 0;
-  size_t oldP = *p;
-  if (buf[*p] == '-') {
-    neg = true;
-    (*p)++;
-  }     
-  while (isdigit(buf[*p])) {
-      val = val * 10 + (buf[*p] - '0');
-      (*p)++;
-  }
-  if (neg) 
-    val *= -1.0f;
-  if (oldP == *p)
-    SYNTAX_ERROR("Illegal char at the start of a number", "[0-9, -]", *p);
-  SKIP_WHITESPACE(*p);
-  return NUM_(val);
-}
-
-static TreeNode* getV(const char* buf, size_t* p, Variables* vars) {
-  SKIP_WHITESPACE(*p);
-  size_t oldP = *p;
-  char varName[MAX_VALUE_STRING_LENGTH] = {0};
-  for (size_t i = 0;
-       ((oldP == *p && 
-        !isdigit(buf[*p])) ||
-        oldP != *p)    &&
-        isvar(buf[*p]) &&
-        i < MAX_VALUE_STRING_LENGTH;
-       i++) {
-    varName[i] = buf[*p];
-    (*p)++;
-  }
-  if (oldP == *p)
-    return NULL;
-  varName[MAX_VALUE_STRING_LENGTH - 1] = '\0'; //ensure it is NULL-terminated
-  //int opType = getOpType(varName);
-  //if (opType >= 0) {
-    //return op type with args...
-  //}
+  std::from_chars_result result = std::from_chars(start, start + length, val);
+  if (result.ec != std::errc()) {
+    syntaxError(parser, parser->p,
+                "Illegal char at the start of a number", "[0-9, .]");
+    return false;
+  }
+  parser->p += (size_t)(result.ptr - start);
+  return parsePushOperand(parser, NUM_(val));
+}
+
+//Pushes a variable, or a call if the name is a function
+static bool parseName(Parser* parser, bool* isCall) {
+  assert(parser && isCall);
+
+  size_t oldP = parser->p;
+  while (isvar(parseChar(parser, parser->p)))
+    parser->p++;
+  size_t length = parser->p - oldP;
+  size_t available = 0;
+  //the name is looked up right in the input, so it has to fit in a stream's window
+  const char* name = inputView(parser->input, oldP, length, &available);
+  if (available < length ||
+      (!parser->input->isEof && !inputHas(parser->input, parser->p))) {
+    syntaxError(parser, oldP, "Name is too long", "[+, -, *, /, ^, ), ','");
+    return false;
+  }
+
+  int op = getOpType(name, length);
+  if (op >= 0 &&
+      parseOpType((OpType)op)->isSupported) {
+    SKIP_WHITESPACE(parser->p);
+    if (parseChar(parser, parser->p) != '(') {
+      syntaxError(parser, parser->p, "Function name without arguments", "(");
+      return false;
+    }
+    if (!parsePushOp(parser, {.kind = PARSE_CALL, .op = (OpType)op}))
+      return false;
+    parser->p++;
+    *isCall = true;
+    return true;
+  }
+
   Error err = OK;
-  size_t index = regVar(vars, varName, &err);
+  size_t index = regVarN(parser->vars, name, length, &err);
   if (err != OK &&
       err != AttemptedReregistration) {
     prettyError(stderr, err);
+    return false;
+  }
+  return parsePushOperand(parser, VAR_(index));
+}
+
+//Reduces down to the innermost bracket and closes it (')') or moves on
+//to the next argument of a call (',')
+static bool parseClose(Parser* parser, bool isComma) {
+  assert(parser);
+
+  ParseOps* ops = &parser->ops;
+  while (ops->count &&
+         ops->items[ops->count - 1].kind != PARSE_GROUP &&
+         ops->items[ops->count - 1].kind != PARSE_CALL) {
+    if (!parseReduce(parser))
+      return false;
+  }
+  if (!ops->count) {
+    syntaxError(parser, parser->p,
+                isComma
+                ? "Argument separator outside of a function call"
+                : "Closing bracket without an opening one",
+                "[+, -, *, /, ^]");
+    return false;
+  }
+
+  ParseOp* top = &ops->items[ops->count - 1];
+  uint argCount = top->kind == PARSE_CALL
+                  ? parseOpType(top->op)->argCount
+                  : 1;
+  top->args++;
+  if (isComma
+      ? top->args >= argCount
+      : top->args != argCount) {
+    syntaxError(parser, parser->p,
+                "Wrong number of function arguments",
+                isComma ? ")" : ",");
+    return false;
+  }
+  if (isComma)
+    return true;
+  return top->kind == PARSE_GROUP
+         ? (ops->count--, true)
+         : parseReduce(parser);
+}
+
+//Reduces every operator on top that binds tighter than priority
+static bool parseReduceAbove(Parser* parser, uint priority, bool isRightAssoc) {
+  assert(parser);
+
+  ParseOps* ops = &parser->ops;
+  while (ops->count) {
+    const ParseOp* top = &ops->items[ops->count - 1];
+    if (top->kind == PARSE_GROUP ||
+        top->kind == PARSE_CALL)
+      return true;
+    uint topPriority = parseOpPriority(top);
+    if (topPriority < priority ||
+        (topPriority == priority && isRightAssoc))
+      return true;
+    if (!parseReduce(parser))
+      return false;
+  }
+  return true;
+}
+
+//Pops the top operator and its operands, pushes the node they make
+static bool parseReduce(Parser* parser) {
+  assert(parser && parser->ops.count);
+
+  ParseOp op = parser->ops.items[--parser->ops.count];
+  TreeNode* right = parsePopOperand(parser);
+  switch (op.kind) {
+    case PARSE_NEG:
+      //-2 is a number, not -1 * 2
+      if (IS_NUM(right)) {
+        double num = right->data.value.num;
+        nodeDestroy(right, true);
+        return parsePushOperand(parser, NUM_(-num));
+      }
+      return parsePushOperand(parser, NEG_(right));
+    case PARSE_CALL:
+      if (parseOpType(op.op)->argCount == 1)
+        return parsePushOperand(parser, nodeAlloc({OP_TYPE, op.op}, NULL, NULL, right));
+    //fallthrough
+    case PARSE_BINARY: {
+      TreeNode* left = parsePopOperand(parser);
+      return parsePushOperand(parser, nodeAlloc({OP_TYPE, op.op}, NULL, left, right));
+    }
+    case PARSE_GROUP:
+    default:
+      if (right)
+        nodeDestroy(right, true);
+      return false;
+  }
+}
+
+//A NULL node (failed allocation) is pushed anyway so the stack
+//stays balanced, the parse fails with it
+static bool parsePushOperand(Parser* parser, TreeNode* node) {
+  assert(parser);
+
+  if (nodeStackPush(&parser->operands, {.node = node})) {
+    if (node)
+      nodeDestroy(node, true);
+    return false;
+  }
+  return node != NULL;
+}
+
+static TreeNode* parsePopOperand(Parser* parser) {
+  assert(parser);
+
+  NodeFrame* top = nodeStackTop(&parser->operands);
+  if (!top)
     return NULL;
+  TreeNode* node = top->node;
+  nodeStackPop(&parser->operands);
+  return node;
+}
+
+static bool parsePushOp(Parser* parser, ParseOp op) {
+  assert(parser);
+
+  ParseOps* ops = &parser->ops;
+  if (ops->count == ops->capacity) {
+    size_t capacity = ops->capacity
+                      ? ops->capacity * 2
+                      : PARSE_OPS_DEFAULT_CAPACITY;
+    ParseOp* items = (ParseOp*)realloc(ops->items, capacity * sizeof(ParseOp));
+    if (!items) {
+      prettyError(stderr, FailMemoryReallocation);
+      return false;
+    }
+    ops->items = items;
+    ops->capacity = capacity;
+  }
+  ops->items[ops->count++] = op;
+  return true;
+}
+
+static uint parseOpPriority(const ParseOp* op) {
+  assert(op);
+
+  const OpTypeInfo* i = parseOpType(op->op);
+  return i ? i->priority : 0;
+}
+
+//Single char binary operators of OP_TYPE_LIST
+static int parseBinaryOp(char c) {
+  if (!c)
+    return -1;
+  for (int op = 0; parseOpType((OpType)op); op++) {
+    const OpTypeInfo* i = parseOpType((OpType)op);
+    if (i->argCount == 2 &&
+        !i->isSupported  &&
+        i->str[0] == c   &&
+        i->str[1] == '\0')
+      return op;
+  }
+  return -1;
+}
+
+static void parserDestroy(Parser* parser) {
+  assert(parser);
+
+  TreeNode* node = NULL;
+  while (parser->operands.count)
+    if ((node = parsePopOperand(parser)))
+      nodeDestroy(node, true);
+  nodeStackDestroy(&parser->operands);
+  free(parser->ops.items);
+  parser->ops = {};
+}
+
+static char parseChar(Parser* parser, size_t p) {
+  assert(parser);
+
+  return inputChar(parser->input, p);
+}
+
+//Chars from p on that can make up a number: digits and dots,
+//then an exponent if there is one. from_chars decides how many it takes
+static size_t parseNumberLength(Parser* parser) {
+  assert(parser);
+
+  size_t end = parser->p;
+  char c = parseChar(parser, end);
+  while (isdigit(c) || c == '.')
+    c = parseChar(parser, ++end);
+  if (c == 'e' ||
+      c == 'E') {
+    size_t exponent = end + 1;
+    c = parseChar(parser, exponent);
+    if (c == '+' || c == '-')
+      c = parseChar(parser, ++exponent);
+    if (isdigit(c)) {
+      end = exponent;
+      while (isdigit(parseChar(parser, end)))
+        end++;
+    }
   }
-  SKIP_WHITESPACE(*p);
-  return VAR_(index);
+  return end - parser->p;
+}
+
+static void syntaxError(Parser* parser, size_t p,
+                        const char* commentary, const char* expectedCharStr) {
+  assert(parser);
+
+  size_t left = 0;
+  const char* snippet = inputView(parser->input, p, 10, &left);
+  fprintf(stderr,
+          "[ERROR]: Failed to read given mathematical expression\n"
+          "\tAt position %lu\n"
+          "\t%s\n"
+          "\tExpected char: %s\n"
+          "\tString snippet:\n"
+          "\t%.*s...\n"
+          "\t^\n",
+          p,
+          commentary,
+          expectedCharStr,
+          (int)left,
+          snippet ? snippet : "");
 }
 
 static bool isvar(const char c) {
@@ -160,5 +480,4 @@ static bool isvar(const char c) {
          c == '_';
 }
 
-#undef SYNTAX_ERROR
 #undef SKIP_WHITESPACE
@@ -2,8 +2,16 @@
 #define PARSE_H
 
 #include "diff/context.h"
+#include "misc/input.h"
 
-//Dumps errors in stderr...
+///Infix formula with + - * / ^, unary minus, brackets, floating point numbers
+///(1.5e-3 too) and functions of OP_TYPE_LIST by name or alias: sin(x), log(base, x).
+///New variable names are registered in vars.
+///Dumps errors in stderr...
 TreeNode* parseFormula(const char* expression, Variables* vars);
+///Same for expression[0..length), it doesn't have to end with a '\0'
+TreeNode* parseFormula(const char* expression, size_t length, Variables* vars);
+///Same for the whole input, a stream is parsed as it is read
+TreeNode* parseFormula(Input* input, Variables* vars);
 
 #endif
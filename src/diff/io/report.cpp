@@ -0,0 +1,178 @@
+#include "diff/io/report.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static const size_t TEX_STEPS_DEFAULT_SIDES = 64;
+static const size_t TEX_STEPS_DEFAULT_TEXT  = 1 << 12;
+
+static ulong texStepsHash(const char* str, size_t length);
+static Error texStepsReserve(TexSteps* steps, size_t length);
+
+#define RETURN_WITH_STATUS(value, returnValue) \
+  {                                            \
+  if (status)                                  \
+    *status = value;                           \
+  return returnValue;                          \
+  }
+
+bool texReportWants(const TexReport* report, uint level, size_t printed) {
+  assert(report);
+
+  switch (report->detail) {
+    case TEX_REPORT_ALL:   return true;
+    case TEX_REPORT_TOP:   return level == 0;
+    case TEX_REPORT_DEPTH: return level <= report->depth;
+    case TEX_REPORT_FIRST: return printed < report->steps;
+    default:               return false;
+  }
+}
+
+//Every node gets at most one step (a constant subtree gets one for all
+//of its nodes), even a shared one reached through many parents
+size_t texReportMaxSteps(const TexReport* report, size_t nodeCount) {
+  assert(report);
+
+  //a var that isn't there at all still makes a step
+  size_t steps = nodeCount
+                 ? nodeCount
+                 : 1;
+  switch (report->detail) {
+    case TEX_REPORT_ALL:
+      return steps;
+    case TEX_REPORT_TOP:
+      return 1;
+    case TEX_REPORT_DEPTH: {
+      //a binary tree has 2^(depth + 1) - 1 nodes down to depth
+      size_t levels = report->depth + (size_t)1;
+      if (levels < sizeof(size_t) * 8 &&
+          ((size_t)1 << levels) - 1 < steps)
+        steps = ((size_t)1 << levels) - 1;
+      return steps;
+    }
+    case TEX_REPORT_FIRST:
+      return report->steps < steps
+             ? report->steps
+             : steps;
+    default:
+      return 0;
+  }
+}
+
+//The preamble and every step are fixed text around at most two
+//expressions, each of which is either at most exprBytes or cut
+size_t texReportBound(const TexReport* report, size_t nodeCount, size_t varLength) {
+  assert(report);
+
+  if (!report->exprBytes)
+    return SIZE_MAX;
+
+  size_t expr = report->exprBytes > sizeof(TEX_REPORT_CUT) - 1
+                ? report->exprBytes
+                : sizeof(TEX_REPORT_CUT) - 1;
+  size_t intro = TEX_REPORT_STEP_OVERHEAD + expr;
+  size_t step  = TEX_REPORT_STEP_OVERHEAD + varLength + 2 * expr;
+  size_t steps = texReportMaxSteps(report, nodeCount);
+  if (steps > (SIZE_MAX - intro) / step)
+    return SIZE_MAX;
+  return intro + steps * step;
+}
+
+Error texStepsInit(TexSteps* steps) {
+  if (!steps)
+    return InvalidParameters;
+
+  *steps = {};
+  return ptrMapInit(&steps->bySide);
+}
+
+Error texStepsDestroy(TexSteps* steps) {
+  if (!steps)
+    return InvalidParameters;
+
+  ptrMapDestroy(&steps->bySide);
+  free(steps->sides);
+  free(steps->text);
+  *steps = {};
+  return OK;
+}
+
+uint texStepsMatch(TexSteps* steps, const char* tex, size_t length, uint step,
+                   Error* status) {
+  if (!steps ||
+      (!tex && length))
+    RETURN_WITH_STATUS(InvalidParameters, 0);
+
+  //0 would be an empty slot
+  const void* key = (const void*)(texStepsHash(tex, length) | 1);
+  size_t latest = 0;
+  ptrMapGet(&steps->bySide, key, &latest);
+  for (size_t i = latest; i; i = steps->sides[i - 1].next) {
+    const TexStepSide* side = steps->sides + i - 1;
+    if (side->length == length &&
+        memcmp(steps->text + side->offset, tex, length) == 0)
+      return side->step;
+  }
+
+  Error err = texStepsReserve(steps, length);
+  if (!err)
+    err = ptrMapSet(&steps->bySide, key, steps->count + 1);
+  if (err)
+    RETURN_WITH_STATUS(err, 0);
+  if (length)
+    memcpy(steps->text + steps->textSize, tex, length);
+  steps->sides[steps->count++] = {
+    .offset = steps->textSize,
+    .length = length,
+    .step   = step,
+    .next   = latest
+  };
+  steps->textSize += length;
+  return 0;
+}
+
+//FNV-1a
+static ulong texStepsHash(const char* str, size_t length) {
+  assert(str || !length);
+
+  ulong hash = 14695981039346656037ul;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (unsigned char)str[i];
+    hash *= 1099511628211ul;
+  }
+  return hash;
+}
+
+//Room for one more side of length bytes
+static Error texStepsReserve(TexSteps* steps, size_t length) {
+  assert(steps);
+
+  if (steps->count == steps->capacity) {
+    size_t capacity = steps->capacity
+                      ? steps->capacity * 2
+                      : TEX_STEPS_DEFAULT_SIDES;
+    TexStepSide* sides = (TexStepSide*)realloc(steps->sides,
+                                               capacity * sizeof(TexStepSide));
+    if (!sides)
+      return FailMemoryReallocation;
+    steps->sides    = sides;
+    steps->capacity = capacity;
+  }
+
+  if (length > steps->textCapacity - steps->textSize) {
+    size_t capacity = steps->textCapacity
+                      ? steps->textCapacity
+                      : TEX_STEPS_DEFAULT_TEXT;
+    while (length > capacity - steps->textSize)
+      capacity *= 2;
+    char* text = (char*)realloc(steps->text, capacity);
+    if (!text)
+      return FailMemoryReallocation;
+    steps->text         = text;
+    steps->textCapacity = capacity;
+  }
+  return OK;
+}
+
+#undef RETURN_WITH_STATUS
@@ -0,0 +1,81 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "error/error.h"
+#include "ds/map/ptrmap.h"
+
+//Which derivation steps get into the TeX report (ctx->sink)
+enum TexReportDetail {
+  TEX_REPORT_ALL,   //every step
+  TEX_REPORT_TOP,   //only the step of the whole expression
+  TEX_REPORT_DEPTH, //steps of nodes at most depth levels below the root
+  TEX_REPORT_FIRST, //the first steps steps, in the order they are taken
+};
+
+const size_t TEX_REPORT_DEFAULT_EXPR_BYTES = 1 << 11;
+//expressions are cut in the output buffer, which has to hold a whole step
+const size_t TEX_REPORT_MAX_EXPR_BYTES = 1 << 14;
+//fixed text of a step (or of the preamble) with a step number of any size
+const size_t TEX_REPORT_STEP_OVERHEAD = 1 << 7;
+//what an expression that is too long is printed as
+const char TEX_REPORT_CUT[] = "\\ldots";
+
+///Detail policy of the derivation report. Every expression printed in it
+///(the preamble's and both sides of each step) whose TeX is longer than
+///exprBytes is replaced with \ldots, and a step whose left side reads
+///exactly like an earlier one's is printed as "same as (k)" if isDeduped.
+///Steps that aren't printed don't simplify their result either, nor do
+///printed ones whose result has more than exprBytes nodes.
+///The default is the unbounded report differentiate() always printed
+struct TexReport {
+  TexReportDetail detail = TEX_REPORT_ALL;
+  uint   depth = 0;      //TEX_REPORT_DEPTH
+  size_t steps = 0;      //TEX_REPORT_FIRST
+  bool   isDeduped = false;
+  size_t exprBytes = 0;  //0 is no limit, allowed for TEX_REPORT_ALL only
+};
+
+///Whether the step of a node level levels below the root is printed
+///after printed steps already were
+bool texReportWants(const TexReport* report, uint level, size_t printed);
+///Most steps printed for an expression of nodeCount nodes
+size_t texReportMaxSteps(const TexReport* report, size_t nodeCount);
+///Most bytes one differentiate() of an expression of nodeCount nodes by a
+///variable named varLength chars long writes to the sink. SIZE_MAX if
+///there is no bound (exprBytes is 0)
+size_t texReportBound(const TexReport* report, size_t nodeCount, size_t varLength);
+
+
+///Left side of a step printed in a deduplicated report, its bytes are in
+///TexSteps::text
+struct TexStepSide {
+  size_t offset = 0;
+  size_t length = 0;
+  uint   step   = 0;
+  size_t next   = 0; //index + 1 of an earlier side with the same hash, 0 if none
+};
+
+///Left sides of the steps printed so far. They are looked up by hash and a
+///match is confirmed byte by byte, so a collision never makes two different
+///expressions "the same"
+struct TexSteps {
+  PtrMap bySide = {}; //hash | 1 -> index + 1 of the latest side with that hash
+  TexStepSide* sides = NULL;
+  size_t count    = 0;
+  size_t capacity = 0;
+  char*  text = NULL;
+  size_t textSize     = 0;
+  size_t textCapacity = 0;
+};
+
+Error texStepsInit(TexSteps* steps);
+Error texStepsDestroy(TexSteps* steps);
+///Number of an earlier step whose left side reads exactly like tex. If there
+///is none, tex is recorded as the left side of step and 0 is returned
+uint texStepsMatch(TexSteps* steps, const char* tex, size_t length, uint step,
+                   Error* status = NULL);
+
+#endif
@@ -0,0 +1,207 @@
+#include "diff/partial.h"
+#include "diff/derivative.h"
+#include "ds/tree/store.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static const size_t PARTIAL_MEMO_DEFAULT_CAPACITY = 16;
+
+//Every derivative computed so far, found by its multi-index
+struct PartialMemo {
+  uint* indices = NULL; //capacity * varCount
+  TreeNode** nodes = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  size_t varCount = 0;
+};
+
+static Error partialRequest(Context* ctx, PartialMemo* memo, const uint* request,
+                            TreeNode** result, PartialStats* stats);
+static Error partialMemoAdd(PartialMemo* memo, const uint* index, TreeNode* node);
+static long partialMemoFind(const PartialMemo* memo, const uint* index);
+static size_t partialMemoBelow(const PartialMemo* memo, const uint* index);
+static void partialMemoDestroy(NodeStore* store, PartialMemo* memo);
+
+Error differentiatePartials(Context* ctx, TreeNode* node,
+                            const uint* indices, size_t count,
+                            TreeNode** results, PartialStats* stats) {
+  if (!ctx       ||
+      !ctx->vars ||
+      !node      ||
+      (count && (!indices || !results)))
+    return InvalidParameters;
+  Error err = varsVerify(ctx->vars);
+  if (err)
+    return err;
+  if ((err = contextEnableSharing(ctx)))
+    return err;
+
+  NodeStore* store = ctx->store;
+  PartialStats ignored = {};
+  if (!stats)
+    stats = &ignored;
+  *stats = {};
+  //the store's high-water mark now only sees this job
+  store->stats.peakNodes = store->stats.liveNodes;
+
+  for (size_t k = 0; k < count; k++)
+    results[k] = NULL;
+
+  PartialMemo memo = {.varCount = ctx->vars->count};
+  TreeNode* root = IS_INTERNED(node)
+                   ? nodeShare(node)
+                   : nodeStoreImport(store, node, &err);
+  if (err)
+    return err;
+  uint* zero = (uint*)calloc(memo.varCount ? memo.varCount : 1, sizeof(uint));
+  if (!zero) {
+    nodeRelease(store, root);
+    return FailMemoryAllocation;
+  }
+  err = partialMemoAdd(&memo, zero, root);
+  free(zero);
+  if (err) {
+    nodeRelease(store, root);
+    return err;
+  }
+
+  for (size_t k = 0; k < count && !err; k++)
+    err = partialRequest(ctx, &memo, indices + k * memo.varCount, results + k, stats);
+
+  if (!err) {
+    PtrMap distinct = {};
+    err = ptrMapInit(&distinct);
+    for (size_t k = 0; k < count && !err; k++)
+      err = nodeCountUses(results[k], &distinct);
+    stats->resultNodes = distinct.count;
+    ptrMapDestroy(&distinct);
+  }
+  stats->peakNodes = store->stats.peakNodes;
+  partialMemoDestroy(store, &memo);
+
+  if (err) {
+    for (size_t k = 0; k < count; k++) {
+      if (results[k])
+        nodeRelease(store, results[k]);
+      results[k] = NULL;
+    }
+  }
+  return err;
+}
+
+//Goes up from the closest computed derivative one variable at a time,
+//remembering every step so later requests can start from it
+static Error partialRequest(Context* ctx, PartialMemo* memo, const uint* request,
+                            TreeNode** result, PartialStats* stats) {
+  assert(ctx && memo && request && result && stats);
+
+  long found = partialMemoFind(memo, request);
+  if (found >= 0) {
+    stats->reused++;
+    *result = nodeShare(memo->nodes[found]);
+    return OK;
+  }
+
+  size_t from = partialMemoBelow(memo, request);
+  size_t varCount = memo->varCount;
+  uint* current = (uint*)calloc(varCount ? varCount : 1, sizeof(uint));
+  if (!current)
+    return FailMemoryAllocation;
+  memcpy(current, memo->indices + from * varCount, varCount * sizeof(uint));
+  TreeNode* derivative = memo->nodes[from];
+
+  Error err = OK;
+  for (size_t i = 0; i < varCount && !err; i++) {
+    while (current[i] < request[i]) {
+      current[i]++;
+      TreeNode* next = differentiateByIndex(ctx, derivative, i);
+      if (!next) {
+        err = FailMemoryAllocation;
+        break;
+      }
+      stats->derivatives++;
+      //simplified before it is differentiated again, and shared all along
+      if ((err = nodeStoreOptimize(ctx->store, &next)) ||
+          (err = partialMemoAdd(memo, current, next))) {
+        nodeRelease(ctx->store, next);
+        break;
+      }
+      derivative = next;
+    }
+  }
+  free(current);
+  if (err)
+    return err;
+
+  *result = nodeShare(derivative);
+  return OK;
+}
+
+//Takes over the reference to node
+static Error partialMemoAdd(PartialMemo* memo, const uint* index, TreeNode* node) {
+  assert(memo && index && node);
+
+  if (memo->count == memo->capacity) {
+    size_t capacity = memo->capacity
+                      ? memo->capacity * 2
+                      : PARTIAL_MEMO_DEFAULT_CAPACITY;
+    size_t width = memo->varCount ? memo->varCount : 1;
+    uint* indices = (uint*)realloc(memo->indices, capacity * width * sizeof(uint));
+    if (!indices)
+      return FailMemoryReallocation;
+    memo->indices = indices;
+    TreeNode** nodes = (TreeNode**)realloc(memo->nodes, capacity * sizeof(TreeNode*));
+    if (!nodes)
+      return FailMemoryReallocation;
+    memo->nodes = nodes;
+    memo->capacity = capacity;
+  }
+
+  memcpy(memo->indices + memo->count * memo->varCount, index,
+         memo->varCount * sizeof(uint));
+  memo->nodes[memo->count++] = node;
+  return OK;
+}
+
+static long partialMemoFind(const PartialMemo* memo, const uint* index) {
+  assert(memo && index);
+
+  for (size_t k = 0; k < memo->count; k++)
+    if (!memcmp(memo->indices + k * memo->varCount, index, memo->varCount * sizeof(uint)))
+      return (long)k;
+  return -1;
+}
+
+//Highest-order computed derivative that index can be reached from
+//(the function itself always can)
+static size_t partialMemoBelow(const PartialMemo* memo, const uint* index) {
+  assert(memo && index);
+
+  size_t best = 0;
+  size_t bestOrder = 0;
+  for (size_t k = 0; k < memo->count; k++) {
+    const uint* candidate = memo->indices + k * memo->varCount;
+    size_t order = 0;
+    bool isBelow = true;
+    for (size_t i = 0; i < memo->varCount && isBelow; i++) {
+      isBelow = (candidate[i] <= index[i]);
+      order += candidate[i];
+    }
+    if (isBelow && order > bestOrder) {
+      best = k;
+      bestOrder = order;
+    }
+  }
+  return best;
+}
+
+static void partialMemoDestroy(NodeStore* store, PartialMemo* memo) {
+  assert(memo);
+
+  for (size_t k = 0; k < memo->count; k++)
+    nodeRelease(store, memo->nodes[k]);
+  free(memo->indices);
+  free(memo->nodes);
+  *memo = {};
+}
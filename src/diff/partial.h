@@ -0,0 +1,28 @@
+#ifndef PARTIAL_H
+#define PARTIAL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "diff/context.h"
+#include "ds/tree/node.h"
+
+struct PartialStats {
+  size_t derivatives = 0; //differentiate() calls, every intermediate is taken once
+  size_t reused      = 0; //requests that were already computed on the way
+  size_t peakNodes   = 0; //most distinct nodes alive in the store during the job
+  size_t resultNodes = 0; //distinct nodes of all results together
+};
+
+///Mixed partial derivatives of node, all in one job.
+///indices[k * varCount + i] is how many times request k differentiates by the
+///variable with index i, varCount is ctx->vars->count.
+///Every request starts from the highest-order derivative already computed
+///below it, so lower orders are shared. Each intermediate is simplified and
+///kept as a DAG in ctx's store (sharing gets enabled), so it is a CSE too.
+///results[k] is request k, release them with nodeDestroy() while the
+///store is still bound
+Error differentiatePartials(Context* ctx, TreeNode* node,
+                            const uint* indices, size_t count,
+                            TreeNode** results, PartialStats* stats = NULL);
+
+#endif
@@ -0,0 +1,116 @@
+#include "ds/map/ptrmap.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+static const size_t MAX_LOAD_NUMERATOR   = 3;
+static const size_t MAX_LOAD_DENOMINATOR = 4;
+
+static size_t ptrHash(const void* key, size_t capacity);
+static Error ptrMapGrow(PtrMap* map);
+
+Error ptrMapInit(PtrMap* map, size_t initialCapacity) {
+  if (!map ||
+      !initialCapacity)
+    return InvalidParameters;
+
+  size_t capacity = 1;
+  while (capacity < initialCapacity)
+    capacity <<= 1;
+
+  PtrMapEntry* items = (PtrMapEntry*)calloc(capacity, sizeof(PtrMapEntry));
+  if (!items)
+    return FailMemoryAllocation;
+
+  map->items = items;
+  map->capacity = capacity;
+  map->count = 0;
+  return OK;
+}
+
+Error ptrMapDestroy(PtrMap* map) {
+  if (!map)
+    return InvalidParameters;
+
+  free(map->items);
+  *map = {};
+  return OK;
+}
+
+Error ptrMapClear(PtrMap* map) {
+  if (!map ||
+      !map->items)
+    return InvalidParameters;
+
+  for (size_t i = 0; i < map->capacity; i++)
+    map->items[i] = {};
+  map->count = 0;
+  return OK;
+}
+
+Error ptrMapSet(PtrMap* map, const void* key, size_t value) {
+  if (!map ||
+      !map->items ||
+      !key)
+    return InvalidParameters;
+
+  if ((map->count + 1) * MAX_LOAD_DENOMINATOR > map->capacity * MAX_LOAD_NUMERATOR) {
+    Error err = ptrMapGrow(map);
+    if (err)
+      return err;
+  }
+
+  size_t mask = map->capacity - 1;
+  for (size_t i = ptrHash(key, map->capacity); ; i = (i + 1) & mask) {
+    PtrMapEntry* e = map->items + i;
+    if (!e->key) {
+      e->key = key;
+      e->value = value;
+      map->count++;
+      return OK;
+    }
+    if (e->key == key) {
+      e->value = value;
+      return OK;
+    }
+  }
+}
+
+bool ptrMapGet(const PtrMap* map, const void* key, size_t* value) {
+  if (!map ||
+      !map->items ||
+      !key)
+    return false;
+
+  size_t mask = map->capacity - 1;
+  for (size_t i = ptrHash(key, map->capacity); ; i = (i + 1) & mask) {
+    const PtrMapEntry* e = map->items + i;
+    if (!e->key)
+      return false;
+    if (e->key == key) {
+      if (value)
+        *value = e->value;
+      return true;
+    }
+  }
+}
+
+static size_t ptrHash(const void* key, size_t capacity) {
+  //Fibonacci hashing, low bits of pointers are always zero
+  uint64_t h = ((uintptr_t)key >> 3) * 0x9E3779B97F4A7C15ull;
+  return (h >> 32) & (capacity - 1);
+}
+
+static Error ptrMapGrow(PtrMap* map) {
+  PtrMap grown = {};
+  Error err = ptrMapInit(&grown, map->capacity * 2);
+  if (err)
+    return err;
+
+  for (size_t i = 0; i < map->capacity; i++) {
+    if (map->items[i].key)
+      ptrMapSet(&grown, map->items[i].key, map->items[i].value);
+  }
+  free(map->items);
+  *map = grown;
+  return OK;
+}
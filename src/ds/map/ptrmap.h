@@ -0,0 +1,30 @@
+#ifndef PTR_MAP_H
+#define PTR_MAP_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "error/error.h"
+
+const size_t PTR_MAP_DEFAULT_CAPACITY = 64;
+
+//NULL key marks an empty slot, so NULL can't be used as a key
+struct PtrMapEntry {
+  const void* key = NULL;
+  size_t value = 0;
+};
+
+///Open addressing (linear probing) map from a pointer to size_t.
+///Mostly used for "was this node visited/what did it turn into" bookkeeping
+struct PtrMap {
+  PtrMapEntry* items = NULL;
+  size_t capacity = 0; //always a power of two
+  size_t count = 0;
+};
+
+Error ptrMapInit(PtrMap* map, size_t initialCapacity = PTR_MAP_DEFAULT_CAPACITY);
+Error ptrMapDestroy(PtrMap* map);
+Error ptrMapClear(PtrMap* map);
+Error ptrMapSet(PtrMap* map, const void* key, size_t value);
+bool  ptrMapGet(const PtrMap* map, const void* key, size_t* value = NULL);
+
+#endif
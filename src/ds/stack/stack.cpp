@@ -0,0 +1,56 @@
+#include "ds/stack/stack.h"
+#include <stdlib.h>
+#include <string.h>
+
+Error nodeStackPush(NodeStack* stack, NodeFrame frame) {
+  if (!stack)
+    return InvalidParameters;
+
+  if (stack->count == stack->capacity) {
+    size_t capacity = stack->capacity * 2;
+    NodeFrame* heap = (NodeFrame*)realloc(stack->heap, capacity * sizeof(NodeFrame));
+    if (!heap)
+      return FailMemoryReallocation;
+    if (!stack->heap)
+      memcpy(heap, stack->inlineFrames, stack->count * sizeof(NodeFrame));
+    stack->heap = heap;
+    stack->capacity = capacity;
+  }
+
+  NodeFrame* frames = stack->heap
+                      ? stack->heap
+                      : stack->inlineFrames;
+  frames[stack->count++] = frame;
+  return OK;
+}
+
+NodeFrame* nodeStackTop(NodeStack* stack) {
+  if (!stack ||
+      !stack->count)
+    return NULL;
+
+  NodeFrame* frames = stack->heap
+                      ? stack->heap
+                      : stack->inlineFrames;
+  return frames + stack->count - 1;
+}
+
+Error nodeStackPop(NodeStack* stack) {
+  if (!stack ||
+      !stack->count)
+    return InvalidParameters;
+
+  stack->count--;
+  return OK;
+}
+
+Error nodeStackDestroy(NodeStack* stack) {
+  if (!stack)
+    return InvalidParameters;
+
+  free(stack->heap);
+  stack->heap = NULL;
+  stack->count = 0;
+  stack->capacity = NODE_STACK_INLINE_CAPACITY;
+  return OK;
+}
@@ -0,0 +1,35 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "error/error.h"
+#include "ds/tree/node.h"
+
+const size_t NODE_STACK_INLINE_CAPACITY = 64;
+
+///One pending node of an iterative tree walk
+struct NodeFrame {
+  TreeNode* node  = NULL;
+  TreeNode* other = NULL; //whatever the walk pairs node with, e.g. its copy
+  uint level = 0;
+  uint stage = 0;         //how much of node the walk has done
+};
+
+///Explicit stack for tree walks, so the depth of a tree isn't limited
+///by the call stack. The first NODE_STACK_INLINE_CAPACITY frames live
+///in the struct itself, deeper walks move to the heap
+struct NodeStack {
+  NodeFrame* heap = NULL;
+  size_t count = 0;
+  size_t capacity = NODE_STACK_INLINE_CAPACITY;
+  NodeFrame inlineFrames[NODE_STACK_INLINE_CAPACITY] = {};
+};
+
+Error nodeStackPush(NodeStack* stack, NodeFrame frame);
+///Top frame, valid until the next push. NULL if the stack is empty
+NodeFrame* nodeStackTop(NodeStack* stack);
+Error nodeStackPop(NodeStack* stack);
+Error nodeStackDestroy(NodeStack* stack);
+
+#endif
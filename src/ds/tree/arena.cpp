@@ -0,0 +1,180 @@
+#include "ds/tree/arena.h"
+#include "ds/tree/node.h"
+#include "ds/tree/deps.h"
+#include <stdlib.h>
+
+static thread_local NodeArena* BOUND_ARENA = NULL;
+
+static NodeSlab* slabAlloc(size_t capacity);
+static void slabFree(NodeSlab* slab);
+static void slabClearDeps(NodeSlab* slab);
+
+#define RETURN_WITH_STATUS(value, returnValue) \
+  {                                            \
+  if (status)                                  \
+    *status = value;                           \
+  return returnValue;                          \
+  }
+
+Error nodeArenaInit(NodeArena* arena, size_t initialCapacity) {
+  if (!arena ||
+      !initialCapacity)
+    return InvalidParameters;
+  if (arena->slabs)
+    return AttemptedReinitialization;
+
+  *arena = {};
+  arena->nextCapacity = initialCapacity;
+  return OK;
+}
+
+NodeArena* nodeArenaAlloc(size_t initialCapacity, Error* status) {
+  NodeArena* arena = (NodeArena*)calloc(1, sizeof(NodeArena));
+  if (!arena)
+    RETURN_WITH_STATUS(FailMemoryAllocation, NULL);
+
+  Error err = nodeArenaInit(arena, initialCapacity);
+  if (err) {
+    free(arena);
+    RETURN_WITH_STATUS(err, NULL);
+  }
+  return arena;
+}
+
+TreeNode* nodeArenaGet(NodeArena* arena, Error* status) {
+  if (!arena)
+    RETURN_WITH_STATUS(InvalidParameters, NULL);
+
+  TreeNode* node = NULL;
+  if (arena->freeList) {
+    node = arena->freeList;
+    arena->freeList = node->parent;
+    arena->stats.nodeRecycles++;
+  } else {
+    NodeSlab* slab = arena->slabs;
+    if (!slab || slab->used == slab->capacity) {
+      slab = slabAlloc(arena->nextCapacity);
+      if (!slab)
+        RETURN_WITH_STATUS(FailMemoryAllocation, NULL);
+      slab->next = arena->slabs;
+      arena->slabs = slab;
+      arena->stats.slabAllocs++;
+      if (arena->nextCapacity < NODE_ARENA_MAX_SLAB_CAPACITY)
+        arena->nextCapacity *= 2;
+    }
+    node = slab->nodes + slab->used++;
+  }
+
+  *node = {};
+  node->flags = NODE_FROM_ARENA;
+  node->arena = arena;
+  arena->stats.nodeAllocs++;
+  if (++arena->stats.liveNodes > arena->stats.peakNodes)
+    arena->stats.peakNodes = arena->stats.liveNodes;
+  return node;
+}
+
+Error nodeArenaPut(NodeArena* arena, TreeNode* node) {
+  if (!nodeArenaOwns(arena, node))
+    return InvalidParameters;
+
+  //nodeArenaGet() zeroes it again, until then only the flags are looked at
+  node->flags  = NODE_FROM_ARENA;
+  node->parent = arena->freeList;
+  arena->freeList = node;
+  arena->stats.nodeFrees++;
+  //the free list comes back in whatever order nodes were destroyed, which
+  //scatters the next tree over the slabs. Once none is alive, nodes are
+  //handed out in address order again
+  if (!--arena->stats.liveNodes)
+    return nodeArenaReset(arena);
+  return OK;
+}
+
+bool nodeArenaOwns(const NodeArena* arena, const TreeNode* node) {
+  return arena &&
+         node  &&
+         (node->flags & NODE_FROM_ARENA) &&
+         node->arena == arena;
+}
+
+Error nodeArenaReset(NodeArena* arena) {
+  if (!arena)
+    return InvalidParameters;
+
+  //slabs are pushed to the front, so the first one is the largest
+  NodeSlab* kept = arena->slabs;
+  if (kept) {
+    NodeSlab* slab = kept->next;
+    while (slab) {
+      NodeSlab* next = slab->next;
+      slabFree(slab);
+      slab = next;
+    }
+    kept->next = NULL;
+    slabClearDeps(kept);
+    kept->used = 0;
+  }
+
+  arena->slabs    = kept;
+  arena->freeList = NULL;
+  arena->stats.liveNodes = 0;
+  return OK;
+}
+
+Error nodeArenaDestroy(NodeArena* arena, bool isAlloced) {
+  if (!arena)
+    return InvalidParameters;
+
+  if (BOUND_ARENA == arena)
+    BOUND_ARENA = NULL;
+
+  NodeSlab* slab = arena->slabs;
+  while (slab) {
+    NodeSlab* next = slab->next;
+    slabFree(slab);
+    slab = next;
+  }
+  *arena = {};
+
+  if (isAlloced)
+    free(arena);
+  return OK;
+}
+
+NodeArena* nodeArenaBind(NodeArena* arena) {
+  NodeArena* prev = BOUND_ARENA;
+  BOUND_ARENA = arena;
+  return prev;
+}
+
+NodeArena* nodeArenaBound() {
+  return BOUND_ARENA;
+}
+
+//the slab header and its nodes live in one block
+static NodeSlab* slabAlloc(size_t capacity) {
+  NodeSlab* slab = (NodeSlab*)calloc(1, sizeof(NodeSlab) + capacity * sizeof(TreeNode));
+  if (!slab)
+    return NULL;
+
+  slab->capacity = capacity;
+  slab->used  = 0;
+  slab->nodes = (TreeNode*)(slab + 1);
+  return slab;
+}
+
+static void slabFree(NodeSlab* slab) {
+  slabClearDeps(slab);
+  free(slab);
+}
+
+//Nodes still alive when their slab goes may hold spilled variable sets
+//(see ds/tree/deps.h), freed ones have been zeroed already
+static void slabClearDeps(NodeSlab* slab) {
+  for (size_t i = 0; i < slab->used; i++)
+    if (slab->nodes[i].flags & NODE_DEPS_SPILLED)
+      nodeDepsClear(slab->nodes + i);
+}
+
+#undef RETURN_WITH_STATUS
@@ -0,0 +1,57 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "error/error.h"
+
+struct TreeNode;
+
+const size_t NODE_ARENA_DEFAULT_CAPACITY = 1024;
+//slabs double in size until they reach this many nodes
+const size_t NODE_ARENA_MAX_SLAB_CAPACITY = 1 << 16;
+
+struct NodeSlab {
+  NodeSlab* next = NULL;
+  size_t capacity = 0;
+  size_t used = 0;
+  TreeNode* nodes = NULL;
+};
+
+struct NodeArenaStats {
+  size_t slabAllocs   = 0; //actual calls to calloc()
+  size_t nodeAllocs   = 0; //nodes handed out in total
+  size_t nodeRecycles = 0; //nodes handed out from the free list
+  size_t nodeFrees    = 0; //nodes returned to the free list
+  size_t liveNodes    = 0;
+  size_t peakNodes    = 0;
+};
+
+struct NodeArena {
+  NodeSlab* slabs = NULL;
+  TreeNode* freeList = NULL;
+  size_t nextCapacity = 0;
+  NodeArenaStats stats = {};
+  size_t users = 0;         //contexts sharing it, see contextInit()
+  NodeArena* outer = NULL;  //bound before the first of them bound this one
+};
+
+Error nodeArenaInit(NodeArena* arena, size_t initialCapacity = NODE_ARENA_DEFAULT_CAPACITY);
+NodeArena* nodeArenaAlloc(size_t initialCapacity = NODE_ARENA_DEFAULT_CAPACITY,
+                          Error* status = NULL);
+///Hands out a zeroed node, either recycled or from the current slab
+TreeNode* nodeArenaGet(NodeArena* arena, Error* status = NULL);
+///Puts node onto the free list, the last live one resets the arena. The node must be owned by this arena
+Error nodeArenaPut(NodeArena* arena, TreeNode* node);
+///O(1), every arena node records the arena it came from
+bool nodeArenaOwns(const NodeArena* arena, const TreeNode* node);
+///Releases every node handed out so far in one go, keeping only the largest slab
+Error nodeArenaReset(NodeArena* arena);
+Error nodeArenaDestroy(NodeArena* arena, bool isAlloced = false);
+
+///nodeAlloc() takes nodes from the bound arena (per thread), or calloc()s them if none is bound.
+///Returns the previously bound arena
+NodeArena* nodeArenaBind(NodeArena* arena);
+NodeArena* nodeArenaBound();
+
+#endif
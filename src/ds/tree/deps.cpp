@@ -0,0 +1,257 @@
+#include "ds/tree/deps.h"
+#include "ds/tree/store.h"
+#include "ds/stack/stack.h"
+#include "misc/util.h"
+#include <stdlib.h>
+#include <assert.h>
+
+//One nonzero word of the whole bitmap
+struct VarSetWord {
+  size_t   index = 0;
+  uint64_t bits  = 0;
+};
+
+//Only the nonzero words, sorted by index, follow the header. A node whose set
+//is the same as a child's takes a reference to the child's spill, so a chain
+//over a few high indices holds one spill rather than one per node
+struct VarSetSpill {
+  size_t refs  = 0;
+  size_t count = 0;
+};
+
+//Either kind of set, read the same way
+struct VarSetView {
+  const VarSetWord* words = NULL;
+  size_t            count = 0;
+  VarSetSpill*      spill = NULL; //if the set is spilled
+};
+
+static bool isKnown(const TreeNode* node);
+static VarSetView varSetView(const TreeNode* node, VarSetWord* inlineWord);
+static bool varSetIncludes(VarSetView set, VarSetView part);
+static size_t varSetMerge(const VarSetView* views, size_t count, VarSetWord* out);
+static VarSetWord* spillWords(VarSetSpill* spill);
+
+Error nodeDepsUpdate(TreeNode* node) {
+  if (!node)
+    return InvalidParameters;
+
+  //the old set of node itself is never read, only its children's
+  const TreeNode* children[] = {node->left, node->right};
+  bool isInline = !IS_VAR(node) ||
+                  node->data.value.var < VAR_SET_INLINE_BITS;
+  uint64_t bits = (isInline && IS_VAR(node))
+                  ? (uint64_t)1 << node->data.value.var
+                  : 0;
+  for (size_t i = 0; i < sizer(children); i++) {
+    if (!children[i])
+      continue;
+    if (!isKnown(children[i])) {
+      nodeDepsClear(node);
+      return OK;
+    }
+    if (children[i]->flags & NODE_DEPS_SPILLED)
+      isInline = false;
+    else
+      bits |= children[i]->deps.bits;
+  }
+  if (isInline) {
+    nodeDepsClear(node);
+    node->deps.bits = bits;
+    node->flags |= NODE_DEPS;
+    return OK;
+  }
+
+  VarSetWord inlineWords[1 + sizer(children)] = {};
+  VarSetView views[1 + sizer(children)] = {};
+  size_t viewCount = 0;
+  if (IS_VAR(node)) {
+    size_t var = node->data.value.var;
+    inlineWords[0] = {var / VAR_SET_INLINE_BITS,
+                      (uint64_t)1 << (var % VAR_SET_INLINE_BITS)};
+    views[viewCount++] = {inlineWords, 1};
+  }
+  for (size_t i = 0; i < sizer(children); i++) {
+    if (!children[i])
+      continue;
+    views[viewCount] = varSetView(children[i], inlineWords + viewCount);
+    viewCount++;
+  }
+
+  VarSetSpill* spill = NULL;
+  for (size_t i = 0; i < viewCount && !spill; i++) {
+    if (!views[i].spill)
+      continue;
+    bool hasAll = true;
+    for (size_t k = 0; k < viewCount && hasAll; k++)
+      hasAll = k == i || varSetIncludes(views[i], views[k]);
+    if (hasAll) {
+      spill = views[i].spill;
+      spill->refs++;
+    }
+  }
+
+  if (!spill) {
+    size_t count = varSetMerge(views, viewCount, NULL);
+    spill = (VarSetSpill*)calloc(1, sizeof(VarSetSpill) + count * sizeof(VarSetWord));
+    if (!spill) {
+      nodeDepsClear(node);
+      return FailMemoryAllocation;
+    }
+    *spill = {.refs = 1, .count = count};
+    varSetMerge(views, viewCount, spillWords(spill));
+  }
+  nodeDepsClear(node);
+  node->deps.spill = spill;
+  node->flags |= NODE_DEPS | NODE_DEPS_SPILLED;
+  return OK;
+}
+
+//Postorder that doesn't go below a node whose set is known already
+Error nodeDepsAnnotate(TreeNode* node) {
+  if (!node)
+    return InvalidParameters;
+  if (isKnown(node))
+    return OK;
+
+  NodeStack stack = {};
+  Error err = nodeStackPush(&stack, {.node = node});
+  while (!err &&
+         stack.count) {
+    NodeFrame* frame = nodeStackTop(&stack);
+    TreeNode* current = frame->node;
+    if (frame->stage++) {
+      err = nodeDepsUpdate(current);
+      nodeStackPop(&stack);
+      continue;
+    }
+    if (current->right && !isKnown(current->right))
+      err = nodeStackPush(&stack, {.node = current->right});
+    if (!err && current->left && !isKnown(current->left))
+      err = nodeStackPush(&stack, {.node = current->left});
+  }
+  nodeStackDestroy(&stack);
+  return err;
+}
+
+Error nodeDepsCopy(TreeNode* to, const TreeNode* from) {
+  if (!to ||
+      !from)
+    return InvalidParameters;
+  if (!isKnown(from))
+    return nodeDepsUpdate(to);
+
+  if (from->flags & NODE_DEPS_SPILLED)
+    from->deps.spill->refs++;
+  nodeDepsClear(to);
+  to->deps   = from->deps;
+  to->flags |= from->flags & (NODE_DEPS | NODE_DEPS_SPILLED);
+  return OK;
+}
+
+//Stops at the first node without a set: none of its ancestors has one either.
+//An interned node has no single parent, but it's never changed in place anyway
+void nodeDepsInvalidate(TreeNode* node) {
+  for (TreeNode* current = node; isKnown(current); current = current->parent) {
+    nodeDepsClear(current);
+    if (IS_INTERNED(current))
+      break;
+  }
+}
+
+void nodeDepsClear(TreeNode* node) {
+  if (!node)
+    return;
+
+  if ((node->flags & NODE_DEPS_SPILLED) &&
+      !--node->deps.spill->refs)
+    free(node->deps.spill);
+  node->deps = {};
+  node->flags &= ~(uint)(NODE_DEPS | NODE_DEPS_SPILLED);
+}
+
+bool nodeDependsOn(const TreeNode* node, size_t var) {
+  if (!node)
+    return false;
+  if (!isKnown(node))
+    return true;
+  if (!(node->flags & NODE_DEPS_SPILLED))
+    return var < VAR_SET_INLINE_BITS &&
+           (node->deps.bits >> var) & 1;
+
+  size_t index = var / VAR_SET_INLINE_BITS;
+  const VarSetWord* words = spillWords(node->deps.spill);
+  size_t low  = 0;
+  size_t high = node->deps.spill->count;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (words[middle].index < index)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low < node->deps.spill->count &&
+         words[low].index == index &&
+         (words[low].bits >> (var % VAR_SET_INLINE_BITS)) & 1;
+}
+
+static bool isKnown(const TreeNode* node) {
+  return node && (node->flags & NODE_DEPS);
+}
+
+//An inline set is read through inlineWord
+static VarSetView varSetView(const TreeNode* node, VarSetWord* inlineWord) {
+  assert(isKnown(node));
+
+  if (node->flags & NODE_DEPS_SPILLED)
+    return {spillWords(node->deps.spill), node->deps.spill->count, node->deps.spill};
+  *inlineWord = {0, node->deps.bits};
+  return {inlineWord, node->deps.bits ? 1u : 0u};
+}
+
+static bool varSetIncludes(VarSetView set, VarSetView part) {
+  size_t k = 0;
+  for (size_t i = 0; i < part.count; i++) {
+    while (k < set.count && set.words[k].index < part.words[i].index)
+      k++;
+    if (k == set.count ||
+        set.words[k].index != part.words[i].index ||
+        (part.words[i].bits & ~set.words[k].bits))
+      return false;
+  }
+  return true;
+}
+
+//Union of a few sorted sets, only counted if out is NULL
+static size_t varSetMerge(const VarSetView* views, size_t count, VarSetWord* out) {
+  size_t positions[3] = {};
+  assert(count <= sizer(positions));
+
+  size_t written = 0;
+  while (true) {
+    bool isDone = true;
+    size_t index = 0;
+    for (size_t i = 0; i < count; i++)
+      if (positions[i] < views[i].count &&
+          (isDone || views[i].words[positions[i]].index < index)) {
+        index  = views[i].words[positions[i]].index;
+        isDone = false;
+      }
+    if (isDone)
+      break;
+
+    uint64_t bits = 0;
+    for (size_t i = 0; i < count; i++)
+      if (positions[i] < views[i].count &&
+          views[i].words[positions[i]].index == index)
+        bits |= views[i].words[positions[i]++].bits;
+    if (out)
+      out[written] = {index, bits};
+    written++;
+  }
+  return written;
+}
+
+static VarSetWord* spillWords(VarSetSpill* spill) {
+  return (VarSetWord*)(spill + 1);
+}
@@ -0,0 +1,32 @@
+#ifndef DEPS_H
+#define DEPS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "ds/tree/node.h"
+
+//Sets of variable indices below this fit in the node itself
+const size_t VAR_SET_INLINE_BITS = 64;
+
+//NOTE: a node's NODE_DEPS flag says its deps matches its subtree. A flagged
+//node only ever has flagged children, so whatever changes a node either
+//brings its set up to date with nodeDepsUpdate() or clears the flags of it
+//and its ancestors with nodeDepsInvalidate()
+
+///Recomputes deps of node from its own data and its children's sets.
+///If a child's set isn't known, neither is node's
+Error nodeDepsUpdate(TreeNode* node);
+///O(1) set of a copy of from, a spilled one is shared.
+///If from's set isn't known, to's is recomputed instead
+Error nodeDepsCopy(TreeNode* to, const TreeNode* from);
+///Fills in every set in the subtree that isn't known yet, bottom up
+Error nodeDepsAnnotate(TreeNode* node);
+///Forgets the sets of node and every ancestor that had one
+void nodeDepsInvalidate(TreeNode* node);
+///Drops the node's share of a spilled set and forgets it
+void nodeDepsClear(TreeNode* node);
+///O(1) below VAR_SET_INLINE_BITS, logarithmic in the spilled words above.
+///A node whose set isn't known is taken to contain var
+bool nodeDependsOn(const TreeNode* node, size_t var);
+
+#endif
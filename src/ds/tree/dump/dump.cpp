@@ -10,6 +10,7 @@
 #include "misc/quotes.h"
 #include "misc/util.h"
 #include "ds/queue/queue.h"
+#include "ds/map/ptrmap.h"
 
 static const size_t MAX_IMAGE_FILE_PATH_LENGTH = 128;
 static const size_t MAX_DOT_COMMAND_LENGTH = 512;
@@ -39,8 +40,9 @@ static int treeTextDump(FILE* f, TreeRoot* root,
                         uint callCount);
 static int treeGraphDump(FILE* f,  Variables* vars, TreeRoot* root, uint callCount);
 static void populateDot(FILE* dot, Variables* vars, TreeNode* node);
-static void declareNode(FILE* dot, Variables* vars, TreeNode* node, bool bondFailed = false);
-static void declareRank(FILE* dot, TreeNode* node, Queue** queue);
+static void declareNode(FILE* dot, Variables* vars, TreeNode* node,
+                        PtrMap* declared, bool bondFailed = false);
+static void declareRank(FILE* dot, TreeNode* node, Queue** queue, PtrMap* ranked);
 static void executeDot(FILE* f, uint callCount, char* dotPath);
 
 #define WARNING_PREFIX(condition) (condition) ? "<b><body><font color=\"red\">[!]</font></body></b>" : ""
@@ -245,30 +247,48 @@ static void populateDot(FILE* dot, Variables* vars, TreeNode* node) {
   assert(!varsVerify(vars));
   assert(node);
 
-  declareNode(dot, vars, node);
+  //shared (interned) nodes are reachable from many parents, but are declared once
+  PtrMap declared = {};
+  PtrMap ranked   = {};
+  if (ptrMapInit(&declared) ||
+      ptrMapInit(&ranked)) {
+    ptrMapDestroy(&declared);
+    return;
+  }
+
+  declareNode(dot, vars, node, &declared);
   Queue* queue = NULL;
-  declareRank(dot, node, &queue);
+  declareRank(dot, node, &queue, &ranked);
+  ptrMapDestroy(&declared);
+  ptrMapDestroy(&ranked);
 }
 
 #define DECLARE_CHILD_NODE(child)                                                 \
    {                                                                              \
    if (child) {                                                                   \
-     if (child->parent == node) {                                                 \
+     if (IS_INTERNED(child)) {                                                    \
+       fprintf(dot, "node%p -> node%p [color=\"%s\"]\n", node, child, OK_EDGE);   \
+       declareNode(dot, vars, child, declared);                                   \
+     } else if (child->parent == node) {                                          \
        fprintf(dot, "node%p -> node%p [color=\"%s\", arrowtail=vee, dir=both]\n", \
                node, child, OK_EDGE);                                             \
-       declareNode(dot, vars, child);                                             \
+       declareNode(dot, vars, child, declared);                                   \
      } else {                                                                     \
        fprintf(dot, "node%p -> node%p [color=\"%s\"]\n", node, child, BAD_EDGE);  \
-       declareNode(dot, vars, child, true);                                       \
+       declareNode(dot, vars, child, declared, true);                             \
      }                                                                            \
    }                                                                              \
    }
 
-static void declareNode(FILE* dot, Variables* vars, TreeNode* node, bool bondFailed) {
+static void declareNode(FILE* dot, Variables* vars, TreeNode* node,
+                        PtrMap* declared, bool bondFailed) {
   assert(dot);
   assert(!varsVerify(vars));
-  if (!node)
+  assert(declared);
+  if (!node ||
+      ptrMapGet(declared, node))
     return;
+  ptrMapSet(declared, node, 0);
   
   const NodeTypeInfo* nodeInfo = parseNodeType(node->data.type);
   fprintf(dot,
@@ -341,7 +361,7 @@ static void declareNode(FILE* dot, Variables* vars, TreeNode* node, bool bondFai
           node->data.type != OP_TYPE && node->right
           ? DEFAULT_CELL
           : RIGHT_FILL, node->right);
-  if (node->parent && bondFailed)
+  if (node->parent && bondFailed && !IS_INTERNED(node))
     fprintf(dot, "node%p -> node%p [color=\"%s\"]\n", node, node->parent, BAD_EDGE);
   DECLARE_CHILD_NODE(node->left);
   DECLARE_CHILD_NODE(node->right);
@@ -349,15 +369,19 @@ static void declareNode(FILE* dot, Variables* vars, TreeNode* node, bool bondFai
 
 #undef DECLARE_CHILD_NODE
 
-static void declareRank(FILE* dot, TreeNode* node, Queue** queue) {
+static void declareRank(FILE* dot, TreeNode* node, Queue** queue, PtrMap* ranked) {
   assert(dot);
   assert(node);
   assert(queue);
+  assert(ranked);
 
   fputs("{ rank = same; ", dot);
   Queue* newQueue = NULL;
   TreeNode* cur = node;
   do {
+    if (ptrMapGet(ranked, cur))
+      continue;
+    ptrMapSet(ranked, cur, 0);
     fprintf(dot, "node%p; ", cur);
     if (cur->left)
       enqueue(&newQueue, cur->left);
@@ -366,7 +390,7 @@ static void declareRank(FILE* dot, TreeNode* node, Queue** queue) {
   } while (!dequeue(queue, &cur));
   fputs("}\n", dot);
   if (!dequeue(&newQueue, &cur))
-    declareRank(dot, cur, &newQueue);
+    declareRank(dot, cur, &newQueue, ranked);
 }
 
 static void executeDot(FILE* f, uint callCount, char* dotPath) {
@@ -1,4 +1,8 @@
 #include "ds/tree/tree.h"
+#include "ds/tree/store.h"
+#include "ds/tree/rewrite.h"
+#include "ds/tree/deps.h"
+#include "ds/stack/stack.h"
 #include "misc/util.h"
 #include <stdlib.h>
 #include <string.h>
@@ -6,8 +10,29 @@
 
 #undef nodeTraverse
 
-static double nodeOptimizeConstants(TreeNode* node, size_t* nodeCount, Error* status = NULL);
-static Error nodeOptimizeNeutral(TreeNode** node, size_t* nodeCount);
+//Where nodeFixParents() came to a node from
+enum WalkFrom {
+  FROM_PARENT,
+  FROM_LEFT,
+  FROM_RIGHT,
+};
+
+//NodeFrame::stage of nodeSimplify(): which operand is next, and which of
+//them came back fresh (see rewriteSimplifyStep())
+enum SimplifyStage {
+  SIMPLIFY_STAGE_LEFT  = 0,
+  SIMPLIFY_STAGE_RIGHT = 1,
+  SIMPLIFY_STAGE_DONE  = 2,
+  SIMPLIFY_STAGE_MASK  = 3,
+  SIMPLIFY_LEFT_FRESH  = 1 << 2,
+  SIMPLIFY_RIGHT_FRESH = 1 << 3,
+};
+
+static bool nodeUnitEqual(const TreeNode* a, const TreeNode* b);
+static TreeNode* nodeCopyUnit(const TreeNode* from, TreeNode* parent, Error* status);
+static Error nodeSimplify(TreeNode** node, bool underPow, size_t* nodeCount);
+static TreeNode* nodeSimplifyLocal(TreeNode* node, bool underPow, bool isFresh,
+                                   size_t* nodeCount, bool* isResultFresh);
 
 #define RETURN_WITH_STATUS(value, returnValue) \
   {                                            \
@@ -29,6 +54,8 @@ Error nodeInit(TreeNode* node, NodeUnit data, TreeNode* parent,
   node->parent = parent;
   node->left   = left;
   node->right  = right;
+  //children are usually there already, otherwise the set is left unknown
+  nodeDepsUpdate(node);
 
   return OK;
 }
@@ -36,50 +63,119 @@ Error nodeInit(TreeNode* node, NodeUnit data, TreeNode* parent,
 TreeNode*  nodeAlloc(NodeUnit data, TreeNode* parent,
                            TreeNode* left, TreeNode* right,
                            Error* status) {
-  TreeNode* node = (TreeNode*)calloc(1, sizeof(TreeNode));
-  if (!node) {
-    free(node);
-    RETURN_WITH_STATUS(FailMemoryAllocation, NULL);
-  }
-  *node = {};
+  NodeStore* store = nodeStoreBound();
+  if (store)
+    return nodeIntern(store, data, left, right, status);
+
+  TreeNode* node = nodeAllocBlank(status);
+  if (!node)
+    return NULL;
 
   Error returnedStatus = nodeInit(node, data, parent, left, right);
   if (returnedStatus) {
-    free(node);
+    nodeFree(node);
     RETURN_WITH_STATUS(returnedStatus, NULL);
   }
 
   return node;
 }
 
+TreeNode* nodeAllocBlank(Error* status) {
+  NodeArena* arena = nodeArenaBound();
+  TreeNode* node = arena
+                   ? nodeArenaGet(arena)
+                   : (TreeNode*)calloc(1, sizeof(TreeNode));
+  if (!node)
+    RETURN_WITH_STATUS(FailMemoryAllocation, NULL);
+  return node;
+}
+
+//Explicit stack instead of recursion, a million-deep chain is fine.
+//Children are read only when the walk gets to them, like before,
+//so a callback may still change them
 Error nodeTraverse(TreeNode* node, NodeTraverseOpt opt) {
-	if (!node)
+  if (!node)
     return OK;
 
-  opt.level++;
-  return (opt.prefix  && opt.prefix(node,  opt.prefixData, opt.level - 1)) ||
-         nodeTraverse(node->left,  opt) ||
-         (opt.infix   && opt.infix(node,   opt.infixData, opt.level - 1)) ||
-         nodeTraverse(node->right, opt) ||
-         (opt.postfix && opt.postfix(node, opt.postfixData, opt.level - 1));
+  NodeStack stack = {};
+  Error err = nodeStackPush(&stack, {.node = node, .level = opt.level});
+  bool isStopped = false;
+  while (!err &&
+         !isStopped &&
+         stack.count) {
+    NodeFrame* frame = nodeStackTop(&stack);
+    TreeNode* current = frame->node;
+    uint level = frame->level;
+    switch (frame->stage++) {
+      case 0:
+        isStopped = opt.prefix && opt.prefix(current, opt.prefixData, level);
+        if (!isStopped && current->left)
+          err = nodeStackPush(&stack, {.node = current->left, .level = level + 1});
+        break;
+      case 1:
+        isStopped = opt.infix && opt.infix(current, opt.infixData, level);
+        if (!isStopped && current->right)
+          err = nodeStackPush(&stack, {.node = current->right, .level = level + 1});
+        break;
+      default:
+        isStopped = opt.postfix && opt.postfix(current, opt.postfixData, level);
+        nodeStackPop(&stack);
+        break;
+    }
+  }
+  nodeStackDestroy(&stack);
+
+  return err
+         ? err
+         : isStopped;
 }
 
 TreeNode* nodeCopy(TreeNode* src, TreeNode* newParent, Error* status) {
   if (!src)
     RETURN_WITH_STATUS(InvalidParameters, NULL);
+  if (IS_INTERNED(src))
+    return nodeShare(src);
+  //an interned node is hashed on its children, so it's built bottom up
+  NodeStore* store = nodeStoreBound();
+  if (store)
+    return nodeStoreImport(store, src, status);
 
   Error returnedStatus = OK;
-  TreeNode* copy = nodeAlloc({src->data.type, src->data.value}, newParent,
-                                   NULL, NULL, &returnedStatus);
-  if (returnedStatus) {
-    nodeDestroy(copy, true);
+  TreeNode* copy = nodeCopyUnit(src, newParent, &returnedStatus);
+  if (returnedStatus)
     RETURN_WITH_STATUS(returnedStatus, NULL);
-  }
 
-  if (src->left)
-    copy->left = nodeCopy(src->left, copy, &returnedStatus);
-  if (src->right)
-    copy->right = nodeCopy(src->right, copy, &returnedStatus);
+  //frame: node is the original, other its copy, stage the next child to copy
+  NodeStack stack = {};
+  returnedStatus = nodeStackPush(&stack, {.node = src, .other = copy});
+  while (!returnedStatus &&
+         stack.count) {
+    NodeFrame* frame = nodeStackTop(&stack);
+    TreeNode* from = frame->node;
+    TreeNode* to   = frame->other;
+    if (frame->stage > 1) {
+      nodeDepsCopy(to, from);
+      nodeStackPop(&stack);
+      continue;
+    }
+    bool isLeft = !frame->stage++;
+    TreeNode* child = isLeft ? from->left : from->right;
+    if (!child)
+      continue;
+
+    TreeNode* childCopy = IS_INTERNED(child)
+                          ? nodeShare(child)
+                          : nodeCopyUnit(child, to, &returnedStatus);
+    if (returnedStatus)
+      break;
+    if (isLeft)
+      to->left  = childCopy;
+    else
+      to->right = childCopy;
+    if (!IS_INTERNED(child))
+      returnedStatus = nodeStackPush(&stack, {.node = child, .other = childCopy});
+  }
+  nodeStackDestroy(&stack);
 
   if (returnedStatus) {
     nodeDestroy(copy, true);
@@ -89,17 +185,91 @@ TreeNode* nodeCopy(TreeNode* src, TreeNode* newParent, Error* status) {
   return copy;
 }
 
-void nodeFixParents(TreeNode* node) {
+//Data only: children and the set come once the walk is back at the node
+static TreeNode* nodeCopyUnit(const TreeNode* from, TreeNode* parent, Error* status) {
+  TreeNode* node = nodeAllocBlank(status);
   if (!node)
+    return NULL;
+
+  node->data   = from->data;
+  node->parent = parent;
+  return node;
+}
+
+//Walks down setting parents and climbs back up along the parents it has
+//just set, so it needs no stack at all
+void nodeFixParents(TreeNode* node) {
+  if (!node ||
+      IS_INTERNED(node))
     return;
 
-  if (node->left) {
-    node->left->parent  = node;
-    nodeFixParents(node->left);
+  WalkFrom from = FROM_PARENT;
+  TreeNode* current = node;
+  while (true) {
+    if (from == FROM_PARENT &&
+        current->left &&
+        !IS_INTERNED(current->left)) {
+      current->left->parent = current;
+      current = current->left;
+      continue;
+    }
+    if (from != FROM_RIGHT &&
+        current->right &&
+        !IS_INTERNED(current->right)) {
+      current->right->parent = current;
+      current = current->right;
+      from = FROM_PARENT;
+      continue;
+    }
+    if (current == node)
+      break;
+
+    TreeNode* parent = current->parent;
+    from = (parent->left == current)
+           ? FROM_LEFT
+           : FROM_RIGHT;
+    current = parent;
   }
-  if (node->right) {
-    node->right->parent = node;
-    nodeFixParents(node->right);
+}
+
+//Pairs of nodes still to compare go on an explicit stack, any depth is fine
+bool nodeEqual(const TreeNode* a, const TreeNode* b) {
+  NodeStack stack = {};
+  bool isEqual = !nodeStackPush(&stack, {.node  = const_cast<TreeNode*>(a),
+                                         .other = const_cast<TreeNode*>(b)});
+  while (isEqual &&
+         stack.count) {
+    NodeFrame frame = *nodeStackTop(&stack);
+    nodeStackPop(&stack);
+    a = frame.node;
+    b = frame.other;
+    if (a == b)
+      continue;
+    if (!nodeUnitEqual(a, b) ||
+        nodeStackPush(&stack, {.node = a->right, .other = b->right}) ||
+        nodeStackPush(&stack, {.node = a->left,  .other = b->left}))
+      isEqual = false;
+  }
+
+  nodeStackDestroy(&stack);
+  return isEqual;
+}
+
+static bool nodeUnitEqual(const TreeNode* a, const TreeNode* b) {
+  if (!a || !b ||
+      a->data.type != b->data.type)
+    return false;
+
+  switch (a->data.type) {
+    case NUM_TYPE:
+      //bitwise on purpose, doubleEqual() isn't transitive
+      return memcmp(&a->data.value.num, &b->data.value.num, sizeof(double)) == 0;
+    case VAR_TYPE:
+      return a->data.value.var == b->data.value.var;
+    case OP_TYPE:
+      return a->data.value.op  == b->data.value.op;
+    default:
+      return true;
   }
 }
 
@@ -116,174 +286,146 @@ Error nodeChangeChild(TreeNode* parent, TreeNode* child,
     if (newChild)
       newChild->parent = parent;
     nodeDestroy(child, true, nodeCount);
+    nodeDepsInvalidate(parent);
   }
 
   return OK;
 }
 
-Error nodeOptimize(TreeNode** node) {
+Error nodeOptimize(TreeNode** node, size_t* nodeCount) {
   if (!node ||
       !*node)
     return InvalidParameters;
-
-  Error returnedStatus = OK;
-  TreeRoot* root = attachRoot(*node, &returnedStatus);
-  if (returnedStatus)
-    return returnedStatus;
-  size_t prevNodeCount = 0;
-  do {
-    prevNodeCount = root->nodeCount;
-    nodeOptimizeConstants(*node, &root->nodeCount);
-    nodeOptimizeNeutral(node, &root->nodeCount);
-    nodeFixParents(*node);
-  } while (prevNodeCount != root->nodeCount);
-
-  detachRoot(root, &returnedStatus);
-  if (returnedStatus)
-    return returnedStatus;
-  return OK;
+  if (IS_INTERNED(*node))
+    return nodeStoreOptimize(nodeStoreBound(), node);
+
+  TreeNode* parent = (*node)->parent;
+  TreeNode* result = *node;
+  Error err = nodeSimplify(&result, OF_OP(parent, OP_POW), nodeCount);
+  if (result != *node &&
+      parent) {
+    if (parent->left == *node)
+      parent->left  = result;
+    else if (parent->right == *node)
+      parent->right = result;
+  }
+  //the subtree may have lost variables on the way
+  nodeDepsInvalidate(parent);
+  result->parent = parent;
+  *node = result;
+  return err;
 }
 
-static double nodeOptimizeConstants(TreeNode* node, size_t* nodeCount, Error* status) {
-  if (!node)
-    RETURN_WITH_STATUS(InvalidParameters, NAN);
-  if (!IS_OP(node))
-    RETURN_WITH_STATUS(OK, NAN);
-  bool suppressOptimization = (OF_OP(node->parent, OP_POW) &&
-                               OF_OP(node, OP_DIV) &&
-                               OF_NUM(node->left, 1));
-
-  OpType opType = node->data.value.op;
-  const OpTypeInfo* i = parseOpType(opType);
-  assert(i);
-  switch (i->argCount) {
-    case 1: {
-      double rightVal = IS_NUM(node->right)
-                        ? node->right->data.value.num
-                        : nodeOptimizeConstants(node->right, nodeCount, status);
-      if (!suppressOptimization &&
-          !node->left &&
-          !isnan(rightVal)) {
-        double result = applyOperation(opType, rightVal);
-        nodeDelete(node->right, true, nodeCount);
-        node->data.type = NUM_TYPE;
-        node->data.value.num = result;
-        return result;
-      }
-      return NAN;
-    }
-    case 2: {
-      double leftVal =  IS_NUM(node->left)
-                        ? node->left->data.value.num
-                        : nodeOptimizeConstants(node->left, nodeCount, status);
-      double rightVal = IS_NUM(node->right)
-                        ? node->right->data.value.num
-                        : nodeOptimizeConstants(node->right, nodeCount, status);
-      if (!suppressOptimization &&
-          !isnan(leftVal) &&
-          !isnan(rightVal)) {
-        double result = applyOperation(opType, leftVal, rightVal);
-        nodeDelete(node->left,  true, nodeCount);
-        nodeDelete(node->right, true, nodeCount);
-        node->data.type = NUM_TYPE;
-        node->data.value.num = result;
-        return result;
-      }
-      return NAN;
+//Postorder with an explicit stack: every node is looked at once, with
+//operands that are already final. Each result goes into its parent right
+//away, so *node is a whole tree even if the walk stops half way
+static Error nodeSimplify(TreeNode** node, bool underPow, size_t* nodeCount) {
+  assert(node && *node);
+
+  NodeStack stack = {};
+  Error err = nodeStackPush(&stack, {.node = *node});
+  while (!err &&
+         stack.count) {
+    NodeFrame* frame = nodeStackTop(&stack);
+    TreeNode* current = frame->node;
+    uint stage = frame->stage & SIMPLIFY_STAGE_MASK;
+    if (IS_OP(current) &&
+        !IS_INTERNED(current) &&
+        stage != SIMPLIFY_STAGE_DONE) {
+      frame->stage++;
+      TreeNode* operand = (stage == SIMPLIFY_STAGE_LEFT)
+                          ? current->left
+                          : current->right;
+      if (operand)
+        err = nodeStackPush(&stack, {.node = operand, .other = current});
+      continue;
     }
-    default:
-      return NAN;
-  }
-
-  return NAN;
-}
 
-#define REPLACE_WITH(newNode)                          \
-  {                                                    \
-  TreeNode* newChild = newNode;                        \
-  newNode = NULL;                                      \
-  TreeNode* parent = (*node)->parent;                  \
-  nodeChangeChild(parent, *node, newChild, nodeCount); \
-  *node = newChild;                                    \
-  }                                                    \
+    TreeNode* parent = frame->other;
+    bool isFresh = false;
+    TreeNode* result = current;
+    if (IS_INTERNED(current)) {
+      NodeStore* store = nodeStoreBound();
+      if (store)
+        nodeStoreOptimize(store, &result);
+    } else if (IS_OP(current)) {
+      result = nodeSimplifyLocal(current,
+                                 parent ? OF_OP(parent, OP_POW) : underPow,
+                                 frame->stage & (SIMPLIFY_LEFT_FRESH | SIMPLIFY_RIGHT_FRESH),
+                                 nodeCount, &isFresh);
+      //the operands' sets are final, so this is all it takes to keep it up to date
+      if (!IS_INTERNED(result))
+        nodeDepsUpdate(result);
+    }
+    nodeStackPop(&stack);
 
-#define REDUCE_TO_NUM(nodeValue)               \
-  {                                            \
-  nodeDelete((*node)->left , true, nodeCount); \
-  nodeDelete((*node)->right, true, nodeCount); \
-  (*node)->data.type      = NUM_TYPE;          \
-  (*node)->data.value.num = nodeValue;         \
+    if (!parent) {
+      *node = result;
+      continue;
+    }
+    //the parent is right below, its operands are pushed one at a time
+    NodeFrame* parentFrame = nodeStackTop(&stack);
+    if (parent->left == current) {
+      parent->left = result;
+      if (isFresh)
+        parentFrame->stage |= SIMPLIFY_LEFT_FRESH;
+    } else {
+      parent->right = result;
+      if (isFresh)
+        parentFrame->stage |= SIMPLIFY_RIGHT_FRESH;
+    }
+    if (!IS_INTERNED(result))
+      result->parent = parent;
   }
 
-static Error nodeOptimizeNeutral(TreeNode** node, size_t* nodeCount) {
-  if (!node ||
-      !*node)
-    return InvalidParameters;
-  if (!IS_OP(*node))
-    return OK;
+  nodeStackDestroy(&stack);
+  return err;
+}
 
-  nodeOptimizeNeutral(&(*node)->left, nodeCount);
-  nodeOptimizeNeutral(&(*node)->right, nodeCount);
-
-  switch ((*node)->data.value.op) {
-    case OP_MUL: {
-      if (OF_NUM((*node)->left, 0) ||
-          OF_NUM((*node)->right, 0)) {
-        REDUCE_TO_NUM(0);
-      } else if (OF_NUM((*node)->left, 1)) {
-        REPLACE_WITH((*node)->right);
-      } else if (OF_NUM((*node)->right, 1)) {
-        REPLACE_WITH((*node)->left);
-      }
-      break;
+//Takes rewriteSimplifyStep() until nothing applies
+static TreeNode* nodeSimplifyLocal(TreeNode* node, bool underPow, bool isFresh,
+                                   size_t* nodeCount, bool* isResultFresh) {
+  assert(isResultFresh);
+
+  *isResultFresh = false;
+  while (IS_OP(node) &&
+         !IS_INTERNED(node)) {
+    SimplifyStep step = rewriteSimplifyStep(node, underPow, isFresh);
+    if (step.action == SIMPLIFY_KEEP)
+      return node;
+
+    if (step.result.kind == REWRITE_RESULT_NUM) {
+      nodeDelete(node->left,  true, nodeCount);
+      nodeDelete(node->right, true, nodeCount);
+      node->data.type      = NUM_TYPE;
+      node->data.value.num = step.result.num;
+      //a number folded out of fresh ones is just as fresh
+      *isResultFresh = (step.action == SIMPLIFY_NEUTRAL) || isFresh;
+      return node;
     }
-    case OP_DIV: {
-      if (OF_NUM((*node)->left, 0)) {
-        REDUCE_TO_NUM(0);
-      } else if (OF_NUM((*node)->right, 1)) {
-        REPLACE_WITH((*node)->left);
-      }
-      break;
-    }
-    case OP_ADD: {
-      if (OF_NUM((*node)->left, 0)) {
-        REPLACE_WITH((*node)->right);
-      } else if (OF_NUM((*node)->right, 0)) {
-        REPLACE_WITH((*node)->left);
-      }
-      break;
-    }
-    case OP_SUB: {
-      if (OF_NUM((*node)->right, 0))
-        REPLACE_WITH((*node)->left);
-      break;
-    }
-    case OP_POW: {
-      if (OF_NUM((*node)->right, 0) ||
-          OF_NUM((*node)->left, 1)) {
-        REDUCE_TO_NUM(1);
-      } else if (OF_NUM((*node)->left, 0)) {
-        REDUCE_TO_NUM(0);
-      } else if (OF_NUM((*node)->right, 1)) {
-        REPLACE_WITH((*node)->left);
-      }
-      break;
-    }
-    default:
-      break;
+    assert(step.result.kind == REWRITE_RESULT_SLOT);
+    TreeNode* kept = step.result.slot;
+    if (kept == node->left)
+      node->left  = NULL;
+    else
+      node->right = NULL;
+    nodeDestroy(node, true, nodeCount);
+    node = kept;
+    *isResultFresh = true;
+    //same operands under another parent: only a 1/n root can change its mind
+    isFresh = false;
   }
 
-  return OK;
+  return node;
 }
 
-#undef REPLACE_WITH
-#undef REDUCE_TO_NUM
-
 Error nodeDelete(TreeNode* node, bool isAlloced, size_t* nodeCount) {
   if (!node)
     return InvalidParameters;
 
-  if (node->parent) {
+  //parent of a shared node is meaningless, it doesn't own the node anyway
+  if (node->parent &&
+      !IS_INTERNED(node)) {
     if (node->parent->left == node)
       node->parent->left = NULL;
     else if (node->parent->right == node)
@@ -293,25 +435,59 @@ Error nodeDelete(TreeNode* node, bool isAlloced, size_t* nodeCount) {
   return nodeDestroy(node, isAlloced, nodeCount);
 }
 
+//Rotates every left child up until there is none, then the node can go
+//and its right child is next. Constant memory, any depth
 Error nodeDestroy(TreeNode* node, bool isAlloced, size_t* nodeCount) {
   if (!node)
     return InvalidParameters;
+  if (IS_INTERNED(node))
+    return nodeRelease(nodeStoreBound(), node);
+
+  TreeNode* current = node;
+  while (current) {
+    TreeNode* left = current->left;
+    if (left &&
+        !IS_INTERNED(left)) {
+      current->left = left->right;
+      left->right   = current;
+      current = left;
+      continue;
+    }
+    if (left)
+      nodeRelease(nodeStoreBound(), left);
 
-  nodeDestroy(node->left, isAlloced);
-  nodeDestroy(node->right, isAlloced);
-  node->left   = NULL;
-  node->right  = NULL;
-  node->parent = NULL;
-  node->data   = {};
-
-  if (isAlloced)
-    free(node);
-  if (nodeCount)
-    (*nodeCount)--;
+    TreeNode* next = current->right;
+    if (IS_INTERNED(next)) {
+      nodeRelease(nodeStoreBound(), next);
+      next = NULL;
+    }
+    current->left   = NULL;
+    current->right  = NULL;
+    current->parent = NULL;
+    current->data   = {};
+    nodeDepsClear(current);
+
+    if (isAlloced)
+      nodeFree(current);
+    if (nodeCount)
+      (*nodeCount)--;
+    current = next;
+  }
 
   return OK;
 }
 
+//Arena nodes go back to the arena they came from, whichever is bound
+void nodeFree(TreeNode* node) {
+  if (!node)
+    return;
+  nodeDepsClear(node);
+  if (node->flags & NODE_FROM_ARENA)
+    nodeArenaPut(node->arena, node);
+  else
+    free(node);
+}
+
 Error countNodesCallback(unused TreeNode* node, 
                          void* data, 
                          unused uint level) {
@@ -325,7 +501,7 @@ Error countNodesCallback(unused TreeNode* node,
 // here non-zero return is treated as found variable
 Error findVariableCallback(TreeNode* node, void* data, 
                            unused uint level) {
-  if (data)
+  if (!data)
     return OK; //nothing to find
 
   size_t* index = (size_t*)data;
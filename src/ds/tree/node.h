@@ -4,9 +4,11 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <math.h>
 #include <sys/types.h>
 #include "ds/tree/nodetype.h"
+#include "ds/tree/arena.h"
 #include "error/error.h"
 
 union NodeValue {
@@ -20,11 +22,30 @@ struct NodeUnit {
   NodeValue value;
 };
 
+enum NodeFlag {
+  NODE_FROM_ARENA = 1 << 0, //never free()'d, goes back to its NodeArena instead
+  NODE_INTERNED   = 1 << 1, //lives in a NodeStore, may have many parents
+  NODE_DEPS         = 1 << 2, //deps is up to date, see ds/tree/deps.h
+  NODE_DEPS_SPILLED = 1 << 3, //deps is in spill rather than bits
+};
+
+struct VarSetSpill;
+
+///Indices of the variables a subtree contains
+union VarSet {
+  uint64_t     bits;  //while every index is below VAR_SET_INLINE_BITS
+  VarSetSpill* spill; //sparse and shared, see ds/tree/deps.cpp
+};
+
 struct TreeNode {
-  NodeUnit  data   = {};
+  NodeUnit  data     = {};
+  uint      flags    = 0;
+  uint      refCount = 0; //only meaningful for NODE_INTERNED nodes
+  VarSet    deps     = {};
   TreeNode* parent = NULL;
   TreeNode* left   = NULL;
   TreeNode* right  = NULL;
+  NodeArena* arena = NULL; //owner of a NODE_FROM_ARENA node
 };
 
 Error nodeInit(TreeNode* node, NodeUnit data, TreeNode* parent = NULL,
@@ -32,6 +53,10 @@ Error nodeInit(TreeNode* node, NodeUnit data, TreeNode* parent = NULL,
 TreeNode* nodeAlloc(NodeUnit data, TreeNode* parent = NULL,
                     TreeNode* left = NULL, TreeNode* right = NULL,
                     Error* status = NULL);
+///Raw zeroed storage from the bound arena (or the heap), bypasses the bound store
+TreeNode* nodeAllocBlank(Error* status = NULL);
+///Counterpart of nodeAllocBlank(), doesn't care about children or references
+void nodeFree(TreeNode* node);
 
 typedef Error (*callback_f)(TreeNode* node, void* data, uint level);
 
@@ -60,10 +85,16 @@ Error findVariableCallback(TreeNode* node, void* data, uint level);
 Error nodeChangeChild(TreeNode* parent, TreeNode* child, TreeNode* newChild,
                       size_t* nodeCount);
 
-///Note: doesnt copy the parent field but instead assigns newParent as copy's parent
+///Note: doesnt copy the parent field but instead assigns newParent as copy's parent.
+///Interned nodes aren't copied at all, they just get one more reference
 TreeNode*  nodeCopy(TreeNode* srcNode, TreeNode* newParent, Error* status = NULL);
+//Interned nodes have no single parent, so they are skipped
 void nodeFixParents(TreeNode* node);
-Error nodeOptimize(TreeNode** node);
+///Folds constants and drops neutral operands (x*1, x+0, x^1...) in one
+///bottom-up pass. Every node it frees is subtracted from *nodeCount
+Error nodeOptimize(TreeNode** node, size_t* nodeCount = NULL);
+///Structural comparison, parents aren't compared
+bool nodeEqual(const TreeNode* a, const TreeNode* b);
 
 Error  nodeDelete(TreeNode* node, bool isAlloced = false, size_t* nodeCount = NULL);
 Error nodeDestroy(TreeNode* node, bool isAlloced = false, size_t* nodeCount = NULL);
@@ -42,17 +42,98 @@ const OpTypeInfo* parseOpType(OpType t) {
          : &OP_TYPES[t];
 }
 
-//PERF: I know this is linear. I dont care. 
-//Better than manual written cmps and easier than a new dt struct
-int getOpType(const char* str) {
-  for (int i = 0; (size_t)i < OP_TYPES_SIZE; i++) {
-    const OpTypeInfo* t = parseOpType((OpType)i);
-    if (!t) continue;
-    if ((t->str && strcmp(str, t->str) == 0) || 
-        (t->alt && strcmp(str, t->alt) == 0)) 
-      return (OpType)i;
+//Every name and alias of OP_TYPE_LIST, for the name lookup below
+struct OpName {
+  const char* str = NULL;
+  size_t length = 0;
+  int op = -1;
+};
+
+static constexpr size_t opNameLength(const char* str) {
+  size_t length = 0;
+  while (str && str[length])
+    length++;
+  return length;
+}
+
+static constexpr OpName OP_NAMES[] = {
+  #define X(enm, s, aS, ...)                  \
+    {.str = s,  .length = opNameLength(s),  .op = enm}, \
+    {.str = aS, .length = opNameLength(aS), .op = enm},
+  OP_TYPE_LIST()
+  #undef X
+};
+
+static constexpr size_t OP_NAMES_SIZE = sizeof(OP_NAMES) / sizeof(OP_NAMES[0]);
+static const size_t OP_NAME_SLOTS = 64; //power of 2, comfortably more than names
+
+static constexpr size_t opNameMaxLength() {
+  size_t max = 0;
+  for (size_t i = 0; i < OP_NAMES_SIZE; i++)
+    if (OP_NAMES[i].length > max)
+      max = OP_NAMES[i].length;
+  return max;
+}
+
+static constexpr size_t OP_NAME_MAX_LENGTH = opNameMaxLength();
+
+static constexpr size_t opNameHash(const char* str, size_t length, uint seed) {
+  uint h = seed ^ (uint)length;
+  for (size_t i = 0; i < length; i++)
+    h = h * 31 + (unsigned char)str[i];
+  return (h ^ (h >> 5)) & (OP_NAME_SLOTS - 1);
+}
+
+//Perfect hash: OP_NAMES index by slot, slots no name hashes to are -1
+struct OpNameTable {
+  uint seed = 0;
+  int slots[OP_NAME_SLOTS] = {};
+  bool isValid = false;
+};
+
+//Tries seeds until no two names share a slot
+static constexpr OpNameTable opNameTableBuild() {
+  OpNameTable table = {};
+  for (uint seed = 0; seed < 1024 && !table.isValid; seed++) {
+    table.seed = seed;
+    table.isValid = true;
+    for (size_t slot = 0; slot < OP_NAME_SLOTS; slot++)
+      table.slots[slot] = -1;
+    for (size_t i = 0; i < OP_NAMES_SIZE && table.isValid; i++) {
+      if (!OP_NAMES[i].str)
+        continue;
+      size_t slot = opNameHash(OP_NAMES[i].str, OP_NAMES[i].length, seed);
+      if (table.slots[slot] >= 0)
+        table.isValid = false;
+      else
+        table.slots[slot] = (int)i;
+    }
   }
-  return -1;
+  return table;
+}
+
+static constexpr OpNameTable OP_NAME_TABLE = opNameTableBuild();
+static_assert(OP_NAME_TABLE.isValid, "no perfect hash for the OP_TYPE_LIST() names, "
+                                     "raise OP_NAME_SLOTS");
+
+int getOpType(const char* str) {
+  if (!str)
+    return -1;
+  return getOpType(str, strlen(str));
+}
+
+int getOpType(const char* str, size_t length) {
+  if (!str ||
+      !length ||
+      length > OP_NAME_MAX_LENGTH)
+    return -1;
+
+  int i = OP_NAME_TABLE.slots[opNameHash(str, length, OP_NAME_TABLE.seed)];
+  if (i < 0 ||
+      OP_NAMES[i].length != length ||
+      memcmp(OP_NAMES[i].str, str, length) != 0)
+    return -1;
+  return OP_NAMES[i].op;
 }
 
 double applyOperation(OpType type, double a, double b) {
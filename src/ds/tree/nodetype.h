@@ -64,7 +64,10 @@ struct OpTypeInfo {
 };
 
 const OpTypeInfo* parseOpType(OpType type);
+///-1 if string is neither a name nor an alias of an op. The lookup is
+///a perfect hash built at compile time from OP_TYPE_LIST
 int getOpType(const char* string);
+int getOpType(const char* string, size_t length);
 ///Applies appropriate operation regarding a and b and returns the result.
 ///If the operation doesn't require a second parameter (e.g. cos(x)) then leave b as NAN
 ///or use default value for b as NAN
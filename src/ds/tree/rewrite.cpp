@@ -0,0 +1,783 @@
+#include "ds/tree/rewrite.h"
+#include "ds/tree/store.h"
+#include "ds/tree/deps.h"
+#include "ds/stack/stack.h"
+#include "misc/util.h"
+#include <assert.h>
+
+//Op names and operand counts for the rule compiler, straight from OP_TYPE_LIST
+static constexpr const char* RULE_OP_STRS[] = {
+  #define X(enm, s, ...) s,
+  OP_TYPE_LIST()
+  #undef X
+};
+
+static constexpr uint RULE_OP_ARGCS[] = {
+  #define X(enm, s, aS, aC, ...) aC,
+  OP_TYPE_LIST()
+  #undef X
+};
+
+static constexpr size_t RULE_OP_COUNT = sizeof(RULE_OP_ARGCS) / sizeof(RULE_OP_ARGCS[0]);
+static const size_t RULE_MAX_SYMBOLS    = 16;
+static const size_t RULE_TREE_MAX_NODES = 128;
+
+//Patterns and results are compiled into preorder symbol strings
+enum RuleSymbolKind {
+  RULE_SYMBOL_OP,   //op node, its operands follow
+  RULE_SYMBOL_NUM,  //number
+  RULE_SYMBOL_SLOT, //any subtree, bound to the next slot (in results: that slot)
+  RULE_SYMBOL_SAME, //subtree equal to an already bound slot
+};
+
+struct RuleSymbol {
+  RuleSymbolKind kind = RULE_SYMBOL_OP;
+  uint value = 0; //op or slot
+  double num = 0;
+};
+
+struct RuleProgram {
+  RuleSymbol pattern[RULE_MAX_SYMBOLS] = {};
+  size_t patternSize = 0;
+  RuleSymbol result[RULE_MAX_SYMBOLS] = {};
+  size_t resultSize = 0;
+};
+
+///Discrimination tree: a trie over the patterns' preorder symbols.
+///Patterns sharing a prefix share the path, so matching a node walks
+///the trie once instead of trying every rule in turn
+struct RuleTreeNode {
+  RuleSymbol symbol = {};
+  int firstChild  = -1;
+  int nextSibling = -1;
+  int rule = -1; //pattern that ends here
+};
+
+struct RuleTree {
+  RuleTreeNode nodes[RULE_TREE_MAX_NODES] = {};
+  size_t count = 0;
+  int roots[RULE_OP_COUNT] = {}; //trie node of the patterns' top op, -1 if none
+  RuleProgram programs[REWRITE_RULE_COUNT] = {};
+  bool isValid = true;
+};
+
+//Only used at compile time
+struct RuleParser {
+  const char* str = NULL;
+  size_t pos = 0;
+  char letters[REWRITE_MAX_SLOTS] = {};
+  size_t letterCount = 0;
+};
+
+static const char* const RULE_NAMES[] = {
+  #define X(enm, ...) #enm,
+  REWRITE_RULE_LIST()
+  #undef X
+};
+
+static const char* const RULE_PATTERNS[] = {
+  #define X(enm, pattern, ...) pattern,
+  REWRITE_RULE_LIST()
+  #undef X
+};
+
+static const char* const RULE_RESULTS[] = {
+  #define X(enm, pattern, result, ...) result,
+  REWRITE_RULE_LIST()
+  #undef X
+};
+
+static const RewriteSet RULE_SETS[] = {
+  #define X(enm, pattern, result, set) set,
+  REWRITE_RULE_LIST()
+  #undef X
+};
+
+static constexpr bool ruleSymbolEqual(const RuleSymbol& a, const RuleSymbol& b) {
+  return a.kind  == b.kind  &&
+         a.value == b.value &&
+         !(a.num < b.num) && !(b.num < a.num);
+}
+
+static constexpr void ruleSkipSpaces(RuleParser* p) {
+  while (p->str[p->pos] == ' ')
+    p->pos++;
+}
+
+static constexpr int ruleOpByName(const char* str, size_t length) {
+  for (size_t op = 0; op < RULE_OP_COUNT; op++) {
+    const char* name = RULE_OP_STRS[op];
+    size_t k = 0;
+    while (k < length && name[k] && name[k] == str[k])
+      k++;
+    if (k == length && !name[k])
+      return (int)op;
+  }
+  return -1;
+}
+
+static constexpr bool ruleParseTerm(RuleParser* p, RuleSymbol* out, size_t* size,
+                                    bool isResult) {
+  ruleSkipSpaces(p);
+  if (*size >= RULE_MAX_SYMBOLS)
+    return false;
+
+  char c = p->str[p->pos];
+  if (c == '(') {
+    p->pos++;
+    size_t begin = p->pos;
+    while (p->str[p->pos] &&
+           p->str[p->pos] != ' ' &&
+           p->str[p->pos] != ')')
+      p->pos++;
+    int op = ruleOpByName(p->str + begin, p->pos - begin);
+    if (op < 0)
+      return false;
+    out[(*size)++] = {.kind = RULE_SYMBOL_OP, .value = (uint)op};
+    for (uint k = 0; k < RULE_OP_ARGCS[op]; k++)
+      if (!ruleParseTerm(p, out, size, isResult))
+        return false;
+    ruleSkipSpaces(p);
+    if (p->str[p->pos] != ')')
+      return false;
+    p->pos++;
+    return true;
+  }
+
+  if ((c >= '0' && c <= '9') ||
+      (c == '-' && p->str[p->pos + 1] >= '0' && p->str[p->pos + 1] <= '9')) {
+    bool isNegative = (c == '-');
+    if (isNegative)
+      p->pos++;
+    double num = 0;
+    double scale = 0;
+    for (; (p->str[p->pos] >= '0' && p->str[p->pos] <= '9') ||
+           p->str[p->pos] == '.'; p->pos++) {
+      if (p->str[p->pos] == '.') {
+        scale = 1;
+        continue;
+      }
+      num = num * 10 + (p->str[p->pos] - '0');
+      scale *= 10;
+    }
+    if (scale > 0)
+      num /= scale;
+    out[(*size)++] = {.kind = RULE_SYMBOL_NUM, .num = isNegative ? -num : num};
+    return true;
+  }
+
+  if (c >= 'a' && c <= 'z') {
+    p->pos++;
+    for (size_t k = 0; k < p->letterCount; k++) {
+      if (p->letters[k] == c) {
+        out[(*size)++] = {.kind = isResult ? RULE_SYMBOL_SLOT : RULE_SYMBOL_SAME,
+                          .value = (uint)k};
+        return true;
+      }
+    }
+    if (isResult ||
+        p->letterCount >= REWRITE_MAX_SLOTS)
+      return false;
+    p->letters[p->letterCount] = c;
+    out[(*size)++] = {.kind = RULE_SYMBOL_SLOT, .value = (uint)p->letterCount++};
+    return true;
+  }
+
+  return false;
+}
+
+static constexpr bool ruleCompile(const char* pattern, const char* result,
+                                  RuleProgram* program) {
+  RuleParser p = {.str = pattern};
+  if (!ruleParseTerm(&p, program->pattern, &program->patternSize, false) ||
+      program->pattern[0].kind != RULE_SYMBOL_OP)
+    return false;
+  ruleSkipSpaces(&p);
+  if (p.str[p.pos])
+    return false;
+
+  p.str = result;
+  p.pos = 0;
+  if (!ruleParseTerm(&p, program->result, &program->resultSize, true))
+    return false;
+  ruleSkipSpaces(&p);
+  return !p.str[p.pos];
+}
+
+static constexpr int ruleTreeAdd(RuleTree* tree, int parent, const RuleSymbol& symbol) {
+  int last = -1;
+  for (int child = tree->nodes[parent].firstChild; child >= 0;
+       child = tree->nodes[child].nextSibling) {
+    if (ruleSymbolEqual(tree->nodes[child].symbol, symbol))
+      return child;
+    last = child;
+  }
+  if (tree->count >= RULE_TREE_MAX_NODES)
+    return -1;
+
+  int node = (int)tree->count++;
+  tree->nodes[node].symbol = symbol;
+  if (last < 0)
+    tree->nodes[parent].firstChild = node;
+  else
+    tree->nodes[last].nextSibling = node;
+  return node;
+}
+
+static constexpr RuleTree ruleTreeBuild() {
+  const char* patterns[] = {
+    #define X(enm, pattern, ...) pattern,
+    REWRITE_RULE_LIST()
+    #undef X
+  };
+  const char* results[] = {
+    #define X(enm, pattern, result, ...) result,
+    REWRITE_RULE_LIST()
+    #undef X
+  };
+
+  RuleTree tree = {};
+  for (size_t op = 0; op < RULE_OP_COUNT; op++)
+    tree.roots[op] = -1;
+
+  for (size_t rule = 0; rule < REWRITE_RULE_COUNT; rule++) {
+    RuleProgram* program = &tree.programs[rule];
+    if (!ruleCompile(patterns[rule], results[rule], program)) {
+      tree.isValid = false;
+      continue;
+    }
+
+    uint op = program->pattern[0].value;
+    if (tree.roots[op] < 0) {
+      tree.roots[op] = (int)tree.count++;
+      tree.nodes[tree.roots[op]].symbol = program->pattern[0];
+    }
+    int node = tree.roots[op];
+    for (size_t k = 1; k < program->patternSize && node >= 0; k++)
+      node = ruleTreeAdd(&tree, node, program->pattern[k]);
+
+    //out of nodes or the same pattern twice
+    if (node < 0 ||
+        tree.nodes[node].rule >= 0)
+      tree.isValid = false;
+    else
+      tree.nodes[node].rule = (int)rule;
+  }
+  return tree;
+}
+
+//nodeOptimize() applies neutral rules without building anything:
+//they may only give a number or one of the node's own operands
+static constexpr bool ruleNeutralAreLocal(const RuleTree& tree) {
+  const RewriteSet sets[] = {
+    #define X(enm, pattern, result, set) set,
+    REWRITE_RULE_LIST()
+    #undef X
+  };
+
+  for (size_t rule = 0; rule < REWRITE_RULE_COUNT; rule++) {
+    const RuleProgram& program = tree.programs[rule];
+    if (!(sets[rule] & REWRITE_NEUTRAL))
+      continue;
+    if (program.resultSize != 1 ||
+        program.result[0].kind == RULE_SYMBOL_OP ||
+        program.patternSize != 1 + RULE_OP_ARGCS[program.pattern[0].value])
+      return false;
+  }
+  return true;
+}
+
+static constexpr RuleTree RULE_TREE = ruleTreeBuild();
+static_assert(RULE_TREE.isValid, "a REWRITE_RULE_LIST() rule doesn't compile");
+static_assert(ruleNeutralAreLocal(RULE_TREE),
+              "REWRITE_NEUTRAL rules must give a number or an operand");
+
+//Folding and a neutral rule only disagree around nan and inf, and which goes
+//first at a node follows the old nodeOptimize(). It alternated whole-tree
+//folding and neutral passes until nothing changed, so a number that was there
+//from the start folds, but one a neutral rule has just made meets the neutral
+//rules of its parent first:
+//  0/0      -> nan  folded
+//  (x*0)/0  -> 0    (/ 0 x) before folding, that 0 is fresh
+//  x^(1/3)  stays   a 1/n right under a pow is a root, it isn't folded at all
+//nodeRewrite() treats every number as fresh
+enum SimplifyPhase {
+  SIMPLIFY_PHASE_FOLD,
+  SIMPLIFY_PHASE_NEUTRAL,
+};
+
+static const SimplifyPhase SIMPLIFY_ORDER[2][2] = {
+  {SIMPLIFY_PHASE_FOLD,    SIMPLIFY_PHASE_NEUTRAL}, //operands as they were
+  {SIMPLIFY_PHASE_NEUTRAL, SIMPLIFY_PHASE_FOLD},    //isFresh
+};
+
+struct RuleMatchState {
+  TreeNode* pending[RULE_MAX_SYMBOLS] = {}; //subtrees left to match, next on top
+  size_t pendingCount = 0;
+  TreeNode* slots[REWRITE_MAX_SLOTS] = {};
+  uint sets = 0;
+  RewriteMatch* best = NULL;
+};
+
+struct RewriteState {
+  uint sets = 0;
+  RewriteStats* stats = NULL;
+  size_t* nodeCount = NULL;
+  Error err = OK;
+};
+
+static bool ruleSymbolMatch(const RuleSymbol* symbol, TreeNode* term, RuleMatchState* state);
+static void ruleTreeWalk(int index, RuleMatchState* state);
+static Error rewriteWalk(TreeNode** node, bool underPow, RewriteState* state);
+static TreeNode* rewriteLocal(TreeNode* node, bool underPow, RewriteState* state);
+static TreeNode* rewriteBuild(const RuleProgram* program, size_t* pos,
+                              const RewriteMatch* match, bool* isUsed,
+                              RewriteState* state);
+static TreeNode* rewriteNode(NodeUnit data, TreeNode* left, TreeNode* right,
+                             RewriteState* state);
+static void rewriteDetach(TreeNode* node);
+static void rewriteToNum(TreeNode* node, double value, RewriteState* state);
+static bool rewriteIsRoot(const TreeNode* node);
+
+const char* rewriteRuleName(RewriteRule rule) {
+  return (rule < 0 || rule >= REWRITE_RULE_COUNT)
+         ? NULL
+         : RULE_NAMES[rule];
+}
+
+RewriteSet rewriteRuleSet(RewriteRule rule) {
+  return (rule < 0 || rule >= REWRITE_RULE_COUNT)
+         ? (RewriteSet)0
+         : RULE_SETS[rule];
+}
+
+bool rewriteMatch(TreeNode* node, uint sets, RewriteMatch* match) {
+  if (!IS_OP(node) ||
+      !match ||
+      (size_t)node->data.value.op >= RULE_OP_COUNT)
+    return false;
+  int root = RULE_TREE.roots[node->data.value.op];
+  if (root < 0)
+    return false;
+
+  *match = {};
+  RuleMatchState state = {
+    .sets = sets,
+    .best = match
+  };
+  if (!ruleSymbolMatch(&RULE_TREE.nodes[root].symbol, node, &state))
+    return false;
+  ruleTreeWalk(root, &state);
+  return match->rule != REWRITE_RULE_COUNT;
+}
+
+RewriteResult rewriteResultOf(const RewriteMatch* match) {
+  RewriteResult result = {};
+  if (!match ||
+      match->rule >= REWRITE_RULE_COUNT)
+    return result;
+
+  const RuleProgram* program = &RULE_TREE.programs[match->rule];
+  if (program->resultSize != 1)
+    return result;
+  if (program->result[0].kind == RULE_SYMBOL_NUM) {
+    result.kind = REWRITE_RESULT_NUM;
+    result.num  = program->result[0].num;
+  } else if (program->result[0].kind == RULE_SYMBOL_SLOT) {
+    result.kind = REWRITE_RESULT_SLOT;
+    result.slot = match->slots[program->result[0].value];
+  }
+  return result;
+}
+
+SimplifyStep rewriteSimplifyStep(TreeNode* node, bool underPow, bool isFresh,
+                                 uint sets) {
+  SimplifyStep step = {};
+  if (!IS_OP(node))
+    return step;
+  OpType opType = node->data.value.op;
+  const OpTypeInfo* i = parseOpType(opType);
+  assert(i);
+
+  bool isFoldable = (i->argCount == 1)
+                    ? (!node->left &&
+                       IS_NUM(node->right) && !isnan(node->right->data.value.num))
+                    : (IS_NUM(node->left)  && !isnan(node->left->data.value.num) &&
+                       IS_NUM(node->right) && !isnan(node->right->data.value.num));
+  if (underPow &&
+      rewriteIsRoot(node))
+    isFoldable = false;
+
+  for (size_t k = 0; k < sizer(SIMPLIFY_ORDER[isFresh]); k++) {
+    RewriteMatch match = {};
+    switch (SIMPLIFY_ORDER[isFresh][k]) {
+      case SIMPLIFY_PHASE_FOLD:
+        if (!isFoldable)
+          break;
+        step.action      = SIMPLIFY_FOLD;
+        step.result.kind = REWRITE_RESULT_NUM;
+        step.result.num  = (i->argCount == 1)
+                           ? applyOperation(opType, node->right->data.value.num)
+                           : applyOperation(opType, node->left->data.value.num,
+                                                    node->right->data.value.num);
+        return step;
+      case SIMPLIFY_PHASE_NEUTRAL:
+        if (!(sets & REWRITE_NEUTRAL) ||
+            !rewriteMatch(node, sets & REWRITE_NEUTRAL, &match))
+          break;
+        step.action = SIMPLIFY_NEUTRAL;
+        step.rule   = match.rule;
+        step.result = rewriteResultOf(&match);
+        return step;
+      default:
+        break;
+    }
+  }
+  return step;
+}
+
+//Every rule of the node's subtree is a candidate at once, the listed
+//first one that matches completely wins
+static void ruleTreeWalk(int index, RuleMatchState* state) {
+  assert(state);
+
+  const RuleTreeNode* trieNode = &RULE_TREE.nodes[index];
+  if (trieNode->rule >= 0 &&
+      !state->pendingCount &&
+      (state->sets & (uint)RULE_SETS[trieNode->rule]) &&
+      trieNode->rule < (int)state->best->rule) {
+    state->best->rule = (RewriteRule)trieNode->rule;
+    for (size_t k = 0; k < REWRITE_MAX_SLOTS; k++)
+      state->best->slots[k] = state->slots[k];
+  }
+  if (!state->pendingCount)
+    return;
+
+  TreeNode* term = state->pending[--state->pendingCount];
+  for (int child = trieNode->firstChild; child >= 0;
+       child = RULE_TREE.nodes[child].nextSibling) {
+    size_t pendingCount = state->pendingCount;
+    if (ruleSymbolMatch(&RULE_TREE.nodes[child].symbol, term, state))
+      ruleTreeWalk(child, state);
+    state->pendingCount = pendingCount;
+  }
+  state->pending[state->pendingCount++] = term;
+}
+
+static bool ruleSymbolMatch(const RuleSymbol* symbol, TreeNode* term, RuleMatchState* state) {
+  assert(symbol && state);
+
+  switch (symbol->kind) {
+    case RULE_SYMBOL_OP: {
+      if (!OF_OP(term, (OpType)symbol->value))
+        return false;
+      //operands go on top in reverse, so the left one is matched first
+      if (RULE_OP_ARGCS[symbol->value] == 2) {
+        if (!term->left ||
+            !term->right)
+          return false;
+        state->pending[state->pendingCount++] = term->right;
+        state->pending[state->pendingCount++] = term->left;
+      } else {
+        if (!term->right)
+          return false;
+        state->pending[state->pendingCount++] = term->right;
+      }
+      return true;
+    }
+    case RULE_SYMBOL_NUM:
+      return OF_NUM(term, symbol->num);
+    case RULE_SYMBOL_SLOT:
+      state->slots[symbol->value] = term;
+      return true;
+    case RULE_SYMBOL_SAME:
+      return nodeEqual(state->slots[symbol->value], term);
+    default:
+      return false;
+  }
+}
+
+Error nodeRewrite(TreeNode** node, uint sets, RewriteStats* stats, size_t* nodeCount) {
+  if (!node ||
+      !*node)
+    return InvalidParameters;
+  if (IS_INTERNED(*node))
+    return nodeStoreOptimize(nodeStoreBound(), node);
+
+  RewriteStats ignored = {};
+  RewriteState state = {
+    .sets      = sets,
+    .stats     = stats ? stats : &ignored,
+    .nodeCount = nodeCount,
+    .err       = OK
+  };
+  TreeNode* parent = (*node)->parent;
+  TreeNode* result = *node;
+  Error err = rewriteWalk(&result, OF_OP(parent, OP_POW), &state);
+  if (result != *node &&
+      parent) {
+    if (parent->left == *node)
+      parent->left  = result;
+    else if (parent->right == *node)
+      parent->right = result;
+  }
+  nodeDepsInvalidate(parent);
+  result->parent = parent;
+  *node = result;
+  return err
+         ? err
+         : state.err;
+}
+
+Error rewriteStatsPrint(FILE* sink, const RewriteStats* stats) {
+  if (!sink ||
+      !stats)
+    return InvalidParameters;
+
+  fprintf(sink, "%zu nodes matched, %zu constants folded\n",
+          stats->matched, stats->folded);
+  for (size_t rule = 0; rule < REWRITE_RULE_COUNT; rule++) {
+    if (!stats->fired[rule])
+      continue;
+    fprintf(sink, "%-20s %-36s -> %-14s %zu\n", RULE_NAMES[rule],
+            RULE_PATTERNS[rule], RULE_RESULTS[rule], stats->fired[rule]);
+  }
+  return OK;
+}
+
+//Postorder with an explicit stack, like nodeSimplify(): a node is matched
+//once its operands are final and its result goes into the parent right away.
+//A rule failing only sets state->err, the walk still puts every node back
+static Error rewriteWalk(TreeNode** node, bool underPow, RewriteState* state) {
+  assert(node && *node && state);
+
+  NodeStack stack = {};
+  Error err = nodeStackPush(&stack, {.node = *node});
+  while (!err &&
+         stack.count) {
+    NodeFrame* frame = nodeStackTop(&stack);
+    TreeNode* current = frame->node;
+    if (IS_OP(current) &&
+        !IS_INTERNED(current) &&
+        frame->stage < 2) {
+      TreeNode* operand = frame->stage++
+                          ? current->right
+                          : current->left;
+      if (operand)
+        err = nodeStackPush(&stack, {.node = operand, .other = current});
+      continue;
+    }
+
+    TreeNode* parent = frame->other;
+    TreeNode* result = current;
+    if (IS_OP(current) &&
+        !IS_INTERNED(current)) {
+      result = rewriteLocal(current, parent ? OF_OP(parent, OP_POW) : underPow, state);
+      if (!IS_INTERNED(result))
+        nodeDepsUpdate(result);
+    }
+    nodeStackPop(&stack);
+
+    if (!parent) {
+      *node = result;
+      continue;
+    }
+    if (parent->left == current)
+      parent->left  = result;
+    else
+      parent->right = result;
+    if (!IS_INTERNED(result))
+      result->parent = parent;
+  }
+
+  //whatever is still on the stack has operands that changed under it
+  if (err)
+    nodeDepsInvalidate(nodeStackTop(&stack)->node);
+  nodeStackDestroy(&stack);
+  return err;
+}
+
+//Operands of node are final
+static TreeNode* rewriteLocal(TreeNode* node, bool underPow, RewriteState* state) {
+  assert(state);
+
+  while (IS_OP(node) &&
+         !IS_INTERNED(node) &&
+         !state->err) {
+    //neutral rules and folding first, the rest only for what neither takes
+    state->stats->matched++;
+    SimplifyStep step = rewriteSimplifyStep(node, underPow, true, state->sets);
+    if (step.action == SIMPLIFY_FOLD) {
+      rewriteToNum(node, step.result.num, state);
+      state->stats->folded++;
+      return node;
+    }
+    RewriteMatch match = {};
+    if (step.action == SIMPLIFY_NEUTRAL) {
+      match.rule = step.rule;
+    } else if (!(state->sets & ~(uint)REWRITE_NEUTRAL) ||
+               !rewriteMatch(node, state->sets & ~(uint)REWRITE_NEUTRAL, &match)) {
+      return node;
+    }
+    state->stats->fired[match.rule]++;
+
+    RewriteResult result = step.action == SIMPLIFY_NEUTRAL
+                           ? step.result
+                           : rewriteResultOf(&match);
+    switch (result.kind) {
+      case REWRITE_RESULT_NUM:
+        rewriteToNum(node, result.num, state);
+        return node;
+      case REWRITE_RESULT_SLOT: {
+        TreeNode* kept = result.slot;
+        if (IS_INTERNED(kept))
+          kept = nodeCopy(kept, NULL);
+        else
+          rewriteDetach(kept);
+        nodeDestroy(node, true, state->nodeCount);
+        node = kept;
+        //already final, only a 1/n root can fold now that its parent changed
+        if (!rewriteIsRoot(node))
+          return node;
+        break;
+      }
+      case REWRITE_RESULT_TREE: {
+        const RuleProgram* program = &RULE_TREE.programs[match.rule];
+        bool isUsed[REWRITE_MAX_SLOTS] = {};
+        size_t pos = 0;
+        TreeNode* built = rewriteBuild(program, &pos, &match, isUsed, state);
+        if (!built)
+          return node;
+        nodeDestroy(node, true, state->nodeCount);
+        return built;
+      }
+      default:
+        return node;
+    }
+  }
+
+  return node;
+}
+
+//Builds the result of a rule, every new op node is simplified as soon as
+//its operands are there. A bound subtree is moved into the result the
+//first time it is used and copied after that
+static TreeNode* rewriteBuild(const RuleProgram* program, size_t* pos,
+                              const RewriteMatch* match, bool* isUsed,
+                              RewriteState* state) {
+  assert(program && pos && match && isUsed && state);
+
+  const RuleSymbol* symbol = &program->result[(*pos)++];
+  switch (symbol->kind) {
+    case RULE_SYMBOL_NUM:
+      return rewriteNode({.type = NUM_TYPE, .value = {.num = symbol->num}},
+                         NULL, NULL, state);
+    case RULE_SYMBOL_SLOT: {
+      TreeNode* slot = match->slots[symbol->value];
+      if (isUsed[symbol->value] ||
+          IS_INTERNED(slot)) {
+        Error err = OK;
+        TreeNode* copy = nodeCopy(slot, NULL, &err);
+        if (err) {
+          state->err = err;
+          return NULL;
+        }
+        if (state->nodeCount && !IS_INTERNED(copy))
+          nodeTraverse(copy, .infix = countNodesCallback, .infixData = state->nodeCount);
+        return copy;
+      }
+      isUsed[symbol->value] = true;
+      rewriteDetach(slot);
+      return slot;
+    }
+    case RULE_SYMBOL_OP: {
+      TreeNode* left  = NULL;
+      TreeNode* right = NULL;
+      if (RULE_OP_ARGCS[symbol->value] == 2)
+        left = rewriteBuild(program, pos, match, isUsed, state);
+      right = rewriteBuild(program, pos, match, isUsed, state);
+      if (state->err) {
+        nodeDestroy(left,  true, state->nodeCount);
+        nodeDestroy(right, true, state->nodeCount);
+        return NULL;
+      }
+
+      TreeNode* node = rewriteNode({.type = OP_TYPE, .value = {.op = (OpType)symbol->value}},
+                                   left, right, state);
+      if (!node) {
+        nodeDestroy(left,  true, state->nodeCount);
+        nodeDestroy(right, true, state->nodeCount);
+        return NULL;
+      }
+      bool isPow = (symbol->value == OP_POW);
+      if (left && !IS_INTERNED(left))
+        left->parent = node;
+      if (right && !IS_INTERNED(right))
+        right->parent = node;
+      //a 1/n operand stays a root only if it ends up under a pow
+      if (!isPow && rewriteIsRoot(node->left))
+        node->left  = rewriteLocal(node->left,  false, state);
+      if (!isPow && rewriteIsRoot(node->right))
+        node->right = rewriteLocal(node->right, false, state);
+      TreeNode* result = rewriteLocal(node, false, state);
+      if (result && !IS_INTERNED(result))
+        nodeDepsUpdate(result);
+      return result;
+    }
+    case RULE_SYMBOL_SAME:
+    default:
+      state->err = BadEnumItem;
+      return NULL;
+  }
+}
+
+//Always a plain node: rewriting works on trees even while a store is bound
+static TreeNode* rewriteNode(NodeUnit data, TreeNode* left, TreeNode* right,
+                             RewriteState* state) {
+  assert(state);
+
+  Error err = OK;
+  TreeNode* node = nodeAllocBlank(&err);
+  if (!err)
+    err = nodeInit(node, data, NULL, left, right);
+  if (err) {
+    nodeFree(node);
+    state->err = err;
+    return NULL;
+  }
+  if (state->nodeCount)
+    (*state->nodeCount)++;
+  return node;
+}
+
+static void rewriteDetach(TreeNode* node) {
+  assert(node);
+
+  TreeNode* parent = node->parent;
+  if (parent) {
+    if (parent->left == node)
+      parent->left = NULL;
+    else if (parent->right == node)
+      parent->right = NULL;
+  }
+  node->parent = NULL;
+}
+
+static void rewriteToNum(TreeNode* node, double value, RewriteState* state) {
+  assert(node && state);
+
+  nodeDestroy(node->left,  true, state->nodeCount);
+  nodeDestroy(node->right, true, state->nodeCount);
+  node->left  = NULL;
+  node->right = NULL;
+  node->data.type      = NUM_TYPE;
+  node->data.value.num = value;
+  nodeDepsUpdate(node);
+}
+
+//A 1/n that was kept as a root under a pow
+static bool rewriteIsRoot(const TreeNode* node) {
+  return OF_OP(node, OP_DIV) &&
+         OF_NUM(node->left, 1) &&
+         IS_NUM(node->right);
+}
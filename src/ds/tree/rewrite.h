@@ -0,0 +1,125 @@
+#ifndef REWRITE_H
+#define REWRITE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "ds/tree/node.h"
+
+//NOTE:
+//X(enum, "pattern", "result", set)
+//Both are prefix: (op args...) with op being a str from OP_TYPE_LIST.
+//A number matches numbers that are doubleEqual() to it, a letter matches
+//any subtree and a letter used twice only matches equal subtrees.
+//If several rules match, the one listed first wins.
+//REWRITE_DOMAIN rules take x > 0 for granted: at x = 0, x/x is 0/0 (nan) and
+//x^-1 * x is inf * 0, neither of which is 1
+#define REWRITE_RULE_LIST()                                                              \
+  X(RULE_MUL_ZERO_LEFT,  "(* 0 x)",                          "0",             REWRITE_NEUTRAL) \
+  X(RULE_MUL_ZERO_RIGHT, "(* x 0)",                          "0",             REWRITE_NEUTRAL) \
+  X(RULE_MUL_ONE_LEFT,   "(* 1 x)",                          "x",             REWRITE_NEUTRAL) \
+  X(RULE_MUL_ONE_RIGHT,  "(* x 1)",                          "x",             REWRITE_NEUTRAL) \
+  X(RULE_DIV_ZERO,       "(/ 0 x)",                          "0",             REWRITE_NEUTRAL) \
+  X(RULE_DIV_ONE,        "(/ x 1)",                          "x",             REWRITE_NEUTRAL) \
+  X(RULE_ADD_ZERO_LEFT,  "(+ 0 x)",                          "x",             REWRITE_NEUTRAL) \
+  X(RULE_ADD_ZERO_RIGHT, "(+ x 0)",                          "x",             REWRITE_NEUTRAL) \
+  X(RULE_SUB_ZERO,       "(- x 0)",                          "x",             REWRITE_NEUTRAL) \
+  X(RULE_POW_ZERO,       "(^ x 0)",                          "1",             REWRITE_NEUTRAL) \
+  X(RULE_POW_ONE_BASE,   "(^ 1 x)",                          "1",             REWRITE_NEUTRAL) \
+  X(RULE_POW_ZERO_BASE,  "(^ 0 x)",                          "0",             REWRITE_NEUTRAL) \
+  X(RULE_POW_ONE,        "(^ x 1)",                          "x",             REWRITE_NEUTRAL) \
+  X(RULE_SUB_SELF,       "(- x x)",                          "0",             REWRITE_ALGEBRA) \
+  X(RULE_DIV_SELF,       "(/ x x)",                          "1",             REWRITE_DOMAIN)  \
+  X(RULE_ADD_SELF,       "(+ x x)",                          "(* 2 x)",       REWRITE_ALGEBRA) \
+  X(RULE_MUL_POWS,       "(* (^ x a) (^ x b))",              "(^ x (+ a b))", REWRITE_DOMAIN)  \
+  X(RULE_MUL_POW_LEFT,   "(* (^ x a) x)",                    "(^ x (+ a 1))", REWRITE_DOMAIN)  \
+  X(RULE_MUL_POW_RIGHT,  "(* x (^ x a))",                    "(^ x (+ a 1))", REWRITE_DOMAIN)  \
+  X(RULE_MUL_SELF,       "(* x x)",                          "(^ x 2)",       REWRITE_ALGEBRA) \
+  X(RULE_DIV_POWS,       "(/ (^ x a) (^ x b))",              "(^ x (- a b))", REWRITE_DOMAIN)  \
+  X(RULE_NEG_NEG,        "(* -1 (* -1 x))",                  "x",             REWRITE_ALGEBRA) \
+  X(RULE_SIN_COS,        "(+ (^ (sin x) 2) (^ (cos x) 2))",  "1",             REWRITE_ALGEBRA) \
+  X(RULE_COS_SIN,        "(+ (^ (cos x) 2) (^ (sin x) 2))",  "1",             REWRITE_ALGEBRA) \
+  X(RULE_COSH_SINH,      "(- (^ (cosh x) 2) (^ (sinh x) 2))", "1",            REWRITE_ALGEBRA)
+
+enum RewriteRule {
+  #define X(enm, ...) enm,
+  REWRITE_RULE_LIST()
+  #undef X
+  REWRITE_RULE_COUNT
+};
+
+///Rules are grouped, the simplifiers pick the groups they use
+enum RewriteSet {
+  REWRITE_NEUTRAL = 1 << 0, //x*1, x+0, x^0...: what nodeOptimize() applies
+  REWRITE_ALGEBRA = 1 << 1, //identities for every finite x
+  REWRITE_DOMAIN  = 1 << 2, //identities for x > 0 only, asked for explicitly
+  REWRITE_DEFAULT = REWRITE_NEUTRAL | REWRITE_ALGEBRA, //what nodeRewrite() uses
+  REWRITE_ALL     = REWRITE_DEFAULT | REWRITE_DOMAIN,
+};
+
+const size_t REWRITE_MAX_SLOTS = 4;
+
+///Which rule matched and what its letters got bound to
+struct RewriteMatch {
+  RewriteRule rule = REWRITE_RULE_COUNT;
+  TreeNode* slots[REWRITE_MAX_SLOTS] = {};
+};
+
+///Result of a matched rule: a number, one of the bound subtrees or a new tree
+enum RewriteResultKind {
+  REWRITE_RESULT_NUM,
+  REWRITE_RESULT_SLOT,
+  REWRITE_RESULT_TREE,
+};
+
+struct RewriteResult {
+  RewriteResultKind kind = REWRITE_RESULT_TREE;
+  double num = NAN;             //REWRITE_RESULT_NUM
+  TreeNode* slot = NULL;        //REWRITE_RESULT_SLOT
+};
+
+struct RewriteStats {
+  size_t fired[REWRITE_RULE_COUNT] = {};
+  size_t folded  = 0; //constant subtrees replaced with their value
+  size_t matched = 0; //nodes looked up in the rule tree
+};
+
+const char* rewriteRuleName(RewriteRule rule);
+RewriteSet rewriteRuleSet(RewriteRule rule);
+
+///Matches node against every rule of sets at once (one walk of the
+///discrimination tree the rules are compiled into), returns false if none does
+bool rewriteMatch(TreeNode* node, uint sets, RewriteMatch* match);
+RewriteResult rewriteResultOf(const RewriteMatch* match);
+
+///What simplifying an op node whose operands are final comes down to
+enum SimplifyAction {
+  SIMPLIFY_KEEP,    //nothing applies
+  SIMPLIFY_FOLD,    //the operands are numbers, result.num is the value
+  SIMPLIFY_NEUTRAL, //rule (a neutral one) gives result, a number or an operand
+};
+
+struct SimplifyStep {
+  SimplifyAction action = SIMPLIFY_KEEP;
+  RewriteRule rule = REWRITE_RULE_COUNT;
+  RewriteResult result = {};
+};
+
+///The one local step of nodeOptimize(), nodeStoreOptimize() and nodeRewrite(),
+///trees and shared nodes alike. isFresh: a number operand was only just made
+///(or moved up) by a neutral rule, which decides whether folding or the rules
+///of sets & REWRITE_NEUTRAL go first, see SIMPLIFY_ORDER in rewrite.cpp
+SimplifyStep rewriteSimplifyStep(TreeNode* node, bool underPow, bool isFresh,
+                                 uint sets = REWRITE_NEUTRAL);
+
+///Bottom-up simplification with constant folding and every rule of sets.
+///A node is matched once its children are final, whatever a rule builds is
+///simplified as it is built, so there is no second pass. nodeCount, if given,
+///is kept up to date and stats counts what fired. Shared (interned) subtrees are left to nodeStoreOptimize()
+Error nodeRewrite(TreeNode** node, uint sets = REWRITE_DEFAULT,
+                  RewriteStats* stats = NULL, size_t* nodeCount = NULL);
+
+///One line per rule that fired
+Error rewriteStatsPrint(FILE* sink, const RewriteStats* stats);
+
+#endif
@@ -0,0 +1,675 @@
+#include "ds/tree/store.h"
+#include "ds/tree/rewrite.h"
+#include "ds/tree/deps.h"
+#include "ds/map/ptrmap.h"
+#include "ds/stack/stack.h"
+#include "misc/util.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+static thread_local NodeStore* BOUND_STORE = NULL;
+
+static const size_t MAX_LOAD_NUMERATOR   = 1;
+static const size_t MAX_LOAD_DENOMINATOR = 2;
+
+static ulong nodeKeyHash(NodeUnit data, const TreeNode* left, const TreeNode* right);
+static bool nodeKeyEqual(const TreeNode* node, NodeUnit data,
+                         const TreeNode* left, const TreeNode* right);
+static Error nodeStoreGrow(NodeStore* store);
+static void nodeStoreInsert(NodeStore* store, TreeNode* node);
+static void nodeStoreRemove(NodeStore* store, TreeNode* node);
+static bool nodeDropReference(NodeStore* store, TreeNode* node);
+
+static size_t nodeCountExpandedMemo(TreeNode* node, PtrMap* memo);
+static size_t nodeCountAdd(size_t a, size_t b);
+
+static TreeNode* optimizeShared(NodeStore* store, TreeNode* node,
+                                PtrMap* memo, Error* status);
+static TreeNode* optimizeSharedTake(PtrMap* memo, TreeNode* node, bool underPow,
+                                    bool* isFresh);
+static TreeNode* simplifyShared(NodeStore* store, OpType op,
+                                TreeNode* left, TreeNode* right, bool underPow,
+                                bool isFresh, bool* isResultFresh, Error* status);
+
+#define RETURN_WITH_STATUS(value, returnValue) \
+  {                                            \
+  if (status)                                  \
+    *status = value;                           \
+  return returnValue;                          \
+  }
+
+Error nodeStoreInit(NodeStore* store, size_t initialCapacity) {
+  if (!store ||
+      !initialCapacity)
+    return InvalidParameters;
+  if (store->table)
+    return AttemptedReinitialization;
+
+  size_t capacity = 1;
+  while (capacity < initialCapacity)
+    capacity <<= 1;
+
+  TreeNode** table = (TreeNode**)calloc(capacity, sizeof(TreeNode*));
+  if (!table)
+    return FailMemoryAllocation;
+
+  *store = {};
+  store->table = table;
+  store->capacity = capacity;
+  return OK;
+}
+
+NodeStore* nodeStoreAlloc(size_t initialCapacity, Error* status) {
+  NodeStore* store = (NodeStore*)calloc(1, sizeof(NodeStore));
+  if (!store)
+    RETURN_WITH_STATUS(FailMemoryAllocation, NULL);
+
+  Error err = nodeStoreInit(store, initialCapacity);
+  if (err) {
+    free(store);
+    RETURN_WITH_STATUS(err, NULL);
+  }
+  return store;
+}
+
+Error nodeStoreDestroy(NodeStore* store, bool isAlloced) {
+  if (!store)
+    return InvalidParameters;
+
+  if (BOUND_STORE == store)
+    BOUND_STORE = NULL;
+
+  for (size_t i = 0; i < store->capacity; i++) {
+    TreeNode* node = store->table[i];
+    if (!node)
+      continue;
+    //a plain child is owned by its only parent
+    if (node->left && !IS_INTERNED(node->left))
+      nodeDestroy(node->left, true);
+    if (node->right && !IS_INTERNED(node->right))
+      nodeDestroy(node->right, true);
+    nodeFree(node);
+  }
+  free(store->table);
+  *store = {};
+
+  if (isAlloced)
+    free(store);
+  return OK;
+}
+
+NodeStore* nodeStoreBind(NodeStore* store) {
+  NodeStore* prev = BOUND_STORE;
+  BOUND_STORE = store;
+  return prev;
+}
+
+NodeStore* nodeStoreBound() {
+  return BOUND_STORE;
+}
+
+TreeNode* nodeIntern(NodeStore* store, NodeUnit data,
+                     TreeNode* left, TreeNode* right,
+                     Error* status) {
+  if (!store ||
+      !store->table)
+    RETURN_WITH_STATUS(InvalidParameters, NULL);
+
+  store->stats.lookups++;
+  size_t mask = store->capacity - 1;
+  for (size_t i = nodeKeyHash(data, left, right) & mask;
+       store->table[i];
+       i = (i + 1) & mask) {
+    TreeNode* node = store->table[i];
+    if (nodeKeyEqual(node, data, left, right)) {
+      //node already holds its own references to the children
+      if (left)
+        nodeRelease(store, left);
+      if (right)
+        nodeRelease(store, right);
+      node->refCount++;
+      store->stats.hits++;
+      return node;
+    }
+  }
+
+  if ((store->stats.liveNodes + 1) * MAX_LOAD_DENOMINATOR > store->capacity * MAX_LOAD_NUMERATOR) {
+    Error err = nodeStoreGrow(store);
+    if (err)
+      RETURN_WITH_STATUS(err, NULL);
+  }
+
+  Error err = OK;
+  TreeNode* node = nodeAllocBlank(&err);
+  if (err)
+    RETURN_WITH_STATUS(err, NULL);
+
+  node->data     = data;
+  node->left     = left;
+  node->right    = right;
+  node->flags   |= NODE_INTERNED;
+  node->refCount = 1;
+  //an interned node never changes, so its set is computed once
+  nodeDepsUpdate(node);
+  nodeStoreInsert(store, node);
+  return node;
+}
+
+TreeNode* nodeStoreImport(NodeStore* store, TreeNode* node, Error* status) {
+  if (!store ||
+      !node)
+    RETURN_WITH_STATUS(InvalidParameters, NULL);
+  if (IS_INTERNED(node))
+    return nodeShare(node);
+
+  //postorder, interned children wait on results until their parent is made
+  NodeStack stack = {};
+  NodeStack results = {};
+  Error err = nodeStackPush(&stack, {.node = node});
+  while (!err &&
+         stack.count) {
+    NodeFrame* frame = nodeStackTop(&stack);
+    TreeNode* current = frame->node;
+    if (IS_INTERNED(current)) {
+      nodeStackPop(&stack);
+      err = nodeStackPush(&results, {.node = nodeShare(current)});
+      continue;
+    }
+    if (!frame->stage++) {
+      if (current->right)
+        err = nodeStackPush(&stack, {.node = current->right});
+      if (!err && current->left)
+        err = nodeStackPush(&stack, {.node = current->left});
+      continue;
+    }
+
+    nodeStackPop(&stack);
+    TreeNode* right = current->right ? nodeStackTop(&results)->node : NULL;
+    if (current->right)
+      nodeStackPop(&results);
+    TreeNode* left  = current->left  ? nodeStackTop(&results)->node : NULL;
+    if (current->left)
+      nodeStackPop(&results);
+    TreeNode* interned = nodeIntern(store, current->data, left, right, &err);
+    if (!err)
+      err = nodeStackPush(&results, {.node = interned});
+  }
+
+  TreeNode* result = NULL;
+  if (!err)
+    result = nodeStackTop(&results)->node;
+  else
+    while (results.count) {
+      nodeRelease(store, nodeStackTop(&results)->node);
+      nodeStackPop(&results);
+    }
+  nodeStackDestroy(&stack);
+  nodeStackDestroy(&results);
+  if (err)
+    RETURN_WITH_STATUS(err, NULL);
+  return result;
+}
+
+TreeNode* nodeShare(TreeNode* node) {
+  if (!node)
+    return NULL;
+  assert(IS_INTERNED(node));
+
+  node->refCount++;
+  return node;
+}
+
+Error nodeRelease(NodeStore* store, TreeNode* node) {
+  if (!node)
+    return InvalidParameters;
+  if (!IS_INTERNED(node))
+    return nodeDestroy(node, true);
+
+  //nodes going away are chained through parent, which means nothing
+  //for interned nodes, so a long chain doesn't need a deep call stack
+  TreeNode* dead = NULL;
+  if (nodeDropReference(store, node)) {
+    node->parent = NULL;
+    dead = node;
+  }
+  while (dead) {
+    TreeNode* current = dead;
+    dead = current->parent;
+
+    TreeNode* children[] = {current->left, current->right};
+    for (size_t i = 0; i < sizer(children); i++) {
+      TreeNode* child = children[i];
+      if (!child)
+        continue;
+      if (!IS_INTERNED(child)) {
+        nodeDestroy(child, true);
+      } else if (nodeDropReference(store, child)) {
+        child->parent = dead;
+        dead = child;
+      }
+    }
+    nodeFree(current);
+  }
+  return OK;
+}
+
+//True if that was the last reference and the node is out of the table now
+static bool nodeDropReference(NodeStore* store, TreeNode* node) {
+  assert(node);
+
+  if (node->refCount > 1) {
+    node->refCount--;
+    return false;
+  }
+
+  //without the owning store the node can't leave the table,
+  //so it stays there (still holding its children) until nodeStoreDestroy()
+  if (!store) {
+    node->refCount = 0;
+    return false;
+  }
+
+  nodeStoreRemove(store, node);
+  return true;
+}
+
+Error nodeStoreOptimize(NodeStore* store, TreeNode** node) {
+  if (!store ||
+      !node  ||
+      !*node)
+    return InvalidParameters;
+
+  PtrMap memo = {};
+  Error err = ptrMapInit(&memo);
+  if (err)
+    return err;
+
+  TreeNode* result = optimizeShared(store, *node, &memo, &err);
+
+  //memo kept its own reference to every result so none got freed too early
+  for (size_t i = 0; i < memo.capacity; i++) {
+    if (memo.items[i].key)
+      nodeRelease(store, (TreeNode*)(memo.items[i].value & ~(size_t)1));
+  }
+  ptrMapDestroy(&memo);
+  if (err)
+    return err;
+
+  nodeRelease(store, *node);
+  *node = result;
+  return OK;
+}
+
+Error nodeCse(NodeStore* store, TreeNode** node, NodeCseStats* stats) {
+  if (!store ||
+      !node  ||
+      !*node)
+    return InvalidParameters;
+
+  NodeCseStats result = {};
+  result.nodesBefore = nodeCountExpanded(*node);
+
+  Error err = OK;
+  if (!IS_INTERNED(*node)) {
+    TreeNode* dag = nodeStoreImport(store, *node, &err);
+    if (err)
+      return err;
+    nodeDestroy(*node, true);
+    *node = dag;
+  }
+
+  PtrMap uses = {};
+  if ((err = ptrMapInit(&uses)))
+    return err;
+  err = nodeCountUses(*node, &uses);
+  if (!err) {
+    result.nodesAfter = uses.count;
+    for (size_t i = 0; i < uses.capacity; i++) {
+      const TreeNode* n = (const TreeNode*)uses.items[i].key;
+      if (IS_OP(n) && uses.items[i].value > 1)
+        result.sharedTerms++;
+    }
+  }
+  ptrMapDestroy(&uses);
+
+  if (!err && stats)
+    *stats = result;
+  return err;
+}
+
+//Each distinct node is expanded once, the first time an edge leads to it
+Error nodeCountUses(TreeNode* node, PtrMap* uses) {
+  if (!node ||
+      !uses)
+    return InvalidParameters;
+
+  size_t count = 0;
+  bool seen = ptrMapGet(uses, node, &count);
+  Error err = ptrMapSet(uses, node, count);
+  if (err || seen)
+    return err;
+
+  NodeStack stack = {};
+  err = nodeStackPush(&stack, {.node = node});
+  while (!err &&
+         stack.count) {
+    TreeNode* current = nodeStackTop(&stack)->node;
+    nodeStackPop(&stack);
+
+    TreeNode* children[] = {current->left, current->right};
+    for (size_t i = 0; i < sizer(children) && !err; i++) {
+      TreeNode* child = children[i];
+      if (!child)
+        continue;
+      size_t childUses = 0;
+      bool childSeen = ptrMapGet(uses, child, &childUses);
+      err = ptrMapSet(uses, child, childUses + 1);
+      if (!err && !childSeen)
+        err = nodeStackPush(&stack, {.node = child});
+    }
+  }
+
+  nodeStackDestroy(&stack);
+  return err;
+}
+
+//The plain part of the tree is counted node by node,
+//every shared subterm once and then taken from memo
+size_t nodeCountExpanded(TreeNode* node) {
+  PtrMap memo = {};
+  if (ptrMapInit(&memo))
+    return 0;
+
+  size_t count = 0;
+  NodeStack stack = {};
+  Error err = node
+              ? nodeStackPush(&stack, {.node = node})
+              : OK;
+  while (!err &&
+         stack.count) {
+    TreeNode* current = nodeStackTop(&stack)->node;
+    nodeStackPop(&stack);
+    if (IS_INTERNED(current)) {
+      count = nodeCountAdd(count, nodeCountExpandedMemo(current, &memo));
+      continue;
+    }
+
+    count = nodeCountAdd(count, 1);
+    if (current->right)
+      err = nodeStackPush(&stack, {.node = current->right});
+    if (!err && current->left)
+      err = nodeStackPush(&stack, {.node = current->left});
+  }
+
+  nodeStackDestroy(&stack);
+  ptrMapDestroy(&memo);
+  return err
+         ? 0
+         : count;
+}
+
+//Postorder over an interned subterm, children of interned nodes are interned too,
+//so every node's count is in memo by the time its parent needs it
+static size_t nodeCountExpandedMemo(TreeNode* node, PtrMap* memo) {
+  assert(IS_INTERNED(node));
+
+  size_t count = 0;
+  if (ptrMapGet(memo, node, &count))
+    return count;
+
+  NodeStack stack = {};
+  Error err = nodeStackPush(&stack, {.node = node});
+  while (!err &&
+         stack.count) {
+    NodeFrame* frame = nodeStackTop(&stack);
+    TreeNode* current = frame->node;
+    if (ptrMapGet(memo, current)) {
+      nodeStackPop(&stack);
+      continue;
+    }
+    if (!frame->stage++) {
+      if (current->right)
+        err = nodeStackPush(&stack, {.node = current->right});
+      if (!err && current->left)
+        err = nodeStackPush(&stack, {.node = current->left});
+      continue;
+    }
+    nodeStackPop(&stack);
+
+    size_t left  = 0;
+    size_t right = 0;
+    if (current->left)
+      ptrMapGet(memo, current->left,  &left);
+    if (current->right)
+      ptrMapGet(memo, current->right, &right);
+    err = ptrMapSet(memo, current, nodeCountAdd(nodeCountAdd(1, left), right));
+  }
+
+  nodeStackDestroy(&stack);
+  if (err)
+    return SIZE_MAX;
+  ptrMapGet(memo, node, &count);
+  return count;
+}
+
+//Saturates at SIZE_MAX
+static size_t nodeCountAdd(size_t a, size_t b) {
+  return (a > SIZE_MAX - b)
+         ? SIZE_MAX
+         : a + b;
+}
+
+//Postorder with an explicit stack, NodeFrame::level is underPow.
+//memo maps (node, underPow) to its result, which parents take their operands from.
+//The key is tagged with underPow, since (1/n) is only kept as is under a power,
+//and the value with whether the result is fresh (see rewriteSimplifyStep())
+static TreeNode* optimizeShared(NodeStore* store, TreeNode* node,
+                                PtrMap* memo, Error* status) {
+  assert(store && node && memo);
+
+  NodeStack stack = {};
+  Error err = nodeStackPush(&stack, {.node = node});
+  while (!err &&
+         stack.count) {
+    NodeFrame* frame = nodeStackTop(&stack);
+    TreeNode* current = frame->node;
+    bool underPow = frame->level;
+    const void* key = (const void*)((uintptr_t)current | (uintptr_t)underPow);
+    if (ptrMapGet(memo, key)) {
+      nodeStackPop(&stack);
+      continue;
+    }
+
+    bool isPow = OF_OP(current, OP_POW);
+    if (IS_OP(current) &&
+        !frame->stage++) {
+      if (current->right)
+        err = nodeStackPush(&stack, {.node = current->right, .level = isPow});
+      if (!err && current->left)
+        err = nodeStackPush(&stack, {.node = current->left,  .level = isPow});
+      continue;
+    }
+    nodeStackPop(&stack);
+
+    bool isFresh = false;
+    TreeNode* result = NULL;
+    if (!IS_OP(current)) {
+      result = nodeShare(current);
+    } else {
+      bool isLeftFresh  = false;
+      bool isRightFresh = false;
+      TreeNode* left  = optimizeSharedTake(memo, current->left,  isPow, &isLeftFresh);
+      TreeNode* right = optimizeSharedTake(memo, current->right, isPow, &isRightFresh);
+      result = simplifyShared(store, current->data.value.op, left, right, underPow,
+                              isLeftFresh || isRightFresh, &isFresh, &err);
+      if (err)
+        break;
+    }
+    //memo holds the only reference until a parent takes one
+    if ((err = ptrMapSet(memo, key, (size_t)result | isFresh)))
+      nodeRelease(store, result);
+  }
+
+  nodeStackDestroy(&stack);
+  if (err)
+    RETURN_WITH_STATUS(err, NULL);
+  bool isFresh = false;
+  return optimizeSharedTake(memo, node, false, &isFresh);
+}
+
+//A new reference to the result of (node, underPow), NULL for no node
+static TreeNode* optimizeSharedTake(PtrMap* memo, TreeNode* node, bool underPow,
+                                    bool* isFresh) {
+  assert(memo && isFresh);
+
+  const void* key = (const void*)((uintptr_t)node | (uintptr_t)underPow);
+  size_t value = 0;
+  *isFresh = false;
+  if (!node ||
+      !ptrMapGet(memo, key, &value))
+    return NULL;
+
+  *isFresh = value & 1;
+  return nodeShare((TreeNode*)(value & ~(size_t)1));
+}
+
+//Children are already optimized. Takes rewriteSimplifyStep() until nothing
+//applies, like nodeSimplifyLocal() in node.cpp, but on a probe with the
+//would-be node's operands, so only the final node gets interned
+static TreeNode* simplifyShared(NodeStore* store, OpType op,
+                                TreeNode* left, TreeNode* right, bool underPow,
+                                bool isFresh, bool* isResultFresh, Error* status) {
+  assert(isResultFresh);
+
+  *isResultFresh = false;
+  while (true) {
+    TreeNode probe = {
+      .data  = {.type = OP_TYPE, .value = {.op = op}},
+      .left  = left,
+      .right = right
+    };
+    SimplifyStep step = rewriteSimplifyStep(&probe, underPow, isFresh);
+    if (step.action == SIMPLIFY_KEEP)
+      return nodeIntern(store, probe.data, left, right, status);
+
+    if (step.result.kind == REWRITE_RESULT_NUM) {
+      nodeRelease(store, left);
+      nodeRelease(store, right);
+      //a number folded out of fresh ones is just as fresh
+      *isResultFresh = (step.action == SIMPLIFY_NEUTRAL) || isFresh;
+      return nodeIntern(store, (NodeUnit){.type = NUM_TYPE,
+                                          .value = {.num = step.result.num}},
+                        NULL, NULL, status);
+    }
+    assert(step.result.kind == REWRITE_RESULT_SLOT);
+    TreeNode* kept = step.result.slot;
+    nodeRelease(store, (kept == left) ? right : left);
+    *isResultFresh = true;
+    //same operands under another parent: only a 1/n root can change its mind
+    if (!IS_OP(kept) ||
+        rewriteSimplifyStep(kept, underPow, false).action == SIMPLIFY_KEEP)
+      return kept;
+
+    op    = kept->data.value.op;
+    left  = nodeShare(kept->left);
+    right = nodeShare(kept->right);
+    nodeRelease(store, kept);
+    isFresh = false;
+  }
+}
+
+static ulong nodeKeyHash(NodeUnit data, const TreeNode* left, const TreeNode* right) {
+  uint64_t value = 0;
+  switch (data.type) {
+    case NUM_TYPE: memcpy(&value, &data.value.num, sizeof(value)); break;
+    case VAR_TYPE: value = data.value.var;                          break;
+    case OP_TYPE:  value = (uint64_t)data.value.op;                 break;
+    default:       break;
+  }
+
+  uint64_t h = (uint64_t)data.type;
+  h = (h ^ value)            * 0x9E3779B97F4A7C15ull;
+  h = (h ^ (uintptr_t)left)  * 0xC2B2AE3D27D4EB4Full;
+  h = (h ^ (uintptr_t)right) * 0x165667B19E3779F9ull;
+  return h ^ (h >> 29);
+}
+
+static bool nodeKeyEqual(const TreeNode* node, NodeUnit data,
+                         const TreeNode* left, const TreeNode* right) {
+  if (node->data.type != data.type ||
+      node->left  != left ||
+      node->right != right)
+    return false;
+
+  switch (data.type) {
+    case NUM_TYPE:
+      return memcmp(&node->data.value.num, &data.value.num, sizeof(double)) == 0;
+    case VAR_TYPE:
+      return node->data.value.var == data.value.var;
+    case OP_TYPE:
+      return node->data.value.op == data.value.op;
+    default:
+      return true;
+  }
+}
+
+static Error nodeStoreGrow(NodeStore* store) {
+  size_t newCapacity = store->capacity * 2;
+  TreeNode** table = (TreeNode**)calloc(newCapacity, sizeof(TreeNode*));
+  if (!table)
+    return FailMemoryAllocation;
+
+  TreeNode** oldTable = store->table;
+  size_t oldCapacity  = store->capacity;
+  store->table = table;
+  store->capacity = newCapacity;
+  store->stats.liveNodes = 0;
+  for (size_t i = 0; i < oldCapacity; i++) {
+    if (oldTable[i])
+      nodeStoreInsert(store, oldTable[i]);
+  }
+  free(oldTable);
+  return OK;
+}
+
+static void nodeStoreInsert(NodeStore* store, TreeNode* node) {
+  size_t mask = store->capacity - 1;
+  size_t i = nodeKeyHash(node->data, node->left, node->right) & mask;
+  while (store->table[i])
+    i = (i + 1) & mask;
+  store->table[i] = node;
+
+  if (++store->stats.liveNodes > store->stats.peakNodes)
+    store->stats.peakNodes = store->stats.liveNodes;
+}
+
+//Backward shift deletion, so lookups never need tombstones
+static void nodeStoreRemove(NodeStore* store, TreeNode* node) {
+  size_t mask = store->capacity - 1;
+  size_t i = nodeKeyHash(node->data, node->left, node->right) & mask;
+  while (store->table[i] != node) {
+    if (!store->table[i])
+      return;
+    i = (i + 1) & mask;
+  }
+
+  store->table[i] = NULL;
+  store->stats.liveNodes--;
+  for (size_t j = (i + 1) & mask; store->table[j]; j = (j + 1) & mask) {
+    TreeNode* moved = store->table[j];
+    size_t home = nodeKeyHash(moved->data, moved->left, moved->right) & mask;
+    //moved can fill the hole only if the hole lies between its home and j
+    bool canMove = (i <= j)
+                   ? (home <= i || home > j)
+                   : (home <= i && home > j);
+    if (canMove) {
+      store->table[i] = moved;
+      store->table[j] = NULL;
+      i = j;
+    }
+  }
+}
+
+#undef RETURN_WITH_STATUS
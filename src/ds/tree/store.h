@@ -0,0 +1,75 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "ds/tree/node.h"
+#include "ds/map/ptrmap.h"
+
+const size_t NODE_STORE_DEFAULT_CAPACITY = 1024;
+
+struct NodeCseStats {
+  size_t nodesBefore = 0; //nodes of the expression written out as a tree
+  size_t nodesAfter  = 0; //distinct nodes of its DAG
+  size_t sharedTerms = 0; //distinct operator nodes used more than once
+};
+
+struct NodeStoreStats {
+  size_t lookups   = 0; //nodeIntern() calls
+  size_t hits      = 0; //of those, how many returned an existing node
+  size_t liveNodes = 0; //distinct nodes currently stored
+  size_t peakNodes = 0;
+};
+
+///Hash-consing table: structurally equal nodes are stored only once
+///and shared between every tree (DAG actually) that refers to them.
+///Since children are interned before their parents, equality is
+///(type, value, left pointer, right pointer).
+struct NodeStore {
+  TreeNode** table = NULL;
+  size_t capacity = 0; //always a power of two
+  NodeStoreStats stats = {};
+};
+
+Error nodeStoreInit(NodeStore* store, size_t initialCapacity = NODE_STORE_DEFAULT_CAPACITY);
+NodeStore* nodeStoreAlloc(size_t initialCapacity = NODE_STORE_DEFAULT_CAPACITY,
+                          Error* status = NULL);
+///Frees every node still in the store, no matter the reference count
+Error nodeStoreDestroy(NodeStore* store, bool isAlloced = false);
+
+///While a store is bound (per thread) nodeAlloc() interns instead of allocating,
+///nodeCopy() shares (imports a plain tree) and nodeDestroy() releases a reference.
+///Returns the previously bound store
+NodeStore* nodeStoreBind(NodeStore* store);
+NodeStore* nodeStoreBound();
+
+///Returns the node equal to (data, left, right) with one more reference.
+///Takes over the caller's references to left and right
+TreeNode* nodeIntern(NodeStore* store, NodeUnit data,
+                     TreeNode* left, TreeNode* right,
+                     Error* status = NULL);
+///Interns a plain tree bottom up, the tree itself is left untouched
+TreeNode* nodeStoreImport(NodeStore* store, TreeNode* node, Error* status = NULL);
+///O(1) copy of an interned node
+TreeNode* nodeShare(TreeNode* node);
+///Drops a reference, node and its children's references go away at zero
+Error nodeRelease(NodeStore* store, TreeNode* node);
+///Same steps as nodeOptimize() (rewriteSimplifyStep()) but rebuilds the DAG
+///instead of rewriting shared nodes in place. Every shared subterm is visited once
+Error nodeStoreOptimize(NodeStore* store, TreeNode** node);
+
+///Common subexpression elimination: replaces the tree *node with its DAG
+///in store, so every structurally equal subtree exists once
+///(the evaluator and nodeToTexNamed() compute and print those once too).
+///An already interned *node is only measured
+Error nodeCse(NodeStore* store, TreeNode** node, NodeCseStats* stats = NULL);
+///uses[n] = number of edges into every distinct node reachable from node,
+///a node hanging off both sides of one parent counts twice, node itself gets 0
+Error nodeCountUses(TreeNode* node, PtrMap* uses);
+///Nodes of the expression written out as a tree, shared subterms counted
+///once per use (saturates at SIZE_MAX)
+size_t nodeCountExpanded(TreeNode* node);
+
+#define IS_INTERNED(node) ((node) && ((node)->flags & NODE_INTERNED))
+
+#endif
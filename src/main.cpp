@@ -1,32 +1,42 @@
 #include "diff/derivative.h"
 #include "diff/io/io.h"
 #include "diff/io/parse.h"
+#include "diff/io/formulas.h"
 #include "diff/context.h"
 #include "ds/tree/dump/dump.h"
 
 //TODO: adapt eval for trees (arcsin, sin, log...)!
-//TODO: calculation with given var values
-//TODO: Taylor Series
-//TODO: partial derivative
 //TODO: total derivative
-int main() {
+int main(int argc, char** argv) {
+  //batch mode: diff [formulas file] [var], one formula per line, TeX to stdout
+  if (argc > 1) {
+    FormulaBatchStats stats = {};
+    Error err = formulaBatchRun(argv[1], stdout, argc > 2 ? argv[2] : "x",
+                                0, FORMULA_BATCH_DEFAULT_CHUNK_BYTES, &stats);
+    fprintf(stderr, "%zu formulas, %zu failed, %zu chunks, %zu bytes\n",
+            stats.formulas, stats.failed, stats.chunks, stats.bytes);
+    if (err)
+      prettyError(stderr, err);
+    return err ? 1 : 0;
+  }
+
   FILE* f = fopen(".test/parse_test.txt", "r");
   if (!f)
     return 1;
   
-  char* buffer = NULL;
-  size_t bufferSize = 0;
-  if (readBufferFromFile(f, &buffer, &bufferSize))
+  Input input = {};
+  if (inputOpen(&input, f)) {
+    fclose(f);
     return 1; 
-
-  fclose(f);
+  }
 
   Context ctx = {0};
   contextInit(&ctx, 32);
   openTexFile(&ctx);
 
-  TreeNode* tree = parseFormula(buffer, ctx.vars); 
-  free(buffer);
+  TreeNode* tree = parseFormula(&input, ctx.vars); 
+  inputClose(&input);
+  fclose(f);
 
   FILE* log = openHtmlLogFile();
   if (!log)
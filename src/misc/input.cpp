@@ -0,0 +1,157 @@
+#include "misc/input.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+static bool inputOpenMapped(Input* input, FILE* file);
+static bool inputFill(Input* input, size_t pos);
+
+Error inputOpenMemory(Input* input, const char* data, size_t size) {
+  if (!input ||
+      (!data && size))
+    return InvalidParameters;
+
+  *input = {
+    .kind = INPUT_MEMORY,
+    .data = data,
+    .size = size,
+    .isEof = true
+  };
+  return OK;
+}
+
+Error inputOpen(Input* input, FILE* file, size_t windowSize) {
+  if (!input ||
+      !file  ||
+      !windowSize)
+    return InvalidParameters;
+
+  if (inputOpenMapped(input, file))
+    return OK;
+
+  char* window = (char*)calloc(windowSize, sizeof(char));
+  if (!window)
+    return FailMemoryAllocation;
+  *input = {
+    .kind     = INPUT_STREAM,
+    .file     = file,
+    .data     = window,
+    .window   = window,
+    .capacity = windowSize
+  };
+  return OK;
+}
+
+Error inputClose(Input* input) {
+  if (!input)
+    return InvalidParameters;
+
+  if (input->map)
+    munmap(input->map, input->mapSize);
+  free(input->window);
+  *input = {};
+  return OK;
+}
+
+bool inputHas(Input* input, size_t pos) {
+  assert(input);
+
+  if (pos < input->offset)
+    return false;
+  if (pos - input->offset < input->size)
+    return true;
+  return inputFill(input, pos);
+}
+
+void inputRelease(Input* input, size_t pos) {
+  assert(input);
+
+  if (pos > input->released)
+    input->released = pos;
+}
+
+const char* inputView(Input* input, size_t pos, size_t want, size_t* available) {
+  assert(input && available);
+
+  *available = 0;
+  if (!inputHas(input, pos))
+    return NULL;
+  //loads as much of [pos, pos + want) as the window takes
+  if (want)
+    inputHas(input, pos + want - 1);
+
+  size_t inMemory = input->offset + input->size - pos;
+  *available = inMemory < want
+               ? inMemory
+               : want;
+  return input->data + (pos - input->offset);
+}
+
+//Regular files only, false means it has to be streamed
+static bool inputOpenMapped(Input* input, FILE* file) {
+  assert(input && file);
+
+  struct stat st = {};
+  long at = ftell(file);
+  if (fstat(fileno(file), &st) ||
+      !S_ISREG(st.st_mode) ||
+      at < 0 ||
+      at > st.st_size)
+    return false;
+
+  size_t mapSize = (size_t)st.st_size;
+  if (mapSize == (size_t)at)
+    return !inputOpenMemory(input, NULL, 0);
+
+  void* map = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+  if (map == MAP_FAILED)
+    return false;
+  //parsers go through it front to back
+  madvise(map, mapSize, MADV_SEQUENTIAL);
+
+  *input = {
+    .kind    = INPUT_MAPPED,
+    .data    = (const char*)map + at,
+    .size    = mapSize - (size_t)at,
+    .map     = map,
+    .mapSize = mapSize,
+    .isEof   = true
+  };
+  return true;
+}
+
+//Moves what is still needed to the front of the window and reads
+//until pos fits or the stream ends
+static bool inputFill(Input* input, size_t pos) {
+  assert(input);
+
+  if (input->isEof ||
+      input->kind != INPUT_STREAM)
+    return false;
+
+  size_t keep = input->released > input->offset
+                ? input->released - input->offset
+                : 0;
+  if (keep > input->size)
+    keep = input->size;
+  if (pos - (input->offset + keep) >= input->capacity)
+    return false; //wouldn't fit even in an empty window
+
+  if (keep) {
+    memmove(input->window, input->window + keep, input->size - keep);
+    input->offset += keep;
+    input->size   -= keep;
+  }
+  while (pos - input->offset >= input->size) {
+    size_t read = fread(input->window + input->size, sizeof(char),
+                        input->capacity - input->size, input->file);
+    input->size += read;
+    if (!read) {
+      input->isEof = true;
+      return false;
+    }
+  }
+  return true;
+}
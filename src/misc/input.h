@@ -0,0 +1,59 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "error/error.h"
+
+//Stream window, also the longest token a stream can have
+const size_t INPUT_DEFAULT_WINDOW = 1 << 16;
+
+enum InputKind {
+  INPUT_MEMORY, //somebody else's buffer
+  INPUT_MAPPED, //regular file, mmapped read-only as a whole
+  INPUT_STREAM, //pipe, tty, stdin...: read through a window of fixed size
+};
+
+///Read-only input addressed by absolute positions, whatever it comes from.
+///Only [offset, offset + size) is in memory at a time. For streams the
+///window is refilled on demand and everything before the released
+///position is dropped, so memory stays at windowSize however long it is
+struct Input {
+  InputKind kind = INPUT_MEMORY;
+  FILE* file = NULL;       //INPUT_STREAM
+  const char* data = NULL; //bytes from offset on
+  size_t size   = 0;
+  size_t offset = 0;
+  size_t released = 0;     //nothing before it is needed anymore
+  char*  window   = NULL;  //INPUT_STREAM, owned
+  size_t capacity = 0;
+  void*  map     = NULL;   //INPUT_MAPPED, owned
+  size_t mapSize = 0;
+  bool isEof = false;
+};
+
+Error inputOpenMemory(Input* input, const char* data, size_t size);
+///Maps file if it is a regular one, reads it through a window otherwise.
+///Starts at file's current position, file stays open and owned by the caller
+Error inputOpen(Input* input, FILE* file, size_t windowSize = INPUT_DEFAULT_WINDOW);
+Error inputClose(Input* input);
+
+///Reads more of a stream if pos isn't in memory yet, false past the end
+bool inputHas(Input* input, size_t pos);
+///Nothing before pos is read anymore
+void inputRelease(Input* input, size_t pos);
+///Contiguous bytes from pos on, *available of them (want at most,
+///fewer only at the end of the input or if want exceeds the window)
+const char* inputView(Input* input, size_t pos, size_t want, size_t* available);
+
+///Char at pos, '\0' past the end
+static inline char inputChar(Input* input, size_t pos) {
+  size_t i = pos - input->offset;
+  if (i < input->size)
+    return input->data[i];
+  return inputHas(input, pos)
+         ? input->data[pos - input->offset]
+         : '\0';
+}
+
+#endif
@@ -0,0 +1,155 @@
+#include "misc/output.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <charconv>
+#include <assert.h>
+
+static const size_t OUTPUT_INITIAL_CAPACITY = 1 << 10;
+static const size_t OUTPUT_NUMBER_MAX_LENGTH = 32;
+//%lg keeps 6 significant digits, so integers below this come out as they are
+static const double OUTPUT_EXACT_INTEGER_LIMIT = 1e6;
+static const int OUTPUT_DOUBLE_PRECISION = 6;
+
+static bool outputReserve(Output* output, size_t length);
+
+Error outputFlush(Output* output) {
+  if (!output)
+    return InvalidParameters;
+
+  Error err = output->err;
+  if (!err && output->size) {
+    if (!output->sink)
+      err = NullPointerField;
+    else if (fwrite(output->data, sizeof(char), output->size, output->sink) != output->size)
+      err = EndOfFile;
+  }
+  output->size = 0;
+  output->err  = OK;
+  return err;
+}
+
+Error outputDestroy(Output* output) {
+  if (!output)
+    return InvalidParameters;
+
+  free(output->data);
+  *output = {};
+  return OK;
+}
+
+void outputPut(Output* output, const char* str, size_t length) {
+  assert(output && (str || !length));
+
+  if (output->err ||
+      !length)
+    return;
+  if (output->limit &&
+      length > output->limit - output->size) {
+    output->isCut = true;
+    return;
+  }
+  if (outputReserve(output, length)) {
+    memcpy(output->data + output->size, str, length);
+    output->size += length;
+    return;
+  }
+  //wouldn't fit even in an empty block, the buffer is empty by now
+  if (!output->err &&
+      fwrite(str, sizeof(char), length, output->sink) != length)
+    output->err = EndOfFile;
+}
+
+void outputPuts(Output* output, const char* str) {
+  assert(str);
+
+  outputPut(output, str, strlen(str));
+}
+
+void outputLimit(Output* output, size_t length) {
+  assert(output);
+
+  output->isCut = false;
+  if (!outputReserve(output, length)) {
+    if (!output->err)
+      output->err = InvalidParameters; //more than a block
+    return;
+  }
+  output->limit = output->size + length;
+}
+
+void outputUnlimit(Output* output) {
+  assert(output);
+
+  output->limit = 0;
+  output->isCut = false;
+}
+
+void outputRewind(Output* output, size_t size) {
+  assert(output);
+
+  if (size < output->size)
+    output->size = size;
+}
+
+size_t outputDouble(Output* output, double value) {
+  char buffer[OUTPUT_NUMBER_MAX_LENGTH] = {};
+  char* end = NULL;
+  //integers are what derivatives are mostly made of, -0 isn't one for %lg
+  if (fabs(value) < OUTPUT_EXACT_INTEGER_LIMIT &&
+      !(fabs(value - trunc(value)) > 0) &&
+      (value < 0 || !signbit(value)))
+    end = std::to_chars(buffer, buffer + sizeof(buffer), (long)value).ptr;
+  else
+    end = std::to_chars(buffer, buffer + sizeof(buffer), value,
+                        std::chars_format::general, OUTPUT_DOUBLE_PRECISION).ptr;
+
+  size_t length = (size_t)(end - buffer);
+  outputPut(output, buffer, length);
+  return length;
+}
+
+size_t outputSize(Output* output, size_t value) {
+  char buffer[OUTPUT_NUMBER_MAX_LENGTH] = {};
+  char* end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+
+  size_t length = (size_t)(end - buffer);
+  outputPut(output, buffer, length);
+  return length;
+}
+
+//True if length more bytes fit after growing the buffer or writing it out
+static bool outputReserve(Output* output, size_t length) {
+  assert(output);
+
+  if (output->size + length <= output->capacity)
+    return true;
+  if (output->capacity < OUTPUT_BLOCK_SIZE) {
+    size_t capacity = output->capacity
+                      ? output->capacity
+                      : OUTPUT_INITIAL_CAPACITY;
+    while (capacity < output->size + length &&
+           capacity < OUTPUT_BLOCK_SIZE)
+      capacity *= 2;
+    char* data = (char*)realloc(output->data, capacity);
+    if (!data) {
+      output->err = FailMemoryAllocation;
+      return false;
+    }
+    output->data     = data;
+    output->capacity = capacity;
+    if (output->size + length <= capacity)
+      return true;
+  }
+
+  if (!output->sink) {
+    output->err = NullPointerField;
+    return false;
+  }
+  if (fwrite(output->data, sizeof(char), output->size, output->sink) != output->size) {
+    output->err = EndOfFile;
+    return false;
+  }
+  output->size = 0;
+  return length <= output->capacity;
+}
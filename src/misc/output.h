@@ -0,0 +1,52 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "error/error.h"
+
+//The buffer grows up to this and is written out once it is full
+const size_t OUTPUT_BLOCK_SIZE = 1 << 16;
+
+///Write-side counterpart of Input: text is built in memory and goes to
+///sink in blocks of up to OUTPUT_BLOCK_SIZE instead of a stdio call per
+///piece. The first error (allocation or a short write) sticks in err and
+///makes every later put a no-op until outputFlush() reports it
+struct Output {
+  FILE* sink = NULL;
+  char* data = NULL; //owned, kept between flushes
+  size_t size     = 0;
+  size_t capacity = 0;
+  size_t limit = 0;    //size puts may not take the buffer past, 0 is none
+  bool isCut = false;  //a put was dropped because of limit
+  Error err = OK;
+};
+
+///Writes out whatever is buffered, returns err (which is reset)
+Error outputFlush(Output* output);
+Error outputDestroy(Output* output);
+
+void outputPut(Output* output, const char* str, size_t length);
+void outputPuts(Output* output, const char* str);
+///Until outputUnlimit(), a put that wouldn't fit into length more bytes is
+///dropped and sets isCut. Those bytes are reserved, so nothing is written
+///out meanwhile and outputRewind() can still take any of them back
+void outputLimit(Output* output, size_t length);
+void outputUnlimit(Output* output);
+///Drops whatever was put after the first size bytes of the buffer
+void outputRewind(Output* output, size_t size);
+
+///Same text as printf("%lg") would produce, returns its length
+size_t outputDouble(Output* output, double value);
+///Same text as printf("%zu") would produce, returns its length
+size_t outputSize(Output* output, size_t value);
+
+static inline void outputPutc(Output* output, char c) {
+  if (output->size < output->capacity &&
+      !output->limit)
+    output->data[output->size++] = c;
+  else
+    outputPut(output, &c, 1);
+}
+
+#endif
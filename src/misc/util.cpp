@@ -3,7 +3,6 @@
 #include <string.h>
 #include <time.h>
 #include <stdlib.h>
-#include <sys/stat.h>
 #include <float.h>
 
 static const size_t TIMESTAMP_LEN = 128;
@@ -43,25 +42,3 @@ char* getTimestampedString(const char* prefix, const char* suffix, uint count) {
 }
 #undef DEFER
 #undef REMAINING_LEN
-
-Error readBufferFromFile(FILE* file,
-                         char** bufferPtr, size_t* trueBufferSizePtr) {
-  if (!file ||
-      !bufferPtr ||
-      !trueBufferSizePtr)
-    return InvalidParameters;
-
-  struct stat fileStats = {0};
-  fstat(file->_fileno, &fileStats);
-  size_t bufferSize = (size_t) fileStats.st_size;
-  char* buffer = (char*) calloc(bufferSize + 1, sizeof(char)); // + 1 for NULL terminating character
-  if (!buffer)
-    return FailMemoryAllocation;
-
-  bufferSize = fread(buffer, sizeof(char), bufferSize, file);
-
-  *trueBufferSizePtr = bufferSize;
-  *bufferPtr = buffer;
-
-  return OK;
-}
@@ -18,7 +18,4 @@ bool doubleEqual(double a, double b);
 
 char* getTimestampedString(const char* prefix, const char* suffix, uint count = 0);
 
-Error readBufferFromFile(FILE* file,
-                         char** bufferPtr, size_t* trueBufferSizePtr);
-
 #endif